@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../common/image_io.h"
+#include "../common/splitmerge.h"
+#include "../common/cli.h"
+#include "../common/spsc_queue.hpp"
+#include "../common/buffer_pool.h"
+
+// Batch driver: segments every image of a directory or manifest in one
+// process. Each lane is a loader -> worker -> writer pipeline joined by
+// bounded SPSC queues, with a fixed set of jobs circulating back from the
+// writer to the loader, so buffers are reused rather than reallocated and
+// one image's I/O overlaps another's segmentation. Lanes claim input files
+// from a shared counter, which balances uneven image sizes.
+
+#define OPTIONS (CLI_CONNECTIVITY | CLI_THRESHOLD | CLI_ENGINE | CLI_LABEL_BYTES | CLI_METRICS | CLI_TRACE)
+
+struct Job {
+    Image img;
+    size_t img_capacity;
+    sm_result result;
+    size_t index;           // into the input list
+    bool ok;
+};
+
+struct Lane {
+    SpscQueue<Job *> loaded;
+    SpscQueue<Job *> segmented;
+    SpscQueue<Job *> free_jobs;
+    std::vector<Job> jobs;
+    size_t images, pixels, failed;
+    // Each stage records its own phases, so the three threads never share one
+    sm_metrics load_metrics, segment_metrics, write_metrics;
+
+    explicit Lane(size_t depth)
+        : loaded(depth), segmented(depth), free_jobs(depth), jobs(depth), images(0), pixels(0), failed(0) {
+        for (size_t i = 0; i < depth; i++) {
+            memset(&jobs[i], 0, sizeof(Job));
+            free_jobs.push(&jobs[i]);
+        }
+        sm_metrics_init(&load_metrics, 0);
+        sm_metrics_init(&segment_metrics, 0);
+        sm_metrics_init(&write_metrics, 0);
+    }
+
+    ~Lane() {
+        for (size_t i = 0; i < jobs.size(); i++) {
+            pool_free(jobs[i].img.data, jobs[i].img_capacity);
+            sm_result_release(&jobs[i].result);
+        }
+        sm_metrics_free(&load_metrics);
+        sm_metrics_free(&segment_metrics);
+        sm_metrics_free(&write_metrics);
+    }
+};
+
+struct Batch {
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::atomic<size_t> next;
+    sm_params params;
+    bool metrics;
+};
+
+static void load_stage(Batch *batch, Lane *lane) {
+    sm_metrics *m = batch->metrics ? &lane->load_metrics : NULL;
+    for (;;) {
+        size_t i = batch->next.fetch_add(1);
+        if (i >= batch->inputs.size())
+            break;
+        Job *job = lane->free_jobs.pop();
+        job->index = i;
+        sm_mark start = sm_metrics_start(m);
+        job->ok = read_pgm_into(batch->inputs[i].c_str(), &job->img, &job->img_capacity) == 0;
+        sm_metrics_stop(m, SM_PHASE_READ, start);
+        lane->loaded.push(job);
+    }
+    lane->loaded.push(NULL);
+}
+
+static void segment_stage(Batch *batch, Lane *lane) {
+    sm_params params = batch->params;
+    sm_metrics *m = batch->metrics ? &lane->segment_metrics : NULL;
+    params.metrics = m;
+    for (Job *job; (job = lane->loaded.pop()) != NULL; ) {
+        if (job->ok) {
+            // The label buffer from the previous image is reused when it is
+            // big enough; otherwise the library replaces it with a larger one
+            int err = sm_segment(&job->img, &params, &job->result);
+            if (err != SM_OK) {
+                fprintf(stderr, "%s: %s\n", batch->inputs[job->index].c_str(), sm_strerror(err));
+                job->ok = false;
+            } else {
+                sm_mark start = sm_metrics_start(m);
+                size_t n = (size_t)job->img.width * job->img.height;
+                if (job->result.label_bytes == 8) {
+                    const uint64_t *labels = (const uint64_t *)job->result.labels;
+                    for (size_t i = 0; i < n; i++)
+                        job->img.data[i] = labels[i] % 1024;
+                } else {
+                    const uint32_t *labels = (const uint32_t *)job->result.labels;
+                    for (size_t i = 0; i < n; i++)
+                        job->img.data[i] = labels[i] % 1024;
+                }
+                job->img.maxval = 255;
+                sm_metrics_stop(m, SM_PHASE_RENDER, start);
+            }
+        }
+        lane->segmented.push(job);
+    }
+    lane->segmented.push(NULL);
+}
+
+static void write_stage(Batch *batch, Lane *lane) {
+    sm_metrics *m = batch->metrics ? &lane->write_metrics : NULL;
+    for (Job *job; (job = lane->segmented.pop()) != NULL; ) {
+        if (job->ok) {
+            // A failed write is reported and counted like a failed read
+            sm_mark start = sm_metrics_start(m);
+            job->ok = write_pgm_file(batch->outputs[job->index].c_str(), &job->img) == 0;
+            sm_metrics_stop(m, SM_PHASE_WRITE, start);
+        }
+        if (job->ok) {
+            lane->images++;
+            lane->pixels += (size_t)job->img.width * job->img.height;
+        } else {
+            lane->failed++;
+        }
+        lane->free_jobs.push(job);
+    }
+}
+
+static bool has_image_suffix(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return dot && (strcmp(dot, ".pgm") == 0 || strcmp(dot, ".ppm") == 0);
+}
+
+// A directory contributes its .pgm/.ppm files; anything else is read as a
+// manifest with one path per line
+static int list_inputs(const char *source, std::vector<std::string> &inputs) {
+    DIR *dir = opendir(source);
+    if (dir) {
+        for (struct dirent *e; (e = readdir(dir)) != NULL; )
+            if (has_image_suffix(e->d_name))
+                inputs.push_back(std::string(source) + "/" + e->d_name);
+        closedir(dir);
+        std::sort(inputs.begin(), inputs.end());
+        return 0;
+    }
+    FILE *fp = fopen(source, "r");
+    if (!fp)
+        return -1;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] && line[0] != '#')
+            inputs.push_back(line);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static std::string output_path(const char *outdir, const std::string &input) {
+    size_t slash = input.find_last_of('/');
+    std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos)
+        name.erase(dot);
+    return std::string(outdir) + "/" + name + ".pgm";
+}
+
+// Inputs that differ only in directory or extension (a.pgm and a.ppm) would
+// overwrite each other's output; report every such pair
+static int check_outputs(const std::vector<std::string> &inputs, const std::vector<std::string> &outputs) {
+    std::vector<size_t> order(outputs.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return outputs[a] < outputs[b]; });
+    int clashes = 0;
+    for (size_t i = 1; i < order.size(); i++) {
+        if (outputs[order[i]] == outputs[order[i - 1]]) {
+            fprintf(stderr, "%s and %s both write %s\n", inputs[order[i - 1]].c_str(),
+                    inputs[order[i]].c_str(), outputs[order[i]].c_str());
+            clashes++;
+        }
+    }
+    return clashes ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s input_dir|manifest.txt output_dir [options]\n", prog);
+    printf("  --lanes=N                          parallel pipelines (default: one per core)\n");
+    printf("  --depth=N                          images in flight per lane (default 4)\n");
+    print_options(OPTIONS);
+}
+
+int main(int argc, char *argv[]) {
+    cli_options opts;
+    default_options(&opts);
+    opts.params.engine = SM_ENGINE_UNION_FIND;
+    int lanes = (int)std::thread::hardware_concurrency();
+    int depth = 4;
+    std::vector<char *> rest;
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--lanes=", 8) == 0)
+            lanes = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--depth=", 8) == 0)
+            depth = atoi(argv[i] + 8);
+        else
+            rest.push_back(argv[i]);
+    }
+    if (argc < 3 || parse_options((int)rest.size(), rest.data(), 0, OPTIONS, &opts) != 0 || depth < 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (lanes < 1)
+        lanes = 1;
+
+    Batch batch;
+    batch.params = opts.params;
+    batch.metrics = opts.metrics || opts.trace_path;
+    start_trace(&opts);
+    batch.next = 0;
+    if (list_inputs(argv[1], batch.inputs) != 0) {
+        perror("Error opening input list");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < batch.inputs.size(); i++)
+        batch.outputs.push_back(output_path(argv[2], batch.inputs[i]));
+    if (check_outputs(batch.inputs, batch.outputs) != 0)
+        exit(EXIT_FAILURE);
+    if ((size_t)lanes > batch.inputs.size())
+        lanes = batch.inputs.size() > 0 ? (int)batch.inputs.size() : 1;
+    // Lanes already run one image per core; the OpenMP engine gets an equal
+    // share of the cores per lane instead of a full team each
+    if (batch.params.engine == SM_ENGINE_OPENMP && batch.params.num_threads == 0) {
+        int cores = (int)std::thread::hardware_concurrency();
+        batch.params.num_threads = cores > lanes ? cores / lanes : 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Lane *> pipeline;
+    std::vector<std::thread> threads;
+    for (int l = 0; l < lanes; l++) {
+        Lane *lane = new Lane(depth);
+        pipeline.push_back(lane);
+        threads.emplace_back(load_stage, &batch, lane);
+        threads.emplace_back(segment_stage, &batch, lane);
+        threads.emplace_back(write_stage, &batch, lane);
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // --metrics: phases summed over lanes, one "threads" entry per lane
+    sm_metrics metrics;
+    sm_metrics_init(&metrics, lanes);
+    size_t images = 0, pixels = 0, failed = 0;
+    for (int l = 0; l < lanes; l++) {
+        images += pipeline[l]->images;
+        pixels += pipeline[l]->pixels;
+        failed += pipeline[l]->failed;
+        sm_phase_times_add(&metrics.threads[l], &pipeline[l]->load_metrics.phases);
+        sm_phase_times_add(&metrics.threads[l], &pipeline[l]->segment_metrics.phases);
+        sm_phase_times_add(&metrics.threads[l], &pipeline[l]->write_metrics.phases);
+        sm_phase_times_add(&metrics.phases, &metrics.threads[l]);
+        delete pipeline[l];
+    }
+    if (opts.metrics)
+        write_metrics(&opts, "batch_split_merge", 0, 0, &metrics, NULL, 0);
+    finish_trace(&opts, "batch_split_merge");
+    sm_metrics_free(&metrics);
+    fprintf(stderr, "%zu images (%zu failed) on %d lanes in %.3f s: %.1f images/s, %.1f Mpx/s\n",
+            images, failed, lanes, seconds, images / seconds, pixels / seconds / 1e6);
+    return failed ? 1 : 0;
+}
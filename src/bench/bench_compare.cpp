@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "runner.hpp"
+
+// Regression gate. Runs bench_split_merge with --samples, stores the trial
+// times under STORE/<machine>/<commit>.csv and compares them with the
+// baseline commit recorded for the same machine. The machine is a hash of
+// the CPU model, core count and memory size, so results from different
+// hosts are never compared.
+//
+// A configuration (pattern, size, backend, threads, ranks) regresses when
+// its median grew by more than --margin percent and a one-sided
+// Mann-Whitney U test says the new trials are slower with p < --alpha. The
+// test uses the exact distribution of U for small tie-free samples and the
+// tie-corrected normal approximation otherwise; a margin alone would flag
+// noise, and a test alone would flag differences too small to care about.
+//
+// A configuration that timed out, failed or was skipped in the new run, and
+// one of the baseline's that the new run lacks, count as regressions too.
+//
+// Exits 1 if anything regressed, 0 otherwise. Without a baseline the run
+// is stored and becomes the baseline.
+
+struct Options {
+    std::string store;
+    std::string baseline;
+    std::string commit;
+    std::string bindir;
+    double margin;
+    double alpha;
+    int set_baseline;
+    std::vector<std::string> bench_args;
+};
+
+struct Key {
+    std::string pattern, backend;
+    int size, threads, ranks;
+
+    bool operator<(const Key &o) const {
+        if (pattern != o.pattern) return pattern < o.pattern;
+        if (size != o.size) return size < o.size;
+        if (backend != o.backend) return backend < o.backend;
+        if (threads != o.threads) return threads < o.threads;
+        return ranks < o.ranks;
+    }
+};
+
+// Trial times of a configuration, or the reason it has none
+struct Trials {
+    std::vector<double> seconds;
+    std::string status;
+
+    Trials() : status("ok") {}
+};
+
+typedef std::map<Key, Trials> Samples;
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] [bench_split_merge options]\n", prog);
+    printf("  --store=DIR                        where results are kept (default bench_results)\n");
+    printf("  --baseline=COMMIT                  compare against this commit (default the stored baseline)\n");
+    printf("  --commit=ID                        store this run as ID (default the HEAD commit)\n");
+    printf("  --set-baseline                     make this run the baseline afterwards\n");
+    printf("  --margin=PCT                       median slowdown that counts as a regression (default 10)\n");
+    printf("  --alpha=P                          significance level of the U test (default 0.05)\n");
+    printf("  --bindir=DIR                       where the driver binaries are (default .)\n");
+    printf("Other options, e.g. --sizes or --backends, are passed to bench_split_merge.\n");
+}
+
+// First line printed by cmd, or "" if it fails
+static std::string command_output(const char *cmd) {
+    std::string out;
+    FILE *fp = popen(cmd, "r");
+    if (!fp)
+        return out;
+    char line[256];
+    if (fgets(line, sizeof(line), fp)) {
+        out = line;
+        while (!out.empty() && (out.back() == '\n' || out.back() == '\r'))
+            out.pop_back();
+    }
+    if (pclose(fp) != 0)
+        out.clear();
+    return out;
+}
+
+static std::string current_commit() {
+    std::string id = command_output("git rev-parse --short=12 HEAD 2>/dev/null");
+    if (id.empty())
+        return "unknown";
+    if (!command_output("git status --porcelain --untracked-files=no 2>/dev/null").empty())
+        id += "-dirty";
+    return id;
+}
+
+// Value after "key" and ':' on the first matching line of a /proc file
+static std::string proc_field(const char *path, const char *key) {
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return "";
+    char line[512];
+    std::string value;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, key, strlen(key)) != 0)
+            continue;
+        const char *colon = strchr(line, ':');
+        if (!colon)
+            continue;
+        for (colon++; *colon == ' ' || *colon == '\t'; colon++) {}
+        value = colon;
+        while (!value.empty() && (value.back() == '\n' || value.back() == ' '))
+            value.pop_back();
+        break;
+    }
+    fclose(fp);
+    return value;
+}
+
+// Human-readable description and its FNV-1a hash, which names the directory
+static std::string machine_description() {
+    std::string cpu = proc_field("/proc/cpuinfo", "model name");
+    if (cpu.empty())
+        cpu = "unknown cpu";
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpu + ", " + std::to_string(cores) + " cores, " + proc_field("/proc/meminfo", "MemTotal") + " memory";
+}
+
+static std::string fingerprint(const std::string &description) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < description.size(); i++) {
+        h ^= (unsigned char)description[i];
+        h *= 1099511628211ULL;
+    }
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+}
+
+// Rows are pattern,size,backend,threads,ranks,trial,seconds[,status]; files
+// written before the status column was added hold only ok trials
+static int read_samples(const std::string &path, Samples &samples) {
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp)
+        return -1;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char pattern[128], backend[64], status[32] = "ok";
+        Key k;
+        size_t trial;
+        double seconds;
+        int fields = sscanf(line, "%127[^,],%d,%63[^,],%d,%d,%zu,%lf,%31[^,\r\n]", pattern, &k.size, backend,
+                            &k.threads, &k.ranks, &trial, &seconds, status);
+        if (fields < 7)
+            continue;   // header
+        k.pattern = pattern;
+        k.backend = backend;
+        Trials &t = samples[k];
+        if (strcmp(status, "ok") == 0)
+            t.seconds.push_back(seconds);
+        else
+            t.status = status;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int write_text(const std::string &path, const std::string &text) {
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "%s\n", text.c_str());
+    return fclose(fp);
+}
+
+static int run_bench(const Options &o, const std::string &samples_path) {
+    std::vector<std::string> args;
+    args.push_back(o.bindir + "/bench_split_merge");
+    args.push_back("--bindir=" + o.bindir);
+    args.push_back("--out=" + samples_path + ".summary");
+    args.push_back("--samples=" + samples_path);
+    args.insert(args.end(), o.bench_args.begin(), o.bench_args.end());
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        std::vector<char *> argv;
+        for (size_t i = 0; i < args.size(); i++)
+            argv.push_back((char *)args[i].c_str());
+        argv.push_back(NULL);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    unlink((samples_path + ".summary").c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// P(U >= u) for the U of an n1-sample against an n2-sample with no ties.
+// After step i, prev[j][v] counts the orderings of j first-sample and i
+// second-sample values whose U is v.
+static double exact_upper_tail(int n1, int n2, double u) {
+    int max_u = n1 * n2;
+    std::vector<std::vector<double> > prev(n1 + 1, std::vector<double>(max_u + 1, 0)), cur = prev;
+    for (int j = 0; j <= n1; j++)
+        prev[j][0] = 1;     // i = 0: every first-sample value counts nothing
+    for (int i = 1; i <= n2; i++) {
+        for (int j = 0; j <= n1; j++) {
+            for (int v = 0; v <= max_u; v++) {
+                // The largest value is either from the second sample, adding
+                // nothing, or from the first, beating all i second values
+                double w = prev[j][v];
+                if (j > 0 && v >= i)
+                    w += cur[j - 1][v - i];
+                cur[j][v] = w;
+            }
+        }
+        prev.swap(cur);
+    }
+    double total = 0, tail = 0;
+    for (int v = 0; v <= max_u; v++) {
+        total += prev[n1][v];
+        if (v >= u - 1e-9)
+            tail += prev[n1][v];
+    }
+    return tail / total;
+}
+
+// One-sided Mann-Whitney U test that a (new trials) tends to be larger than
+// b (baseline trials). Returns the p-value.
+static double mann_whitney_greater(const std::vector<double> &a, const std::vector<double> &b) {
+    size_t n1 = a.size(), n2 = b.size(), n = n1 + n2;
+    std::vector<std::pair<double, int> > all;
+    for (size_t i = 0; i < n1; i++)
+        all.push_back(std::make_pair(a[i], 0));
+    for (size_t i = 0; i < n2; i++)
+        all.push_back(std::make_pair(b[i], 1));
+    std::sort(all.begin(), all.end());
+
+    // Average ranks over ties
+    double rank_sum = 0, tie_term = 0;
+    bool ties = false;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && all[j].first == all[i].first)
+            j++;
+        double t = (double)(j - i), rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; k++)
+            if (all[k].second == 0)
+                rank_sum += rank;
+        tie_term += t * t * t - t;
+        ties |= t > 1;
+        i = j;
+    }
+    double u = rank_sum - n1 * (n1 + 1) / 2.0;
+
+    if (!ties && n1 <= 20 && n2 <= 20)
+        return exact_upper_tail((int)n1, (int)n2, u);
+    double mean = n1 * n2 / 2.0;
+    double var = n1 * n2 / 12.0 * ((n + 1) - tie_term / (n * (n - 1.0)));
+    if (var <= 0)
+        return 1;
+    double z = (u - mean - 0.5) / sqrt(var);
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return percentile(v, 50);
+}
+
+// Prints the comparison table and returns the number of regressions
+static int compare(const Samples &base, const Samples &cur, const Options &o) {
+    printf("%-9s %6s %-10s %3s %3s %11s %11s %8s %8s  %s\n", "pattern", "size", "backend", "thr", "rnk",
+           "base_med_s", "new_med_s", "change", "p", "verdict");
+    int regressions = 0;
+    for (Samples::const_iterator it = cur.begin(); it != cur.end(); ++it) {
+        const Key &k = it->first;
+        const Trials &t = it->second;
+        Samples::const_iterator b = base.find(k);
+        bool has_base = b != base.end() && b->second.status == "ok" && !b->second.seconds.empty();
+        if (t.status != "ok" || t.seconds.empty()) {
+            // No times at all: a run that no longer completes is a regression
+            std::string verdict = "REGRESSION (" + (t.status != "ok" ? t.status : std::string("no trials")) + ")";
+            if (has_base)
+                printf("%-9s %6d %-10s %3d %3d %11.6f %11s %8s %8s  %s\n", k.pattern.c_str(), k.size,
+                       k.backend.c_str(), k.threads, k.ranks, median(b->second.seconds), "-", "-", "-",
+                       verdict.c_str());
+            else
+                printf("%-9s %6d %-10s %3d %3d %11s %11s %8s %8s  %s\n", k.pattern.c_str(), k.size,
+                       k.backend.c_str(), k.threads, k.ranks, "-", "-", "-", "-", verdict.c_str());
+            regressions++;
+            continue;
+        }
+        double new_med = median(t.seconds);
+        if (!has_base) {
+            printf("%-9s %6d %-10s %3d %3d %11s %11.6f %8s %8s  new\n", k.pattern.c_str(), k.size,
+                   k.backend.c_str(), k.threads, k.ranks, "-", new_med, "-", "-");
+            continue;
+        }
+        double base_med = median(b->second.seconds);
+        double change = base_med > 0 ? (new_med / base_med - 1) * 100 : 0;
+        double p_slower = mann_whitney_greater(t.seconds, b->second.seconds);
+        double p_faster = mann_whitney_greater(b->second.seconds, t.seconds);
+        const char *verdict = "same";
+        double p = p_slower;
+        if (change > o.margin && p_slower < o.alpha) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (change < -o.margin && p_faster < o.alpha) {
+            verdict = "faster";
+            p = p_faster;
+        }
+        printf("%-9s %6d %-10s %3d %3d %11.6f %11.6f %+7.1f%% %8.4f  %s\n", k.pattern.c_str(), k.size,
+               k.backend.c_str(), k.threads, k.ranks, base_med, new_med, change, p, verdict);
+    }
+    // A baseline configuration the new run never produced cannot be shown
+    // to be as fast as before
+    for (Samples::const_iterator it = base.begin(); it != base.end(); ++it) {
+        const Key &k = it->first;
+        if (cur.find(k) != cur.end())
+            continue;
+        if (it->second.seconds.empty())
+            printf("%-9s %6d %-10s %3d %3d %11s %11s %8s %8s  REGRESSION (missing)\n", k.pattern.c_str(),
+                   k.size, k.backend.c_str(), k.threads, k.ranks, "-", "-", "-", "-");
+        else
+            printf("%-9s %6d %-10s %3d %3d %11.6f %11s %8s %8s  REGRESSION (missing)\n", k.pattern.c_str(),
+                   k.size, k.backend.c_str(), k.threads, k.ranks, median(it->second.seconds), "-", "-", "-");
+        regressions++;
+    }
+    return regressions;
+}
+
+static int parse_compare(int argc, char *argv[], Options &o) {
+    o.store = "bench_results";
+    o.bindir = ".";
+    o.margin = 10;
+    o.alpha = 0.05;
+    o.set_baseline = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--store=", 8) == 0 && arg[8])
+            o.store = arg + 8;
+        else if (strncmp(arg, "--baseline=", 11) == 0 && arg[11])
+            o.baseline = arg + 11;
+        else if (strncmp(arg, "--commit=", 9) == 0 && arg[9])
+            o.commit = arg + 9;
+        else if (strcmp(arg, "--set-baseline") == 0)
+            o.set_baseline = 1;
+        else if (strncmp(arg, "--margin=", 9) == 0) {
+            if ((o.margin = atof(arg + 9)) < 0)
+                return -1;
+        } else if (strncmp(arg, "--alpha=", 8) == 0) {
+            o.alpha = atof(arg + 8);
+            if (o.alpha <= 0 || o.alpha >= 1)
+                return -1;
+        } else if (strncmp(arg, "--bindir=", 9) == 0)
+            o.bindir = arg + 9;
+        else if (strncmp(arg, "--out=", 6) == 0 || strncmp(arg, "--samples=", 10) == 0 ||
+                 strcmp(arg, "--help") == 0)
+            return -1;
+        else
+            o.bench_args.push_back(arg);
+    }
+    if (o.commit.empty())
+        o.commit = current_commit();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    if (parse_compare(argc, argv, o) != 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!executable(o.bindir + "/bench_split_merge")) {
+        fprintf(stderr, "bench_split_merge is not built in %s\n", o.bindir.c_str());
+        return 2;
+    }
+
+    std::string description = machine_description();
+    std::string dir = o.store + "/" + fingerprint(description);
+    mkdir(o.store.c_str(), 0755);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        perror("Error creating result directory");
+        return 2;
+    }
+    write_text(dir + "/machine.txt", description);
+
+    std::string baseline_file = dir + "/baseline";
+    if (o.baseline.empty()) {
+        FILE *fp = fopen(baseline_file.c_str(), "r");
+        char id[128];
+        if (fp && fscanf(fp, "%127s", id) == 1)
+            o.baseline = id;
+        if (fp)
+            fclose(fp);
+    }
+
+    std::string samples_path = dir + "/" + o.commit + ".csv";
+    fprintf(stderr, "bench_compare: commit %s on %s (%s)\n", o.commit.c_str(), description.c_str(),
+            fingerprint(description).c_str());
+    int rc = run_bench(o, samples_path);
+    if (rc != 0) {
+        fprintf(stderr, "bench_split_merge failed (status %d)\n", rc);
+        return 2;
+    }
+    Samples cur, base;
+    read_samples(samples_path, cur);
+
+    int regressions = 0;
+    if (o.baseline.empty()) {
+        printf("No baseline for this machine yet; %s is the baseline now\n", o.commit.c_str());
+        o.set_baseline = 1;
+    } else if (o.baseline == o.commit) {
+        printf("%s is the baseline; nothing to compare\n", o.commit.c_str());
+    } else if (read_samples(dir + "/" + o.baseline + ".csv", base) != 0) {
+        fprintf(stderr, "No stored results for baseline %s in %s\n", o.baseline.c_str(), dir.c_str());
+        return 2;
+    } else {
+        printf("%s against baseline %s, margin %.1f%%, alpha %.3f\n", o.commit.c_str(), o.baseline.c_str(),
+               o.margin, o.alpha);
+        regressions = compare(base, cur, o);
+        if (regressions)
+            printf("%d configuration%s regressed\n", regressions, regressions == 1 ? "" : "s");
+        else
+            printf("No regressions\n");
+    }
+    if (o.set_baseline && write_text(baseline_file, o.commit) != 0) {
+        perror("Error writing baseline");
+        return 2;
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../common/image_io.h"
+#include "runner.hpp"
+#include "synthetic.h"
+
+// Benchmark runner. Generates synthetic inputs, runs each backend binary on
+// them as a subprocess for a number of trials, and writes one CSV row per
+// (pattern, size, backend, threads, ranks) with the spread of the
+// segmentation time each driver reports under --stats. Running the real
+// binaries keeps MPI in the suite and measures exactly what users run.
+//
+// A configuration that times out is not retried on larger sizes of the same
+// pattern. --samples also writes every trial's time, one row each, which is
+// what bench_compare tests against a baseline; a configuration that timed
+// out, failed or was skipped gets a single row with that status instead.
+
+struct Config {
+    std::string backend;    // serial, union-find, openmp or mpi
+    int threads;
+    int ranks;
+};
+
+struct Options {
+    std::vector<std::string> patterns;
+    std::vector<int> sizes;
+    std::vector<std::string> backends;
+    std::vector<int> threads;
+    std::vector<int> ranks;
+    int trials;
+    int threshold;
+    double timeout;
+    std::string bindir;
+    std::string workdir;
+    std::string mpirun;
+    const char *out_path;
+    const char *samples_path;
+    int keep;
+};
+
+static std::vector<Config> expand_configs(const Options &o) {
+    std::vector<Config> configs;
+    for (size_t b = 0; b < o.backends.size(); b++) {
+        const std::string &name = o.backends[b];
+        if (name == "openmp") {
+            for (size_t t = 0; t < o.threads.size(); t++)
+                configs.push_back(Config{name, o.threads[t], 1});
+        } else if (name == "mpi") {
+            for (size_t r = 0; r < o.ranks.size(); r++)
+                configs.push_back(Config{name, 1, o.ranks[r]});
+        } else {
+            configs.push_back(Config{name, 1, 1});
+        }
+    }
+    return configs;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]                 run the benchmark suite\n", prog);
+    printf("       %s generate PATTERN WIDTH HEIGHT output.pgm [--seed=N]\n", prog);
+    printf("  --patterns=a,b                     uniform,noise,gradient,rings,snake (default all)\n");
+    printf("  --sizes=N,...                      square image edges (default 256,1024,4096)\n");
+    printf("  --backends=a,b                     serial,union-find,openmp,mpi (default all built)\n");
+    printf("  --threads=N,...                    OpenMP thread counts (default 1,2,4)\n");
+    printf("  --ranks=N,...                      MPI rank counts (default 2,4)\n");
+    printf("  --trials=N                         runs per configuration (default 5)\n");
+    printf("  --threshold=N                      merge threshold passed to every backend (default 4)\n");
+    printf("  --timeout=S                        seconds before a run is killed (default 300)\n");
+    printf("  --bindir=DIR                       where the driver binaries are (default .)\n");
+    printf("  --workdir=DIR                      where inputs are generated (default /tmp)\n");
+    printf("  --mpirun=\"CMD ARGS\"                MPI launcher (default mpirun)\n");
+    printf("  --out=FILE.csv                     results (default stdout)\n");
+    printf("  --samples=FILE.csv                 also write each trial's time\n");
+    printf("  --keep                             keep the generated inputs\n");
+}
+
+static int generate(int argc, char *argv[]) {
+    uint64_t seed = 0;
+    for (int i = 6; i < argc; i++) {
+        if (strncmp(argv[i], "--seed=", 7) == 0)
+            seed = strtoull(argv[i] + 7, NULL, 10);
+        else
+            return -1;
+    }
+    Image *img = generate_pattern(argv[2], atoi(argv[3]), atoi(argv[4]), seed);
+    if (!img)
+        return -1;
+    write_pgm(argv[5], img);
+    free_image(img);
+    return 0;
+}
+
+static int parse_suite(int argc, char *argv[], Options &o) {
+    for (int i = 0; i < synthetic_pattern_count; i++)
+        o.patterns.push_back(synthetic_patterns[i]);
+    o.sizes = {256, 1024, 4096};
+    o.backends = {"serial", "union-find", "openmp", "mpi"};
+    o.threads = {1, 2, 4};
+    o.ranks = {2, 4};
+    o.trials = 5;
+    o.threshold = 4;
+    o.timeout = 300;
+    o.bindir = ".";
+    o.workdir = "/tmp";
+    o.mpirun = "mpirun";
+    o.out_path = NULL;
+    o.samples_path = NULL;
+    o.keep = 0;
+    bool explicit_backends = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int err = 0;
+        if (strncmp(arg, "--patterns=", 11) == 0)
+            o.patterns = split(arg + 11, ',');
+        else if (strncmp(arg, "--sizes=", 8) == 0)
+            err = parse_ints(arg + 8, o.sizes);
+        else if (strncmp(arg, "--backends=", 11) == 0) {
+            o.backends = split(arg + 11, ',');
+            explicit_backends = true;
+        } else if (strncmp(arg, "--threads=", 10) == 0)
+            err = parse_ints(arg + 10, o.threads);
+        else if (strncmp(arg, "--ranks=", 8) == 0)
+            err = parse_ints(arg + 8, o.ranks);
+        else if (strncmp(arg, "--trials=", 9) == 0)
+            err = (o.trials = atoi(arg + 9)) > 0 ? 0 : -1;
+        else if (strncmp(arg, "--threshold=", 12) == 0)
+            o.threshold = atoi(arg + 12);
+        else if (strncmp(arg, "--timeout=", 10) == 0)
+            err = (o.timeout = atof(arg + 10)) > 0 ? 0 : -1;
+        else if (strncmp(arg, "--bindir=", 9) == 0)
+            o.bindir = arg + 9;
+        else if (strncmp(arg, "--workdir=", 10) == 0)
+            o.workdir = arg + 10;
+        else if (strncmp(arg, "--mpirun=", 9) == 0 && arg[9])
+            o.mpirun = arg + 9;
+        else if (strncmp(arg, "--out=", 6) == 0 && arg[6])
+            o.out_path = arg + 6;
+        else if (strncmp(arg, "--samples=", 10) == 0 && arg[10])
+            o.samples_path = arg + 10;
+        else if (strcmp(arg, "--keep") == 0)
+            o.keep = 1;
+        else
+            err = -1;
+        if (err != 0)
+            return -1;
+    }
+
+    for (size_t i = 0; i < o.patterns.size(); i++) {
+        Image *probe = generate_pattern(o.patterns[i].c_str(), 1, 1, 0);
+        if (!probe) {
+            fprintf(stderr, "Unknown pattern %s\n", o.patterns[i].c_str());
+            return -1;
+        }
+        free_image(probe);
+    }
+    // Backends that were not built are dropped from the default set; asking
+    // for one explicitly is an error
+    std::vector<std::string> available;
+    for (size_t i = 0; i < o.backends.size(); i++) {
+        const std::string &b = o.backends[i];
+        if (b != "serial" && b != "union-find" && b != "openmp" && b != "mpi") {
+            fprintf(stderr, "Unknown backend %s\n", b.c_str());
+            return -1;
+        }
+        if (backend_available(o.bindir, o.mpirun, b))
+            available.push_back(b);
+        else if (explicit_backends) {
+            fprintf(stderr, "Backend %s is not available in %s\n", b.c_str(), o.bindir.c_str());
+            return -1;
+        } else
+            fprintf(stderr, "Skipping %s: not built\n", b.c_str());
+    }
+    o.backends = available;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "generate") == 0) {
+        int err = argc >= 6 ? generate(argc, argv) : -1;
+        if (err != 0)
+            usage(argv[0]);
+        return err;
+    }
+
+    Options o;
+    if (parse_suite(argc, argv, o) != 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    FILE *out = o.out_path ? fopen(o.out_path, "w") : stdout;
+    if (!out) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "pattern,size,backend,threads,ranks,trials,median_s,p10_s,p90_s,min_s,max_s,"
+                 "wall_median_s,mpx_per_s,sweeps,regions,status\n");
+    fflush(out);
+    FILE *samples = NULL;
+    if (o.samples_path) {
+        samples = fopen(o.samples_path, "w");
+        if (!samples) {
+            perror("Error opening samples file");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(samples, "pattern,size,backend,threads,ranks,trial,seconds,status\n");
+    }
+
+    std::vector<Config> configs = expand_configs(o);
+    std::string err_path = o.workdir + "/bench_split_merge." + std::to_string(getpid()) + ".err";
+    std::sort(o.sizes.begin(), o.sizes.end());
+
+    for (size_t p = 0; p < o.patterns.size(); p++) {
+        std::vector<bool> timed_out(configs.size(), false);
+        for (size_t s = 0; s < o.sizes.size(); s++) {
+            int size = o.sizes[s];
+            const std::string &pattern = o.patterns[p];
+            std::string input = o.workdir + "/bench_" + pattern + "_" + std::to_string(size) + ".pgm";
+            Image *img = generate_pattern(pattern.c_str(), size, size, 0);
+            if (!img) {
+                fprintf(stderr, "Out of memory generating %s %dx%d\n", pattern.c_str(), size, size);
+                exit(EXIT_FAILURE);
+            }
+            write_pgm(input.c_str(), img);
+            free_image(img);
+
+            for (size_t c = 0; c < configs.size(); c++) {
+                const Config &cfg = configs[c];
+                std::vector<double> seconds, walls;
+                Trial t = {0, 0, 0};
+                const char *status = "ok";
+                if (timed_out[c]) {
+                    status = "skipped";
+                } else {
+                    std::vector<std::string> args = driver_command(o.bindir, o.mpirun, cfg.backend, cfg.ranks, input, o.threshold);
+                    for (int k = 0; k < o.trials; k++) {
+                        double wall;
+                        int rc = run_driver(args, cfg.backend == "openmp" ? cfg.threads : 0, err_path.c_str(), o.timeout, &wall);
+                        if (rc < 0) {
+                            status = "timeout";
+                            timed_out[c] = true;
+                            break;
+                        }
+                        if (rc != 0 || read_stats(err_path.c_str(), &t) != 0) {
+                            status = "failed";
+                            break;
+                        }
+                        seconds.push_back(t.seconds);
+                        walls.push_back(wall);
+                    }
+                }
+                if (seconds.size() < (size_t)o.trials) {
+                    seconds.clear();
+                    walls.clear();
+                }
+                for (size_t k = 0; samples && k < seconds.size(); k++)
+                    fprintf(samples, "%s,%d,%s,%d,%d,%zu,%.6f,ok\n", pattern.c_str(), size, cfg.backend.c_str(),
+                            cfg.threads, cfg.ranks, k, seconds[k]);
+                if (samples && seconds.empty())
+                    fprintf(samples, "%s,%d,%s,%d,%d,0,0,%s\n", pattern.c_str(), size, cfg.backend.c_str(),
+                            cfg.threads, cfg.ranks, status);
+                std::sort(seconds.begin(), seconds.end());
+                std::sort(walls.begin(), walls.end());
+                double median = percentile(seconds, 50);
+                double mpx = median > 0 ? (double)size * size / median / 1e6 : 0;
+                fprintf(out, "%s,%d,%s,%d,%d,%zu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.2f,%d,%zu,%s\n",
+                        pattern.c_str(), size, cfg.backend.c_str(), cfg.threads, cfg.ranks, seconds.size(),
+                        median, percentile(seconds, 10), percentile(seconds, 90),
+                        seconds.empty() ? 0 : seconds.front(), seconds.empty() ? 0 : seconds.back(),
+                        percentile(walls, 50), mpx, seconds.empty() ? 0 : t.sweeps,
+                        seconds.empty() ? 0 : t.regions, status);
+                fflush(out);
+                fprintf(stderr, "%-8s %6d %-10s threads=%d ranks=%d: %s, median %.4f s\n", pattern.c_str(), size,
+                        cfg.backend.c_str(), cfg.threads, cfg.ranks, status, median);
+            }
+            if (!o.keep)
+                unlink(input.c_str());
+        }
+    }
+    unlink(err_path.c_str());
+    if (samples)
+        fclose(samples);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
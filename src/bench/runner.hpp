@@ -0,0 +1,171 @@
+#ifndef RUNNER_HPP
+#define RUNNER_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include "../common/cli.h"
+
+// Subprocess plumbing shared by the benchmark and scaling runners: run a
+// driver binary with a timeout, read back the --stats line it printed, and
+// summarise repeated trials.
+
+struct Trial {
+    double seconds;         // segmentation phase, from the stats line
+    int sweeps;
+    size_t regions;
+};
+
+static inline std::vector<std::string> split(const char *s, char sep) {
+    std::vector<std::string> parts;
+    std::string cur;
+    for (; *s; s++) {
+        if (*s == sep) {
+            if (!cur.empty())
+                parts.push_back(cur);
+            cur.clear();
+        } else {
+            cur += *s;
+        }
+    }
+    if (!cur.empty())
+        parts.push_back(cur);
+    return parts;
+}
+
+static inline int parse_ints(const char *s, std::vector<int> &out) {
+    out.clear();
+    std::vector<std::string> parts = split(s, ',');
+    for (size_t i = 0; i < parts.size(); i++) {
+        int v = atoi(parts[i].c_str());
+        if (v <= 0)
+            return -1;
+        out.push_back(v);
+    }
+    return out.empty() ? -1 : 0;
+}
+
+static inline bool executable(const std::string &path) {
+    return access(path.c_str(), X_OK) == 0;
+}
+
+// Run argv with stdout discarded and stderr captured to err_path. Returns
+// the exit status, or -1 if the child was killed for exceeding timeout.
+static inline int run_driver(const std::vector<std::string> &args, int omp_threads, const char *err_path,
+                             double timeout, double *wall) {
+    double start = cli_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        // Own process group so a timeout also kills mpirun's ranks
+        setpgid(0, 0);
+        int null = open("/dev/null", O_WRONLY);
+        int err = open(err_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (null < 0 || err < 0)
+            _exit(127);
+        dup2(null, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        if (omp_threads > 0) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%d", omp_threads);
+            setenv("OMP_NUM_THREADS", buf, 1);
+        }
+        std::vector<char *> argv;
+        for (size_t i = 0; i < args.size(); i++)
+            argv.push_back((char *)args[i].c_str());
+        argv.push_back(NULL);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status;
+    for (;;) {
+        pid_t done = waitpid(pid, &status, WNOHANG);
+        if (done == pid)
+            break;
+        if (cli_seconds() - start > timeout) {
+            kill(-pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            *wall = cli_seconds() - start;
+            return -1;
+        }
+        usleep(1000);
+    }
+    *wall = cli_seconds() - start;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Last "stats:" line the driver wrote to stderr
+static inline int read_stats(const char *err_path, Trial *t) {
+    FILE *fp = fopen(err_path, "r");
+    if (!fp)
+        return -1;
+    char line[512];
+    int found = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "stats: seconds=%lf sweeps=%d regions=%zu", &t->seconds, &t->sweeps, &t->regions) == 3)
+            found = 0;
+    }
+    fclose(fp);
+    return found;
+}
+
+// Linear interpolation between closest ranks of sorted v
+static inline double percentile(const std::vector<double> &v, double p) {
+    if (v.empty())
+        return 0;
+    double pos = p / 100.0 * (v.size() - 1);
+    size_t lo = (size_t)pos;
+    size_t hi = lo + 1 < v.size() ? lo + 1 : lo;
+    return v[lo] + (v[hi] - v[lo]) * (pos - lo);
+}
+
+// Command line for one run of a driver: "serial", "union-find", "openmp"
+// or "mpi" (launched as mpirun -np ranks). The output image is discarded.
+static inline std::vector<std::string> driver_command(const std::string &bindir, const std::string &mpirun,
+                                                      const std::string &backend, int ranks,
+                                                      const std::string &input, int threshold) {
+    std::vector<std::string> args;
+    if (backend == "mpi") {
+        args = split(mpirun.c_str(), ' ');
+        args.push_back("-np");
+        args.push_back(std::to_string(ranks));
+        args.push_back(bindir + "/mpi_split_merge");
+    } else if (backend == "openmp") {
+        args.push_back(bindir + "/omp_split_merge");
+    } else {
+        args.push_back(bindir + "/serial_split_merge");
+    }
+    args.push_back(input);
+    args.push_back("/dev/null");
+    if (backend != "openmp" && backend != "mpi")
+        args.push_back("--engine=" + backend);
+    args.push_back("--threshold=" + std::to_string(threshold));
+    args.push_back("--stats");
+    return args;
+}
+
+// Whether the driver for backend is built in bindir (and, for MPI, the
+// launcher is on the PATH)
+static inline bool backend_available(const std::string &bindir, const std::string &mpirun, const std::string &backend) {
+    if (backend == "openmp")
+        return executable(bindir + "/omp_split_merge");
+    if (backend == "mpi") {
+        if (!executable(bindir + "/mpi_split_merge"))
+            return false;
+        std::string check = "command -v " + split(mpirun.c_str(), ' ')[0] + " >/dev/null 2>&1";
+        return system(check.c_str()) == 0;
+    }
+    return executable(bindir + "/serial_split_merge");
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../common/image_io.h"
+#include "runner.hpp"
+#include "synthetic.h"
+
+// Scaling runner. Runs the OpenMP driver at 1..N threads and the MPI driver
+// at 1..N local ranks, in two modes:
+//
+//   strong  the image is fixed at SIZE x SIZE and more workers share it
+//   weak    the image is SIZE wide and SIZE * p rows tall, so each worker
+//           keeps SIZE x SIZE pixels however many there are
+//
+// Against the one-worker median T1 of the same backend and mode, with Tp
+// the median at p workers:
+//
+//   strong  speedup S = T1 / Tp         efficiency E = S / p
+//   weak    speedup S = p * T1 / Tp     efficiency E = T1 / Tp
+//
+// and the Karp-Flatt serial fraction e = (1/S - 1/p) / (1 - 1/p). An e that
+// grows with p points at overhead (halo exchange, barriers, imbalance)
+// rather than a fixed serial part.
+
+struct Options {
+    std::vector<std::string> modes;
+    std::vector<std::string> backends;
+    std::vector<int> workers;
+    std::string pattern;
+    int size;
+    int trials;
+    int threshold;
+    double timeout;
+    std::string bindir;
+    std::string workdir;
+    std::string mpirun;
+    const char *out_path;
+};
+
+struct Point {
+    int workers;
+    int width, height;
+    double median;
+    int sweeps;
+    const char *status;
+};
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --modes=a,b                        strong,weak (default both)\n");
+    printf("  --backends=a,b                     openmp,mpi (default all built)\n");
+    printf("  --workers=N,...                    thread and rank counts (default 1,2,4,... up to the cores)\n");
+    printf("  --max-workers=N                    default worker counts go up to N (default the cores)\n");
+    printf("  --pattern=NAME                     synthetic input (default noise)\n");
+    printf("  --size=N                           image edge, per worker for weak scaling (default 1024)\n");
+    printf("  --trials=N                         runs per point (default 5)\n");
+    printf("  --threshold=N                      merge threshold (default 4)\n");
+    printf("  --timeout=S                        seconds before a run is killed (default 300)\n");
+    printf("  --bindir=DIR                       where the driver binaries are (default .)\n");
+    printf("  --workdir=DIR                      where inputs are generated (default /tmp)\n");
+    printf("  --mpirun=\"CMD ARGS\"                MPI launcher (default mpirun)\n");
+    printf("  --out=FILE.csv                     results (default stdout)\n");
+}
+
+// 1, 2, 4, ... up to max, plus max itself
+static std::vector<int> default_workers(int max) {
+    std::vector<int> w;
+    for (int p = 1; p < max; p *= 2)
+        w.push_back(p);
+    w.push_back(max);
+    return w;
+}
+
+static int parse_scale(int argc, char *argv[], Options &o) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_workers = cores > 0 ? (int)cores : 1;
+    o.modes = {"strong", "weak"};
+    o.backends = {"openmp", "mpi"};
+    o.pattern = "noise";
+    o.size = 1024;
+    o.trials = 5;
+    o.threshold = 4;
+    o.timeout = 300;
+    o.bindir = ".";
+    o.workdir = "/tmp";
+    o.mpirun = "mpirun";
+    o.out_path = NULL;
+    bool explicit_backends = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int err = 0;
+        if (strncmp(arg, "--modes=", 8) == 0)
+            o.modes = split(arg + 8, ',');
+        else if (strncmp(arg, "--backends=", 11) == 0) {
+            o.backends = split(arg + 11, ',');
+            explicit_backends = true;
+        } else if (strncmp(arg, "--workers=", 10) == 0)
+            err = parse_ints(arg + 10, o.workers);
+        else if (strncmp(arg, "--max-workers=", 14) == 0)
+            err = (max_workers = atoi(arg + 14)) > 0 ? 0 : -1;
+        else if (strncmp(arg, "--pattern=", 10) == 0 && arg[10])
+            o.pattern = arg + 10;
+        else if (strncmp(arg, "--size=", 7) == 0)
+            err = (o.size = atoi(arg + 7)) > 0 ? 0 : -1;
+        else if (strncmp(arg, "--trials=", 9) == 0)
+            err = (o.trials = atoi(arg + 9)) > 0 ? 0 : -1;
+        else if (strncmp(arg, "--threshold=", 12) == 0)
+            o.threshold = atoi(arg + 12);
+        else if (strncmp(arg, "--timeout=", 10) == 0)
+            err = (o.timeout = atof(arg + 10)) > 0 ? 0 : -1;
+        else if (strncmp(arg, "--bindir=", 9) == 0)
+            o.bindir = arg + 9;
+        else if (strncmp(arg, "--workdir=", 10) == 0)
+            o.workdir = arg + 10;
+        else if (strncmp(arg, "--mpirun=", 9) == 0 && arg[9])
+            o.mpirun = arg + 9;
+        else if (strncmp(arg, "--out=", 6) == 0 && arg[6])
+            o.out_path = arg + 6;
+        else
+            err = -1;
+        if (err != 0)
+            return -1;
+    }
+
+    for (size_t i = 0; i < o.modes.size(); i++) {
+        if (o.modes[i] != "strong" && o.modes[i] != "weak") {
+            fprintf(stderr, "Unknown mode %s\n", o.modes[i].c_str());
+            return -1;
+        }
+    }
+    Image *probe = generate_pattern(o.pattern.c_str(), 1, 1, 0);
+    if (!probe) {
+        fprintf(stderr, "Unknown pattern %s\n", o.pattern.c_str());
+        return -1;
+    }
+    free_image(probe);
+
+    // Every ratio is taken against one worker, so that point always runs
+    if (o.workers.empty())
+        o.workers = default_workers(max_workers);
+    o.workers.push_back(1);
+    std::sort(o.workers.begin(), o.workers.end());
+    o.workers.erase(std::unique(o.workers.begin(), o.workers.end()), o.workers.end());
+
+    std::vector<std::string> available;
+    for (size_t i = 0; i < o.backends.size(); i++) {
+        const std::string &b = o.backends[i];
+        if (b != "openmp" && b != "mpi") {
+            fprintf(stderr, "Unknown backend %s\n", b.c_str());
+            return -1;
+        }
+        if (backend_available(o.bindir, o.mpirun, b))
+            available.push_back(b);
+        else if (explicit_backends) {
+            fprintf(stderr, "Backend %s is not available in %s\n", b.c_str(), o.bindir.c_str());
+            return -1;
+        } else
+            fprintf(stderr, "Skipping %s: not built\n", b.c_str());
+    }
+    o.backends = available;
+    return 0;
+}
+
+static Point measure(const Options &o, const std::string &backend, int workers, int width, int height,
+                     const std::string &err_path) {
+    Point pt = {workers, width, height, 0, 0, "ok"};
+    std::string input = o.workdir + "/scale_" + o.pattern + "_" + std::to_string(width) + "x" +
+                        std::to_string(height) + "." + std::to_string(getpid()) + ".pgm";
+    Image *img = generate_pattern(o.pattern.c_str(), width, height, 0);
+    if (!img) {
+        fprintf(stderr, "Out of memory generating %s %dx%d\n", o.pattern.c_str(), width, height);
+        exit(EXIT_FAILURE);
+    }
+    write_pgm(input.c_str(), img);
+    free_image(img);
+
+    std::vector<std::string> args = driver_command(o.bindir, o.mpirun, backend, workers, input, o.threshold);
+    std::vector<double> seconds;
+    Trial t = {0, 0, 0};
+    for (int k = 0; k < o.trials; k++) {
+        double wall;
+        int rc = run_driver(args, backend == "openmp" ? workers : 0, err_path.c_str(), o.timeout, &wall);
+        if (rc < 0) {
+            pt.status = "timeout";
+            break;
+        }
+        if (rc != 0 || read_stats(err_path.c_str(), &t) != 0) {
+            pt.status = "failed";
+            break;
+        }
+        seconds.push_back(t.seconds);
+    }
+    unlink(input.c_str());
+    if (seconds.size() == (size_t)o.trials) {
+        std::sort(seconds.begin(), seconds.end());
+        pt.median = percentile(seconds, 50);
+        pt.sweeps = t.sweeps;
+    }
+    return pt;
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    if (parse_scale(argc, argv, o) != 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    FILE *out = o.out_path ? fopen(o.out_path, "w") : stdout;
+    if (!out) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "mode,backend,pattern,workers,width,height,trials,median_s,speedup,efficiency,karp_flatt,"
+                 "sweeps,status\n");
+    fflush(out);
+
+    std::string err_path = o.workdir + "/scale_split_merge." + std::to_string(getpid()) + ".err";
+
+    for (size_t m = 0; m < o.modes.size(); m++) {
+        bool weak = o.modes[m] == "weak";
+        for (size_t b = 0; b < o.backends.size(); b++) {
+            const std::string &backend = o.backends[b];
+            double t1 = 0;
+            bool stopped = false;
+            for (size_t w = 0; w < o.workers.size(); w++) {
+                int p = o.workers[w];
+                int height = weak ? o.size * p : o.size;
+                Point pt = {p, o.size, height, 0, 0, "skipped"};
+                // Without T1 nothing can be compared, and past a timeout
+                // weak scaling only gets slower
+                if (!stopped)
+                    pt = measure(o, backend, p, o.size, height, err_path);
+                if (strcmp(pt.status, "ok") != 0)
+                    stopped = p == 1 || weak;
+                if (p == 1)
+                    t1 = pt.median;
+
+                double speedup = 0, efficiency = 0;
+                if (t1 > 0 && pt.median > 0) {
+                    speedup = weak ? p * t1 / pt.median : t1 / pt.median;
+                    efficiency = weak ? t1 / pt.median : speedup / p;
+                }
+                char karp_flatt[32] = "";
+                if (p > 1 && speedup > 0)
+                    snprintf(karp_flatt, sizeof(karp_flatt), "%.4f",
+                             (1.0 / speedup - 1.0 / p) / (1.0 - 1.0 / p));
+                fprintf(out, "%s,%s,%s,%d,%d,%d,%d,%.6f,%.3f,%.3f,%s,%d,%s\n", o.modes[m].c_str(),
+                        backend.c_str(), o.pattern.c_str(), p, pt.width, pt.height,
+                        pt.median > 0 ? o.trials : 0, pt.median, speedup, efficiency, karp_flatt,
+                        pt.sweeps, pt.status);
+                fflush(out);
+                fprintf(stderr, "%-6s %-6s p=%-3d %dx%d: %s, median %.4f s, speedup %.2f, efficiency %.2f\n",
+                        o.modes[m].c_str(), backend.c_str(), p, pt.width, pt.height, pt.status, pt.median,
+                        speedup, efficiency);
+            }
+        }
+    }
+    unlink(err_path.c_str());
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
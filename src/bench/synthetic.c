@@ -0,0 +1,74 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "synthetic.h"
+
+const char *const synthetic_patterns[] = { "uniform", "noise", "gradient", "rings", "snake" };
+const int synthetic_pattern_count = sizeof(synthetic_patterns) / sizeof(synthetic_patterns[0]);
+
+#define RING_WIDTH 8
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+Image *generate_pattern(const char *name, int width, int height, uint64_t seed) {
+    int pattern = -1;
+    for (int i = 0; i < synthetic_pattern_count; i++)
+        if (strcmp(name, synthetic_patterns[i]) == 0)
+            pattern = i;
+    if (pattern < 0 || width <= 0 || height <= 0)
+        return NULL;
+
+    Image *img = (Image *)malloc(sizeof(Image));
+    img->width = width;
+    img->height = height;
+    img->maxval = 255;
+    img->data = (uint8_t *)malloc((size_t)width * height);
+    img->map_base = NULL;
+    img->map_size = 0;
+    if (!img->data) {
+        free(img);
+        return NULL;
+    }
+
+    uint64_t state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+    double cx = width / 2.0, cy = height / 2.0;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = img->data + (size_t)y * width;
+        switch (pattern) {
+        case 0:
+            memset(row, 128, width);
+            break;
+        case 1:
+            for (int x = 0; x < width; x++)
+                row[x] = (uint8_t)(xorshift64(&state) >> 56);
+            break;
+        case 2:
+            for (int x = 0; x < width; x++)
+                row[x] = (uint8_t)((uint64_t)(x + y) * 255 / (width + height > 2 ? width + height - 2 : 1));
+            break;
+        case 3:
+            for (int x = 0; x < width; x++) {
+                double d = sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+                row[x] = ((int)(d / RING_WIDTH) & 1) ? 200 : 40;
+            }
+            break;
+        case 4:
+            // Even rows are corridor; odd rows are wall with one gap,
+            // alternating between the right and left ends
+            if (y % 2 == 0) {
+                memset(row, 255, width);
+            } else {
+                memset(row, 0, width);
+                row[(y / 2) % 2 == 0 ? width - 1 : 0] = 255;
+            }
+            break;
+        }
+    }
+    return img;
+}
@@ -0,0 +1,30 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <stdint.h>
+#include "../common/image_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Synthetic 8-bit inputs that stress different parts of the engines:
+//   uniform   one flat region (best case)
+//   noise     white noise; many tiny regions
+//   gradient  diagonal ramp below any useful threshold; one region spanning
+//             the image
+//   rings     concentric bands 8 pixels wide; long curved boundaries
+//   snake     one-pixel corridor winding row by row through walls; a single
+//             region whose labels need a sweep per corridor pixel travelled
+//             against the scan direction (worst case for merge_labels)
+extern const char *const synthetic_patterns[];
+extern const int synthetic_pattern_count;
+
+// NULL if name is not a pattern; free the result with free_image
+Image *generate_pattern(const char *name, int width, int height, uint64_t seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,273 @@
+#include "buffer_pool.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define POOL_MIN_SHIFT   16         // smallest class: 64 KiB
+#define POOL_CLASSES     48
+#define POOL_MAX_CACHED  8          // buffers kept per class
+#define HUGE_PAGE_BYTES  ((size_t)2 << 20)
+#define POOL_EXACT_BYTES ((size_t)64 << 20) // from here on, page-rounded
+#define POOL_MAX_EXACT   4          // exact buffers kept, most recently freed first
+#define PAGE_BYTES       ((size_t)4096)
+
+// Cached buffers are linked through their first word
+typedef struct FreeBuffer {
+    struct FreeBuffer *next;
+} FreeBuffer;
+
+static FreeBuffer *free_lists[POOL_CLASSES];
+static int cached[POOL_CLASSES];
+
+// Freed exact-size buffers. A request takes the smallest one that holds it
+// and wastes at most an eighth of it, so a batch of same-sized large images
+// maps its buffers once.
+typedef struct {
+    void *ptr;
+    size_t bytes;
+} ExactBuffer;
+
+static ExactBuffer exact_cache[POOL_MAX_EXACT];
+static int exact_cached;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int huge_pages = -1;         // POOL_HUGE_*, -1 until read from the environment
+
+// Mapped size of every buffer handed out, keyed by address (open addressing,
+// linear probing, power-of-two capacity), so pool_free never trusts the
+// caller's size. Guarded by pool_lock.
+typedef struct {
+    void *ptr;
+    size_t bytes;
+} Block;
+
+static Block *blocks;
+static size_t block_cap, block_count;
+
+static size_t block_slot(const void *ptr, size_t cap) {
+    return (size_t)(((uintptr_t)ptr >> 12) * 0x9E3779B97F4A7C15ull) & (cap - 1);
+}
+
+static int record_block(void *ptr, size_t bytes) {
+    if (2 * (block_count + 1) > block_cap) {
+        size_t cap = block_cap ? 2 * block_cap : 64;
+        Block *grown = (Block *)calloc(cap, sizeof(Block));
+        if (!grown)
+            return -1;
+        for (size_t i = 0; i < block_cap; i++) {
+            if (!blocks[i].ptr)
+                continue;
+            size_t s = block_slot(blocks[i].ptr, cap);
+            while (grown[s].ptr)
+                s = (s + 1) & (cap - 1);
+            grown[s] = blocks[i];
+        }
+        free(blocks);
+        blocks = grown;
+        block_cap = cap;
+    }
+    size_t s = block_slot(ptr, block_cap);
+    while (blocks[s].ptr)
+        s = (s + 1) & (block_cap - 1);
+    blocks[s].ptr = ptr;
+    blocks[s].bytes = bytes;
+    block_count++;
+    return 0;
+}
+
+// Remove ptr and return its mapped size, or 0 if it was never recorded.
+// Later entries of the probe run shift back into the hole.
+static size_t forget_block(const void *ptr) {
+    if (!block_cap)
+        return 0;
+    size_t s = block_slot(ptr, block_cap);
+    while (blocks[s].ptr && blocks[s].ptr != ptr)
+        s = (s + 1) & (block_cap - 1);
+    if (!blocks[s].ptr)
+        return 0;
+    size_t bytes = blocks[s].bytes;
+    size_t hole = s;
+    for (size_t i = (s + 1) & (block_cap - 1); blocks[i].ptr; i = (i + 1) & (block_cap - 1)) {
+        size_t home = block_slot(blocks[i].ptr, block_cap);
+        // Move entry i into the hole unless its home lies cyclically in (hole, i]
+        if (hole <= i ? (home <= hole || home > i) : (home <= hole && home > i)) {
+            blocks[hole] = blocks[i];
+            hole = i;
+        }
+    }
+    blocks[hole].ptr = NULL;
+    block_count--;
+    return bytes;
+}
+
+static int size_class(size_t bytes) {
+    int c = 0;
+    while (c < POOL_CLASSES - 1 && ((size_t)1 << (c + POOL_MIN_SHIFT)) < bytes)
+        c++;
+    return c;
+}
+
+static size_t class_bytes(int c) {
+    return (size_t)1 << (c + POOL_MIN_SHIFT);
+}
+
+static int huge_mode(void) {
+    if (huge_pages < 0) {
+        const char *env = getenv("SM_HUGEPAGES");
+        if (env && strcmp(env, "hugetlb") == 0)
+            huge_pages = POOL_HUGE_HUGETLB;
+        else if (env && (strcmp(env, "thp") == 0 || strcmp(env, "1") == 0))
+            huge_pages = POOL_HUGE_THP;
+        else
+            huge_pages = POOL_HUGE_OFF;         // unset, "off" or anything else
+    }
+    return huge_pages;
+}
+
+// Map *bytes (a class size, or a page multiple for exact buffers), 2 MiB
+// aligned when it is at least that large, by over-mapping and trimming the
+// unaligned ends. hugetlbfs mappings round *bytes up to whole huge pages.
+static void *map_buffer(size_t *bytes) {
+    size_t n = *bytes;
+    if (n < HUGE_PAGE_BYTES) {
+        void *p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p;
+    }
+#ifdef MAP_HUGETLB
+    // hugetlbfs mappings are huge-page aligned by construction
+    if (huge_mode() == POOL_HUGE_HUGETLB) {
+        size_t huge = (n + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+        void *p = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *bytes = huge;
+            return p;
+        }
+    }
+#endif
+    size_t span = n + HUGE_PAGE_BYTES;
+    uint8_t *raw = (uint8_t *)mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+    uint8_t *p = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1));
+    if (p > raw)
+        munmap(raw, p - raw);
+    if (raw + span > p + n)
+        munmap(p + n, raw + span - (p + n));
+#ifdef MADV_HUGEPAGE
+    if (huge_mode() != POOL_HUGE_OFF)
+        madvise(p, n, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+// Buffers below POOL_EXACT_BYTES come from the class lists; larger ones are
+// mapped at their page-rounded size, since a power of two could waste
+// nearly half of a multi-gigabyte request, or taken from the exact cache
+static void *take(size_t bytes, int *fresh) {
+    if (!bytes)
+        bytes = 1;
+    FreeBuffer *b = NULL;
+    size_t mapped;
+    if (bytes >= POOL_EXACT_BYTES) {
+        mapped = (bytes + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1);
+        pthread_mutex_lock(&pool_lock);
+        int best = -1;
+        for (int i = 0; i < exact_cached; i++)
+            if (exact_cache[i].bytes >= mapped && exact_cache[i].bytes - mapped <= exact_cache[i].bytes / 8 &&
+                (best < 0 || exact_cache[i].bytes < exact_cache[best].bytes))
+                best = i;
+        if (best >= 0) {
+            b = (FreeBuffer *)exact_cache[best].ptr;
+            mapped = exact_cache[best].bytes;
+            memmove(&exact_cache[best], &exact_cache[best + 1], (exact_cached - best - 1) * sizeof(ExactBuffer));
+            exact_cached--;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    } else {
+        int c = size_class(bytes);
+        mapped = class_bytes(c);
+        pthread_mutex_lock(&pool_lock);
+        b = free_lists[c];
+        if (b) {
+            free_lists[c] = b->next;
+            cached[c]--;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    *fresh = b == NULL;
+    void *p = b ? (void *)b : map_buffer(&mapped);
+    if (p) {
+        pthread_mutex_lock(&pool_lock);
+        int err = record_block(p, mapped);
+        pthread_mutex_unlock(&pool_lock);
+        if (err) {
+            munmap(p, mapped);
+            p = NULL;
+        }
+    }
+    return p;
+}
+
+void *pool_alloc(size_t bytes) {
+    int fresh;
+    return take(bytes, &fresh);
+}
+
+void *pool_calloc(size_t bytes) {
+    int fresh;
+    void *p = take(bytes, &fresh);
+    if (p && !fresh)
+        memset(p, 0, bytes);
+    return p;
+}
+
+void pool_free(void *ptr, size_t bytes) {
+    (void)bytes;
+    if (!ptr)
+        return;
+    pthread_mutex_lock(&pool_lock);
+    size_t mapped = forget_block(ptr);
+    int c = size_class(mapped);
+    if (mapped && mapped < POOL_EXACT_BYTES && class_bytes(c) == mapped && cached[c] < POOL_MAX_CACHED) {
+        FreeBuffer *b = (FreeBuffer *)ptr;
+        b->next = free_lists[c];
+        free_lists[c] = b;
+        cached[c]++;
+        ptr = NULL;
+    } else if (mapped >= POOL_EXACT_BYTES) {
+        // Keep it at the front; the least recently freed one drops out
+        ExactBuffer evicted = { NULL, 0 };
+        if (exact_cached == POOL_MAX_EXACT)
+            evicted = exact_cache[--exact_cached];
+        memmove(&exact_cache[1], &exact_cache[0], exact_cached * sizeof(ExactBuffer));
+        exact_cache[0].ptr = ptr;
+        exact_cache[0].bytes = mapped;
+        exact_cached++;
+        ptr = evicted.ptr;
+        mapped = evicted.bytes;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (ptr && mapped)
+        munmap(ptr, mapped);
+}
+
+void pool_set_huge_pages(int mode) {
+    huge_pages = mode;
+}
+
+void pool_trim(void) {
+    pthread_mutex_lock(&pool_lock);
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        while (free_lists[c]) {
+            FreeBuffer *b = free_lists[c];
+            free_lists[c] = b->next;
+            munmap(b, class_bytes(c));
+        }
+        cached[c] = 0;
+    }
+    for (int i = 0; i < exact_cached; i++)
+        munmap(exact_cache[i].ptr, exact_cache[i].bytes);
+    exact_cached = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,42 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size-classed pool for image, label and scratch buffers. Requests are
+// rounded up to a power of two of at least 64 KiB and mapped directly;
+// buffers of 2 MiB or more start on a 2 MiB boundary so the kernel can back
+// them with huge pages. Freed buffers are kept per class and handed out
+// again, so repeated runs (batches, MPI iterations) skip the mmap/munmap
+// and page-fault cost. Requests of 64 MiB or more are instead mapped at
+// their page-rounded size; the last few freed are kept and reused for
+// requests they fit with at most an eighth to spare. Thread-safe. A reused
+// buffer is not cleared.
+
+void *pool_alloc(size_t bytes);
+// Zeroed buffer; fresh mappings are already zero and are not touched
+void *pool_calloc(size_t bytes);
+// The pool records each buffer's mapped size, so bytes is informational;
+// callers pass the requested size for symmetry with pool_alloc
+void pool_free(void *ptr, size_t bytes);
+// Huge page backing for new 2 MiB+ buffers. POOL_HUGE_THP marks them
+// MADV_HUGEPAGE; POOL_HUGE_HUGETLB maps them from the hugetlbfs pool
+// (MAP_HUGETLB) and falls back to THP when no huge pages are reserved.
+// Off by default; SM_HUGEPAGES=thp or SM_HUGEPAGES=hugetlb in the
+// environment selects a mode (1 means thp).
+#define POOL_HUGE_OFF     0
+#define POOL_HUGE_THP     1
+#define POOL_HUGE_HUGETLB 2
+void pool_set_huge_pages(int mode);
+// Unmap every cached buffer
+void pool_trim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cli.h"
+
+void default_options(cli_options *opts) {
+    memset(opts, 0, sizeof(*opts));
+    sm_default_params(&opts->params);
+}
+
+// Option prefix, CLI_* bit and help line, in the order print_options lists them
+static const struct {
+    const char *prefix;
+    unsigned bit;
+    const char *help;
+} options[] = {
+    { "--connectivity=", CLI_CONNECTIVITY, "  --connectivity=4|8                 neighbourhood used for merging (default 4)" },
+    { "--threshold=",    CLI_THRESHOLD,    "  --threshold=N                      merge neighbours with |a - b| < N" },
+    { "--engine=",       CLI_ENGINE,       "  --engine=serial|openmp|union-find  labeling engine" },
+    { "--label-bytes=",  CLI_LABEL_BYTES,  "  --label-bytes=4|8                  label width (default: 4 unless over 2^32 pixels)" },
+    { "--labels=",       CLI_LABELS,       "  --labels=FILE.npy                  also write the full-precision label map" },
+    { "--rle=",          CLI_RLE,          "  --rle=FILE.rle                     also write run-length encoded labels" },
+    { "--stats",         CLI_STATS,        "  --stats                            print segmentation time and sweeps to stderr" },
+    { "--metrics=",      CLI_METRICS,      "  --metrics=json[:FILE]              per-phase timings as JSON (default stderr)" },
+    { "--counters",      CLI_COUNTERS,     "  --counters                         add cycles, instructions, LLC/dTLB and branch misses" },
+    { "--trace=",        CLI_TRACE,        "  --trace=FILE.json                  Chrome/Perfetto timeline of every phase and thread" },
+    { "--telemetry=",    CLI_TELEMETRY,    "  --telemetry=FILE.csv               per-sweep label writes, changed rows and max label drop" },
+};
+
+#define NUM_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+int parse_options(int argc, char *argv[], int first, unsigned supported, cli_options *opts) {
+    for (int i = first; i < argc; i++) {
+        const char *arg = argv[i];
+        size_t k = 0;
+        while (k < NUM_OPTIONS && strncmp(arg, options[k].prefix, strlen(options[k].prefix)) != 0)
+            k++;
+        if (k == NUM_OPTIONS || !(options[k].bit & supported))
+            return -1;
+
+        if (strncmp(arg, "--connectivity=", 15) == 0) {
+            if (sscanf(arg + 15, "%d", &opts->params.connectivity) != 1 ||
+                (opts->params.connectivity != 4 && opts->params.connectivity != 8))
+                return -1;
+        } else if (strncmp(arg, "--threshold=", 12) == 0) {
+            if (sscanf(arg + 12, "%d", &opts->params.threshold) != 1 || opts->params.threshold < 0)
+                return -1;
+        } else if (strncmp(arg, "--engine=", 9) == 0) {
+            if (sm_engine_from_name(arg + 9, &opts->params.engine) != SM_OK)
+                return -1;
+        } else if (strncmp(arg, "--label-bytes=", 14) == 0) {
+            if (sscanf(arg + 14, "%d", &opts->params.label_bytes) != 1 ||
+                (opts->params.label_bytes != 4 && opts->params.label_bytes != 8))
+                return -1;
+        } else if (strncmp(arg, "--labels=", 9) == 0 && arg[9]) {
+            opts->labels_path = arg + 9;
+        } else if (strncmp(arg, "--rle=", 6) == 0 && arg[6]) {
+            opts->rle_path = arg + 6;
+        } else if (strncmp(arg, "--telemetry=", 12) == 0 && arg[12]) {
+            opts->telemetry_path = arg + 12;
+        } else if (strcmp(arg, "--stats") == 0) {
+            opts->stats = 1;
+        } else if (strncmp(arg, "--metrics=json", 14) == 0 && (!arg[14] || (arg[14] == ':' && arg[15]))) {
+            opts->metrics = 1;
+            opts->metrics_path = arg[14] ? arg + 15 : NULL;
+        } else if (strncmp(arg, "--trace=", 8) == 0 && arg[8]) {
+            opts->trace_path = arg + 8;
+        } else if (strcmp(arg, "--counters") == 0) {
+            opts->counters = 1;
+            opts->metrics = 1;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void print_usage(const char *prog, unsigned supported) {
+    printf("Usage: %s input.pgm output.pgm [options]\n", prog);
+    print_options(supported);
+}
+
+void print_options(unsigned supported) {
+    for (size_t k = 0; k < NUM_OPTIONS; k++)
+        if (options[k].bit & supported)
+            printf("%s\n", options[k].help);
+}
+
+double cli_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void print_stats(double seconds, int sweeps, size_t regions) {
+    fprintf(stderr, "stats: seconds=%.6f sweeps=%d regions=%zu\n", seconds, sweeps, regions);
+}
+
+void write_metrics(const cli_options *opts, const char *binary, int width, int height,
+                   const sm_metrics *m, const sm_phase_times *ranks, int num_ranks) {
+    FILE *fp = opts->metrics_path ? fopen(opts->metrics_path, "w") : stderr;
+    if (!fp) {
+        perror("Error writing metrics");
+        return;
+    }
+    fprintf(fp, "{\"binary\": \"%s\", \"engine\": \"%s\", \"width\": %d, \"height\": %d, "
+                "\"connectivity\": %d, \"threshold\": %d,\n",
+            binary, ranks ? "mpi" : sm_engine_name(opts->params.engine), width, height,
+            opts->params.connectivity, opts->params.threshold);
+    if (opts->counters) {
+        const char *sep = "";
+        fprintf(fp, " \"counters\": [");
+        for (int c = 0; c < SM_COUNTER_COUNT; c++) {
+            if (m->counter_mask & (1u << c)) {
+                fprintf(fp, "%s\"%s\"", sep, sm_counter_name((sm_counter)c));
+                sep = ", ";
+            }
+        }
+        fprintf(fp, "],\n");
+    }
+    fprintf(fp, " \"phases\": ");
+    sm_phase_times_json(fp, &m->phases, m->counter_mask);
+
+    int threads = 0;
+    for (int t = 0; t < m->max_threads; t++)
+        for (int p = 0; p < SM_PHASE_COUNT; p++)
+            if (m->threads[t].calls[p])
+                threads = t + 1;
+    if (threads) {
+        fprintf(fp, ",\n \"threads\": [");
+        for (int t = 0; t < threads; t++) {
+            fprintf(fp, "%s\n  {\"thread\": %d, \"phases\": ", t ? "," : "", t);
+            sm_phase_times_json(fp, &m->threads[t], m->counter_mask);
+            fputc('}', fp);
+        }
+        fprintf(fp, "]");
+    }
+    if (ranks) {
+        fprintf(fp, ",\n \"ranks\": [");
+        for (int r = 0; r < num_ranks; r++) {
+            fprintf(fp, "%s\n  {\"rank\": %d, \"phases\": ", r ? "," : "", r);
+            sm_phase_times_json(fp, &ranks[r], m->counter_mask);
+            fputc('}', fp);
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "}\n");
+    if (fp != stderr)
+        fclose(fp);
+}
+
+void enable_counters(sm_metrics *m) {
+    if (!sm_metrics_enable_counters(m))
+        fprintf(stderr, "Hardware counters unavailable: perf_event_open failed "
+                        "(no PMU, or kernel.perf_event_paranoid too high); reporting times only\n");
+}
+
+// Events kept per thread; a run with more keeps its latest ones
+#define TRACE_CAPACITY (1 << 16)
+
+void start_trace(const cli_options *opts) {
+    if (opts->trace_path)
+        sm_trace_enable(TRACE_CAPACITY);
+}
+
+void finish_trace(const cli_options *opts, const char *binary) {
+    if (!opts->trace_path)
+        return;
+    size_t len;
+    char *events = sm_trace_json(0, binary, &len);
+    if (sm_trace_write(opts->trace_path, &events, 1) != 0)
+        perror("Error writing trace");
+    if (sm_trace_dropped())
+        fprintf(stderr, "Trace kept the last %d events per thread; %zu earlier ones were dropped\n",
+                TRACE_CAPACITY, sm_trace_dropped());
+    free(events);
+}
@@ -0,0 +1,75 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include "splitmerge.h"
+#include "trace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Options shared by the driver binaries; they follow the two positional
+// arguments (input and output file)
+typedef struct {
+    sm_params params;
+    const char *labels_path;    // --labels=FILE.npy: also write full-precision labels
+    const char *rle_path;       // --rle=FILE.rle: also write run-length encoded labels
+    int stats;                  // --stats: print segmentation time and sweep count to stderr
+    int metrics;                // --metrics=json[:FILE]: per-phase timings as JSON
+    const char *metrics_path;   // FILE from --metrics, or NULL for stderr
+    int counters;               // --counters: add hardware counters to the metrics report
+    const char *trace_path;     // --trace=FILE.json: Chrome trace of every phase
+    const char *telemetry_path; // --telemetry=FILE.csv: per-sweep convergence series
+} cli_options;
+
+// Which of the shared options a driver implements
+#define CLI_CONNECTIVITY    (1u << 0)
+#define CLI_THRESHOLD       (1u << 1)
+#define CLI_ENGINE          (1u << 2)
+#define CLI_LABEL_BYTES     (1u << 3)
+#define CLI_LABELS          (1u << 4)
+#define CLI_RLE             (1u << 5)
+#define CLI_STATS           (1u << 6)
+#define CLI_METRICS         (1u << 7)
+#define CLI_COUNTERS        (1u << 8)
+#define CLI_TRACE           (1u << 9)
+#define CLI_TELEMETRY       (1u << 10)
+#define CLI_ALL             ((1u << 11) - 1)
+
+// Fill opts with the library defaults and no optional outputs
+void default_options(cli_options *opts);
+// Parse argv[first..argc) into opts (which should hold the defaults).
+// Returns 0 on success, -1 on an unknown or malformed option or on one
+// outside supported (CLI_* bits), so a driver never silently ignores one.
+int parse_options(int argc, char *argv[], int first, unsigned supported, cli_options *opts);
+// Usage line for the input.pgm output.pgm drivers, then print_options
+void print_usage(const char *prog, unsigned supported);
+// One line per supported option
+void print_options(unsigned supported);
+
+// Monotonic wall clock in seconds, for timing the segmentation phase
+double cli_seconds(void);
+// The --stats line: "stats: seconds=S sweeps=N regions=R", parsed by the
+// benchmark runner
+void print_stats(double seconds, int sweeps, size_t regions);
+
+// The --metrics report: the run, per-phase totals, the per-thread table of
+// m when any thread recorded into it, and num_ranks per-rank breakdowns when
+// ranks is not NULL (the MPI driver passes each phase's maximum over ranks
+// as the totals)
+void write_metrics(const cli_options *opts, const char *binary, int width, int height,
+                   const sm_metrics *m, const sm_phase_times *ranks, int num_ranks);
+// --trace: start recording (the drivers then time phases even without
+// --metrics) and, for single-process drivers, write the trace at exit
+void start_trace(const cli_options *opts);
+void finish_trace(const cli_options *opts, const char *binary);
+
+// Turn on m's hardware counters for --counters, warning on stderr when the
+// system provides none
+void enable_counters(sm_metrics *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef EDGE_MASK_H
+#define EDGE_MASK_H
+
+// Bits of the per-pixel edge mask. Each pixel records which of its forward
+// neighbours (right, down and, for 8-connectivity, the two lower diagonals)
+// pass the similarity test, so the merge sweeps never touch pixel values.
+#define EDGE_RIGHT      0x1
+#define EDGE_DOWN       0x2
+#define EDGE_DOWN_RIGHT 0x4
+#define EDGE_DOWN_LEFT  0x8
+
+#endif
@@ -1,50 +1,1173 @@
 #include "image_io.h"
+#include "buffer_pool.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef SM_HAVE_LZ4
+#include <lz4.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define HAVE_SSSE3_KERNEL 1
+#endif
+
+typedef struct {
+    int width;
+    int height;
+    int maxval;
+    size_t offset;      // first raster byte
+} PgmHeader;
+
+// Skip whitespace and '#' comments (which run to end of line)
+static size_t skip_space(const uint8_t *buf, size_t len, size_t pos) {
+    while (pos < len) {
+        if (buf[pos] == '#') {
+            while (pos < len && buf[pos] != '\n' && buf[pos] != '\r')
+                pos++;
+        } else if (isspace(buf[pos])) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+static int parse_uint(const uint8_t *buf, size_t len, size_t *pos, int *value) {
+    size_t p = skip_space(buf, len, *pos);
+    long v = 0;
+    size_t start = p;
+    while (p < len && isdigit(buf[p]) && v <= 0x7fffffff)
+        v = v * 10 + (buf[p++] - '0');
+    if (p == start || v > 0x7fffffff)
+        return -1;
+    *value = (int)v;
+    *pos = p;
+    return 0;
+}
+
+// Parse a binary PNM header; the raster starts after exactly one whitespace
+// byte following maxval
+static int parse_header(const uint8_t *buf, size_t len, const char *magic, PgmHeader *hdr) {
+    size_t pos = 0;
+    if (len < 2 || buf[0] != magic[0] || buf[1] != magic[1])
+        return -1;
+    pos = 2;
+    if (parse_uint(buf, len, &pos, &hdr->width) ||
+        parse_uint(buf, len, &pos, &hdr->height) ||
+        parse_uint(buf, len, &pos, &hdr->maxval))
+        return -1;
+    if (pos >= len || !isspace(buf[pos]))
+        return -1;
+    hdr->offset = pos + 1;
+    if (hdr->width <= 0 || hdr->height <= 0 || hdr->maxval <= 0 || hdr->maxval > 65535)
+        return -1;
+    return 0;
+}
+
+// Fallback for inputs that cannot be mapped: slurp the whole stream
+static uint8_t *read_all(int fd, size_t *len) {
+    size_t cap = 1 << 20, n = 0;
+    uint8_t *buf = (uint8_t *)malloc(cap);
+    ssize_t got;
+    while (buf && (got = read(fd, buf + n, cap - n)) > 0) {
+        n += got;
+        if (n == cap) {
+            cap *= 2;
+            uint8_t *grown = (uint8_t *)realloc(buf, cap);
+            if (!grown)
+                free(buf);
+            buf = grown;
+        }
+    }
+    if (!buf) {
+        fprintf(stderr, "Out of memory reading image\n");
+        exit(EXIT_FAILURE);
+    }
+    *len = n;
+    return buf;
+}
+
+// Copy n 16-bit samples, swapping byte order (PGM stores them big-endian)
+static void swap16_copy(uint16_t *dst, const uint8_t *src, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = (uint16_t)(src[2 * i] << 8 | src[2 * i + 1]);
+}
+
+// Fixed-point Rec. 601 luma: (77 R + 150 G + 29 B + 128) >> 8
+#define LUMA(r, g, b) (((uint32_t)(r) * 77 + (uint32_t)(g) * 150 + (uint32_t)(b) * 29 + 128) >> 8)
+
+static void rgb_to_luma_scalar(uint8_t *dst, const uint8_t *rgb, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (uint8_t)LUMA(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+#ifdef HAVE_SSSE3_KERNEL
+// 16 pixels per step: three pshufb per channel de-interleave the 48 RGB
+// bytes, then the weighted sum runs in 16-bit lanes. Matches the scalar
+// LUMA exactly (the largest sum, 255 * 256 + 128, still fits in 16 bits).
+__attribute__((target("ssse3")))
+static void rgb_to_luma_ssse3(uint8_t *dst, const uint8_t *rgb, size_t n) {
+    // shuf[c][j] gathers channel c's bytes held by the j-th 16-byte load
+    int8_t shuf[3][3][16];
+    for (int c = 0; c < 3; c++)
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 16; k++) {
+                int pos = 3 * k + c;
+                shuf[c][j][k] = pos / 16 == j ? (int8_t)(pos % 16) : (int8_t)0x80;
+            }
+
+    __m128i ch_mask[3][3];
+    for (int c = 0; c < 3; c++)
+        for (int j = 0; j < 3; j++)
+            ch_mask[c][j] = _mm_loadu_si128((const __m128i *)shuf[c][j]);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wr = _mm_set1_epi16(77), wg = _mm_set1_epi16(150), wb = _mm_set1_epi16(29);
+    const __m128i round = _mm_set1_epi16(128);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const uint8_t *p = rgb + 3 * i;
+        __m128i in[3] = {
+            _mm_loadu_si128((const __m128i *)p),
+            _mm_loadu_si128((const __m128i *)(p + 16)),
+            _mm_loadu_si128((const __m128i *)(p + 32)),
+        };
+        __m128i ch[3];
+        for (int c = 0; c < 3; c++)
+            ch[c] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in[0], ch_mask[c][0]),
+                                              _mm_shuffle_epi8(in[1], ch_mask[c][1])),
+                                 _mm_shuffle_epi8(in[2], ch_mask[c][2]));
+
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(ch[0], zero), wr),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(ch[1], zero), wg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(ch[2], zero), wb), round));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(ch[0], zero), wr),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(ch[1], zero), wg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(ch[2], zero), wb), round));
+        __m128i y = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128((__m128i *)(dst + i), y);
+    }
+    rgb_to_luma_scalar(dst + i, rgb + 3 * i, n - i);
+}
+#endif
+
+// Convert n interleaved 8-bit RGB pixels to luminance
+static void rgb_to_luma(uint8_t *dst, const uint8_t *rgb, size_t n) {
+#ifdef HAVE_SSSE3_KERNEL
+    if (__builtin_cpu_supports("ssse3")) {
+        rgb_to_luma_ssse3(dst, rgb, n);
+        return;
+    }
+#endif
+    rgb_to_luma_scalar(dst, rgb, n);
+}
+
+// Same for 16-bit (big-endian) RGB samples
+static void rgb16_to_luma(uint16_t *dst, const uint8_t *rgb, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *p = rgb + 6 * i;
+        dst[i] = (uint16_t)LUMA(p[0] << 8 | p[1], p[2] << 8 | p[3], p[4] << 8 | p[5]);
+    }
+}
+
+// Store the file's raster as read_pgm hands it out: 16-bit samples in host
+// order, colour as luminance
+static void convert_raster(uint8_t *dst, const uint8_t *src, size_t pixels, size_t sample_bytes, int colour) {
+    if (colour && sample_bytes == 2)
+        rgb16_to_luma((uint16_t *)dst, src, pixels);
+    else if (colour)
+        rgb_to_luma(dst, src, pixels);
+    else if (sample_bytes == 2)
+        swap16_copy((uint16_t *)dst, src, pixels);
+    else
+        memcpy(dst, src, pixels);
+}
 
 Image* read_pgm(const char *filename) {
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         perror("Error opening file");
         exit(EXIT_FAILURE);
     }
 
-    char magic[3];
-    fscanf(fp, "%2s\n", magic);
-    if (magic[0] != 'P' || magic[1] != '5') {
+    struct stat st;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        len = st.st_size;
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+        madvise(map, len, MADV_SEQUENTIAL);
+        buf = (uint8_t *)map;
+    } else {
+        buf = read_all(fd, &len);
+    }
+    close(fd);
+
+    // P6 colour input is converted to luminance while loading
+    PgmHeader hdr;
+    int colour = parse_header(buf, len, "P6", &hdr) == 0;
+    if (!colour && parse_header(buf, len, "P5", &hdr) != 0) {
         fprintf(stderr, "Unsupported file format!\n");
         exit(EXIT_FAILURE);
     }
+    size_t pixels = (size_t)hdr.width * hdr.height;
+    size_t sample_bytes = hdr.maxval > 255 ? 2 : 1;
+    size_t raster = pixels * sample_bytes;
+    if (len - hdr.offset < raster * (colour ? 3 : 1)) {
+        fprintf(stderr, "%s: truncated image data\n", filename);
+        exit(EXIT_FAILURE);
+    }
 
     Image *img = (Image*)malloc(sizeof(Image));
+    img->width = hdr.width;
+    img->height = hdr.height;
+    img->maxval = hdr.maxval;
+    if (colour || hdr.maxval > 255) {
+        // Converting in place would copy every page anyway; convert into an
+        // aligned buffer instead and drop the raw bytes
+        uint8_t *samples = (uint8_t *)malloc(raster);
+        if (!samples) {
+            fprintf(stderr, "Out of memory reading image\n");
+            exit(EXIT_FAILURE);
+        }
+        convert_raster(samples, buf + hdr.offset, pixels, sample_bytes, colour);
+        if (map != MAP_FAILED)
+            munmap(map, len);
+        else
+            free(buf);
+        img->data = samples;
+        img->map_base = NULL;
+        img->map_size = 0;
+    } else if (map != MAP_FAILED) {
+        img->data = buf + hdr.offset;
+        img->map_base = map;
+        img->map_size = len;
+    } else {
+        memmove(buf, buf + hdr.offset, raster);
+        img->data = buf;
+        img->map_base = NULL;
+        img->map_size = 0;
+    }
+    return img;
+}
 
-    int maxval;
-    fscanf(fp, "%d %d\n%d\n", &img->width, &img->height, &maxval);
+// Longest header read_pgm_into will search for the raster offset
+#define PGM_HEADER_MAX (1 << 20)
 
-    img->data = (uint8_t*)malloc(img->width * img->height);
+// read() until n bytes or end of file; returns the byte count
+static size_t read_full(int fd, uint8_t *buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = read(fd, buf + done, n - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        done += got;
+    }
+    return done;
+}
 
-    fread(img->data, 1, img->width * img->height, fp);
+int read_pgm_into(const char *filename, Image *img, size_t *capacity) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return -1;
+    }
 
-    fclose(fp);
-    return img;
+    // The header usually fits in the first block; long comment blocks grow
+    // it up to PGM_HEADER_MAX. Plain 8-bit rasters are then read straight
+    // into the caller's buffer
+    uint8_t block[4096];
+    uint8_t *head = block;
+    size_t cap = sizeof(block);
+    size_t got = read_full(fd, head, cap);
+    PgmHeader hdr;
+    int colour;
+    for (;;) {
+        colour = parse_header(head, got, "P6", &hdr) == 0;
+        if (colour || parse_header(head, got, "P5", &hdr) == 0)
+            break;
+        uint8_t *grown = got == cap && cap < PGM_HEADER_MAX ? (uint8_t *)malloc(cap * 2) : NULL;
+        if (!grown) {
+            fprintf(stderr, "%s: unsupported file format\n", filename);
+            if (head != block)
+                free(head);
+            close(fd);
+            return -1;
+        }
+        memcpy(grown, head, got);
+        if (head != block)
+            free(head);
+        head = grown;
+        cap *= 2;
+        got += read_full(fd, head + got, cap - got);
+    }
+    size_t pixels = (size_t)hdr.width * hdr.height;
+    size_t sample_bytes = hdr.maxval > 255 ? 2 : 1;
+    size_t raster = pixels * sample_bytes;
+    if (*capacity < raster) {
+        pool_free(img->data, *capacity);
+        *capacity = 0;
+        img->data = (uint8_t *)pool_alloc(raster);
+        if (!img->data) {
+            fprintf(stderr, "%s: out of memory\n", filename);
+            if (head != block)
+                free(head);
+            close(fd);
+            return -1;
+        }
+        *capacity = raster;
+    }
+    img->width = hdr.width;
+    img->height = hdr.height;
+    img->maxval = hdr.maxval;
+    img->map_base = NULL;
+    img->map_size = 0;
+
+    int ok;
+    if (!colour && sample_bytes == 1) {
+        size_t have = got - hdr.offset < raster ? got - hdr.offset : raster;
+        memcpy(img->data, head + hdr.offset, have);
+        ok = read_full(fd, img->data + have, raster - have) == raster - have;
+    } else {
+        // Converted formats go through a mapping of the whole file
+        size_t file_raster = raster * (colour ? 3 : 1);
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= hdr.offset + file_raster)
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = map != MAP_FAILED;
+        if (ok) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            convert_raster(img->data, (const uint8_t *)map + hdr.offset, pixels, sample_bytes, colour);
+            munmap(map, st.st_size);
+        }
+    }
+    if (head != block)
+        free(head);
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "%s: truncated image data\n", filename);
+        return -1;
+    }
+    return 0;
 }
 
-void write_pgm(const char *filename, const Image *img) {
+PgmStream *pgm_stream_open(FILE *fp) {
+    // Grow the header a byte at a time until it parses, so nothing past the
+    // header is consumed from a pipe
+    uint8_t buf[4096];
+    size_t len = 0;
+    PgmHeader hdr;
+    int colour = 0;
+    int c;
+    while (len < sizeof(buf) && (c = getc(fp)) != EOF) {
+        buf[len++] = (uint8_t)c;
+        if (len > 2 && isspace(buf[len - 1])) {
+            if (parse_header(buf, len, "P5", &hdr) == 0)
+                break;
+            if (parse_header(buf, len, "P6", &hdr) == 0) {
+                colour = 1;
+                break;
+            }
+        }
+    }
+    if (len == 0 || (!colour && parse_header(buf, len, "P5", &hdr) != 0))
+        return NULL;
+    PgmStream *s = pgm_stream_open_raw(fp, hdr.width, hdr.maxval);
+    if (!s)
+        return NULL;
+    s->height = hdr.height;
+    if (colour) {
+        s->colour = 1;
+        s->raw_bytes *= 3;
+        free(s->raw);
+        s->raw = (uint8_t *)malloc(s->raw_bytes);
+        if (!s->raw) {
+            free(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+PgmStream *pgm_stream_open_raw(FILE *fp, int width, int maxval) {
+    if (width <= 0 || maxval <= 0 || maxval > 65535)
+        return NULL;
+    PgmStream *s = (PgmStream *)calloc(1, sizeof(PgmStream));
+    if (!s)
+        return NULL;
+    s->fp = fp;
+    s->width = width;
+    s->maxval = maxval;
+    s->raw_bytes = (size_t)width * (maxval > 255 ? 2 : 1);
+    s->raw = (uint8_t *)malloc(s->raw_bytes);
+    if (!s->raw) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int pgm_stream_read_row(PgmStream *s, void *row) {
+    if (s->height > 0 && s->rows_read >= s->height)
+        return 0;
+    if (fread(s->raw, 1, s->raw_bytes, s->fp) != s->raw_bytes)
+        return 0;
+    convert_raster((uint8_t *)row, s->raw, s->width, s->maxval > 255 ? 2 : 1, s->colour);
+    s->rows_read++;
+    return 1;
+}
+
+void pgm_stream_close(PgmStream *s) {
+    if (!s)
+        return;
+    free(s->raw);
+    free(s);
+}
+
+int write_pgm_file(const char *filename, const Image *img) {
     FILE *fp = fopen(filename, "wb");
     if (!fp) {
-        perror("Error writing file");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return -1;
     }
 
-    fprintf(fp, "P5\n%d %d\n255\n", img->width, img->height);
-    fwrite(img->data, 1, img->width * img->height, fp);
+    size_t pixels = (size_t)img->width * img->height;
+    int maxval = img->maxval > 0 ? img->maxval : 255;
+    fprintf(fp, "P5\n%d %d\n%d\n", img->width, img->height, maxval);
 
-    fclose(fp);
+    size_t written;
+    if (maxval > 255) {
+        uint16_t *be = (uint16_t *)malloc(pixels * 2);
+        if (!be) {
+            fprintf(stderr, "%s: out of memory\n", filename);
+            fclose(fp);
+            return -1;
+        }
+        swap16_copy(be, img->data, pixels);
+        written = fwrite(be, 2, pixels, fp);
+        free(be);
+    } else {
+        written = fwrite(img->data, 1, pixels, fp);
+    }
+    int err = written != pixels ? errno : 0;
+    if (fclose(fp) != 0 && !err)
+        err = errno;
+    if (err || written != pixels) {
+        fprintf(stderr, "%s: %s\n", filename, err ? strerror(err) : "short write");
+        return -1;
+    }
+    return 0;
+}
+
+void write_pgm(const char *filename, const Image *img) {
+    if (write_pgm_file(filename, img) != 0)
+        exit(EXIT_FAILURE);
 }
 
 void free_image(Image *img) {
     if (img) {
-        free(img->data);
+        if (img->map_base)
+            munmap(img->map_base, img->map_size);
+        else
+            free(img->data);
         free(img);
     }
 }
+
+// .npy v1.0 header padded so the array data starts on a 64-byte boundary
+static size_t npy_header(char *hdr, size_t cap, int width, int height, int label_bytes) {
+    char dict[128];
+    int n = snprintf(dict, sizeof(dict), "{'descr': '<u%d', 'fortran_order': False, 'shape': (%d, %d), }",
+                     label_bytes, height, width);
+    size_t total = (10 + n + 1 + 63) / 64 * 64;
+    if (total > cap)
+        return 0;
+    memcpy(hdr, "\x93NUMPY\x01\x00", 8);
+    hdr[8] = (char)((total - 10) & 0xff);
+    hdr[9] = (char)((total - 10) >> 8);
+    memcpy(hdr + 10, dict, n);
+    memset(hdr + 10 + n, ' ', total - 10 - n - 1);
+    hdr[total - 1] = '\n';
+    return total;
+}
+
+void *create_label_map(const char *filename, int width, int height, int label_bytes, LabelMap *map) {
+    char hdr[256];
+    size_t hdr_len = npy_header(hdr, sizeof(hdr), width, height, label_bytes);
+    if (hdr_len == 0 || (label_bytes != 2 && label_bytes != 4 && label_bytes != 8)) {
+        fprintf(stderr, "%s: unsupported label map layout\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = hdr_len + (size_t)width * height * label_bytes;
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, len) == 0)
+        base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    madvise(base, len, MADV_SEQUENTIAL);
+    memcpy(base, hdr, hdr_len);
+
+    map->labels = (uint8_t *)base + hdr_len;
+    map->label_bytes = label_bytes;
+    map->map_base = base;
+    map->map_size = len;
+    return map->labels;
+}
+
+// Parse the .npy header written by npy_header (or numpy itself, for C-order
+// <u2 / <u4 / <u8 arrays); returns the data offset or 0
+static size_t npy_parse(const uint8_t *base, size_t len, int *width, int *height, int *label_bytes) {
+    if (len < 10 || memcmp(base, "\x93NUMPY", 6) != 0)
+        return 0;
+    size_t hdr_len = base[8] | (size_t)base[9] << 8;
+    size_t offset = 10;
+    if (base[6] >= 2) {
+        if (len < 12)
+            return 0;
+        hdr_len = base[8] | (size_t)base[9] << 8 | (size_t)base[10] << 16 | (size_t)base[11] << 24;
+        offset = 12;
+    }
+    if (offset + hdr_len > len || hdr_len >= 512)
+        return 0;
+    char dict[512];
+    memcpy(dict, base + offset, hdr_len);
+    dict[hdr_len] = '\0';
+    const char *descr = strstr(dict, "'descr':");
+    const char *shape = strstr(dict, "'shape':");
+    if (!descr || !shape || strstr(dict, "'fortran_order': True"))
+        return 0;
+    if (strstr(descr, "'<u2'"))
+        *label_bytes = 2;
+    else if (strstr(descr, "'<u4'"))
+        *label_bytes = 4;
+    else if (strstr(descr, "'<u8'"))
+        *label_bytes = 8;
+    else
+        return 0;
+    if (sscanf(shape + 8, " (%d, %d)", height, width) != 2 || *width <= 0 || *height <= 0)
+        return 0;
+    offset += hdr_len;
+    if (len - offset < (size_t)*width * *height * *label_bytes)
+        return 0;
+    return offset;
+}
+
+const void *open_label_map(const char *filename, int *width, int *height, LabelMap *map) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Error reading file");
+        exit(EXIT_FAILURE);
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    int label_bytes;
+    size_t offset = npy_parse((const uint8_t *)base, st.st_size, width, height, &label_bytes);
+    if (offset == 0) {
+        fprintf(stderr, "%s: not a uint32/uint64 label map\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    map->labels = (uint8_t *)base + offset;
+    map->label_bytes = label_bytes;
+    map->map_base = base;
+    map->map_size = st.st_size;
+    return map->labels;
+}
+
+void close_label_map(LabelMap *map) {
+    if (map->map_base)
+        munmap(map->map_base, map->map_size);
+    memset(map, 0, sizeof(*map));
+}
+
+void write_label_map(const char *filename, const void *labels, int width, int height, int label_bytes) {
+    LabelMap map;
+    void *dst = create_label_map(filename, width, height, label_bytes, &map);
+    memcpy(dst, labels, (size_t)width * height * label_bytes);
+    close_label_map(&map);
+}
+
+#define RLE_MAGIC "SMRLE01\n"
+#define RLE_HEADER_BYTES 32
+#define RLE_BUFFER_BYTES (1 << 20)
+
+static uint64_t label_at(const void *labels, int label_bytes, size_t i) {
+    if (label_bytes == 2)
+        return ((const uint16_t *)labels)[i];
+    return label_bytes == 8 ? ((const uint64_t *)labels)[i] : ((const uint32_t *)labels)[i];
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static void rle_flush(RleWriter *w) {
+    if (w->used && fwrite(w->buf, 1, w->used, w->fp) != w->used) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    w->used = 0;
+}
+
+RleWriter *rle_open(const char *filename, int width, int height, int label_bytes) {
+    RleWriter *w = (RleWriter *)calloc(1, sizeof(RleWriter));
+    w->fp = fopen(filename, "wb");
+    if (!w->fp) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    w->width = width;
+    w->height = height;
+    w->label_bytes = label_bytes;
+    w->buf = (uint8_t *)malloc(RLE_BUFFER_BYTES);
+
+    // Header goes first with a zero run count, patched in rle_close
+    memcpy(w->buf, RLE_MAGIC, 8);
+    put_u32(w->buf + 8, width);
+    put_u32(w->buf + 12, height);
+    put_u32(w->buf + 16, label_bytes);
+    put_u32(w->buf + 20, 0);
+    put_u64(w->buf + 24, 0);
+    w->used = RLE_HEADER_BYTES;
+    return w;
+}
+
+void rle_write_run(RleWriter *w, const LabelRun *run) {
+    size_t rec = 12 + w->label_bytes;
+    if (w->used + rec > RLE_BUFFER_BYTES)
+        rle_flush(w);
+    uint8_t *p = w->buf + w->used;
+    put_u32(p, run->row);
+    put_u32(p + 4, run->start);
+    put_u32(p + 8, run->length);
+    if (w->label_bytes == 8) {
+        put_u64(p + 12, run->label);
+    } else if (w->label_bytes == 4) {
+        put_u32(p + 12, (uint32_t)run->label);
+    } else {
+        p[12] = (uint8_t)run->label;
+        p[13] = (uint8_t)(run->label >> 8);
+    }
+    w->used += rec;
+    w->runs++;
+}
+
+void rle_write_row(void *writer, int row, const void *labels, int label_bytes, int width) {
+    RleWriter *w = (RleWriter *)writer;
+    LabelRun run = { (uint32_t)row, 0, 0, label_at(labels, label_bytes, 0) };
+    for (int x = 1; x < width; x++) {
+        uint64_t label = label_at(labels, label_bytes, x);
+        if (label != run.label) {
+            run.length = x - run.start;
+            rle_write_run(w, &run);
+            run.start = x;
+            run.label = label;
+        }
+    }
+    run.length = width - run.start;
+    rle_write_run(w, &run);
+}
+
+void rle_close(RleWriter *w) {
+    rle_flush(w);
+    uint8_t count[8];
+    put_u64(count, w->runs);
+    if (fseek(w->fp, 24, SEEK_SET) != 0 || fwrite(count, 1, 8, w->fp) != 8 || fclose(w->fp) != 0) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    free(w->buf);
+    free(w);
+}
+
+size_t rle_encode_row(const void *labels, int label_bytes, int width, int row, LabelRun *runs) {
+    size_t n = 0;
+    int start = 0;
+    for (int x = 1; x <= width; x++) {
+        if (x == width || label_at(labels, label_bytes, x) != label_at(labels, label_bytes, start)) {
+            LabelRun run = { (uint32_t)row, (uint32_t)start, (uint32_t)(x - start),
+                             label_at(labels, label_bytes, start) };
+            runs[n++] = run;
+            start = x;
+        }
+    }
+    return n;
+}
+
+// Read and check an RLE header: positive dimensions, 4- or 8-byte labels,
+// and a run count between one run per row and one per pixel that the rest
+// of the file actually holds
+static void rle_read_header(FILE *fp, const char *filename, int *width, int *height, int *label_bytes,
+                            uint64_t *count) {
+    uint8_t hdr[RLE_HEADER_BYTES];
+    if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || memcmp(hdr, RLE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not an RLE label file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t w = get_le(hdr + 8, 4), h = get_le(hdr + 12, 4);
+    *label_bytes = (int)get_le(hdr + 16, 4);
+    *count = get_le(hdr + 24, 8);
+    if (*label_bytes != 2 && *label_bytes != 4 && *label_bytes != 8) {
+        fprintf(stderr, "%s: bad label size\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (w == 0 || h == 0 || w > INT_MAX || h > INT_MAX || *count < h || *count > w * h) {
+        fprintf(stderr, "%s: bad RLE header\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+        ((uint64_t)st.st_size - RLE_HEADER_BYTES) / (12 + *label_bytes) < *count) {
+        fprintf(stderr, "%s: truncated run data\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    *width = (int)w;
+    *height = (int)h;
+}
+
+LabelRun *read_rle(const char *filename, int *width, int *height, int *label_bytes, size_t *count) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t total;
+    rle_read_header(fp, filename, width, height, label_bytes, &total);
+
+    // The run array grows with the records actually read, so a header that
+    // claims more runs than the file holds cannot size the allocation
+    size_t rec = 12 + *label_bytes;
+    size_t per_block = RLE_BUFFER_BYTES / rec;
+    size_t cap = 0;
+    LabelRun *runs = NULL;
+    uint8_t *buf = (uint8_t *)malloc(RLE_BUFFER_BYTES);
+    if (!buf) {
+        perror("Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t row = 0, filled = 0;
+    for (size_t done = 0; done < total;) {
+        size_t n = total - done < per_block ? total - done : per_block;
+        if (fread(buf, rec, n, fp) != n) {
+            fprintf(stderr, "%s: truncated run data\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        if (done + n > cap) {
+            cap = cap * 2 > done + n ? cap * 2 : done + n;
+            runs = (LabelRun *)realloc(runs, cap * sizeof(LabelRun));
+            if (!runs) {
+                perror("Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            const uint8_t *p = buf + i * rec;
+            LabelRun run = { (uint32_t)get_le(p, 4), (uint32_t)get_le(p + 4, 4), (uint32_t)get_le(p + 8, 4),
+                             get_le(p + 12, *label_bytes) };
+            // Same rule as rle_read_row: runs tile each row left to right
+            if (run.row != row || run.start != filled || run.length == 0 ||
+                run.length > (uint32_t)*width - filled) {
+                fprintf(stderr, "%s: runs do not tile row %u\n", filename, row);
+                exit(EXIT_FAILURE);
+            }
+            filled += run.length;
+            if (filled == (uint32_t)*width) {
+                row++;
+                filled = 0;
+            }
+            runs[done + i] = run;
+        }
+        done += n;
+    }
+    if (row != (uint32_t)*height) {
+        fprintf(stderr, "%s: runs cover %u of %d rows\n", filename, row, *height);
+        exit(EXIT_FAILURE);
+    }
+    free(buf);
+    fclose(fp);
+    *count = total;
+    return runs;
+}
+
+void rle_decode(const LabelRun *runs, size_t count, void *labels, int label_bytes, int width) {
+    for (size_t r = 0; r < count; r++) {
+        size_t i = (size_t)runs[r].row * width + runs[r].start;
+        for (uint32_t k = 0; k < runs[r].length; k++, i++) {
+            if (label_bytes == 8)
+                ((uint64_t *)labels)[i] = runs[r].label;
+            else if (label_bytes == 4)
+                ((uint32_t *)labels)[i] = (uint32_t)runs[r].label;
+            else
+                ((uint16_t *)labels)[i] = (uint16_t)runs[r].label;
+        }
+    }
+}
+
+RleReader *rle_reader_open(const char *filename) {
+    RleReader *r = (RleReader *)calloc(1, sizeof(RleReader));
+    r->fp = fopen(filename, "rb");
+    if (!r->fp) {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+    rle_read_header(r->fp, filename, &r->width, &r->height, &r->label_bytes, &r->remaining);
+    r->buf = (uint8_t *)malloc(RLE_BUFFER_BYTES);
+    if (!r->buf) {
+        perror("Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    r->filename = filename;
+    return r;
+}
+
+void rle_read_row(RleReader *r, int row, void *labels) {
+    size_t rec = 12 + r->label_bytes;
+    uint32_t filled = 0;
+    while (filled < (uint32_t)r->width) {
+        if (r->pos + rec > r->used) {
+            // Refill with whole records
+            size_t want = (RLE_BUFFER_BYTES / rec) * rec;
+            if (r->remaining * rec < want)
+                want = r->remaining * rec;
+            r->used = want ? fread(r->buf, 1, want, r->fp) : 0;
+            r->pos = 0;
+            if (r->used == 0 || r->used != want) {
+                fprintf(stderr, "%s: truncated run data\n", r->filename);
+                exit(EXIT_FAILURE);
+            }
+        }
+        const uint8_t *p = r->buf + r->pos;
+        LabelRun run = { (uint32_t)get_le(p, 4), (uint32_t)get_le(p + 4, 4), (uint32_t)get_le(p + 8, 4),
+                         get_le(p + 12, r->label_bytes) };
+        if (run.row != (uint32_t)row || run.start != filled || run.length == 0 ||
+            run.length > (uint32_t)r->width - filled) {
+            fprintf(stderr, "%s: runs do not tile row %d\n", r->filename, row);
+            exit(EXIT_FAILURE);
+        }
+        run.row = 0;
+        rle_decode(&run, 1, labels, r->label_bytes, r->width);
+        filled += run.length;
+        r->pos += rec;
+        r->remaining--;
+    }
+}
+
+void rle_reader_close(RleReader *r) {
+    fclose(r->fp);
+    free(r->buf);
+    free(r);
+}
+
+#define TILED_MAGIC "SMTILE1\n"
+#define TILED_HEADER_BYTES 32
+#define TILED_ENTRY_BYTES 16
+
+// Size in pixels of tile (tx, ty); edge tiles are clipped to the image
+static void tile_extent(int width, int height, int tile_size, int tx, int ty, int *tw, int *th) {
+    *tw = width - tx * tile_size < tile_size ? width - tx * tile_size : tile_size;
+    *th = height - ty * tile_size < tile_size ? height - ty * tile_size : tile_size;
+}
+
+void write_tiled(const char *filename, const Image *img, int tile_size, int compression) {
+#ifndef SM_HAVE_LZ4
+    if (compression == TILED_LZ4) {
+        fprintf(stderr, "LZ4 tiles need a build with SM_HAVE_LZ4 (make LZ4=1)\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    int tiles_x = (img->width + tile_size - 1) / tile_size;
+    int tiles_y = (img->height + tile_size - 1) / tile_size;
+    size_t ntiles = (size_t)tiles_x * tiles_y;
+    size_t pixel_bytes = IMAGE_PIXEL_BYTES(img);
+    size_t raw_cap = (size_t)tile_size * tile_size * pixel_bytes;
+    size_t index_bytes = ntiles * TILED_ENTRY_BYTES;
+
+    uint8_t hdr[TILED_HEADER_BYTES];
+    memcpy(hdr, TILED_MAGIC, 8);
+    put_u32(hdr + 8, img->width);
+    put_u32(hdr + 12, img->height);
+    put_u32(hdr + 16, img->maxval);
+    put_u32(hdr + 20, tile_size);
+    put_u32(hdr + 24, compression);
+    put_u32(hdr + 28, 0);
+    uint8_t *index = (uint8_t *)calloc(ntiles, TILED_ENTRY_BYTES);
+    uint8_t *raw = (uint8_t *)malloc(raw_cap);
+    size_t packed_cap = raw_cap;
+#ifdef SM_HAVE_LZ4
+    packed_cap = LZ4_compressBound((int)raw_cap);
+#endif
+    uint8_t *packed = (uint8_t *)malloc(packed_cap);
+    int ok = fwrite(hdr, 1, sizeof(hdr), fp) == sizeof(hdr) && fwrite(index, 1, index_bytes, fp) == index_bytes;
+
+    uint64_t offset = TILED_HEADER_BYTES + index_bytes;
+    for (int ty = 0; ok && ty < tiles_y; ty++) {
+        for (int tx = 0; ok && tx < tiles_x; tx++) {
+            int tw, th;
+            tile_extent(img->width, img->height, tile_size, tx, ty, &tw, &th);
+            size_t row_bytes = tw * pixel_bytes;
+            for (int y = 0; y < th; y++)
+                memcpy(raw + y * row_bytes,
+                       img->data + ((size_t)(ty * tile_size + y) * img->width + (size_t)tx * tile_size) * pixel_bytes,
+                       row_bytes);
+            size_t raw_bytes = row_bytes * th;
+            const uint8_t *out = raw;
+            size_t out_bytes = raw_bytes;
+#ifdef SM_HAVE_LZ4
+            if (compression == TILED_LZ4) {
+                int n = LZ4_compress_default((const char *)raw, (char *)packed, (int)raw_bytes, (int)packed_cap);
+                if (n > 0 && (size_t)n < raw_bytes) {
+                    out = packed;
+                    out_bytes = n;
+                }
+            }
+#endif
+            uint8_t *entry = index + ((size_t)ty * tiles_x + tx) * TILED_ENTRY_BYTES;
+            put_u64(entry, offset);
+            put_u32(entry + 8, (uint32_t)out_bytes);
+            ok = fwrite(out, 1, out_bytes, fp) == out_bytes;
+            offset += out_bytes;
+        }
+    }
+    ok = ok && fseek(fp, TILED_HEADER_BYTES, SEEK_SET) == 0 && fwrite(index, 1, index_bytes, fp) == index_bytes;
+    if (fclose(fp) != 0 || !ok) {
+        perror("Error writing file");
+        exit(EXIT_FAILURE);
+    }
+    free(index);
+    free(raw);
+    free(packed);
+}
+
+TiledImage *tiled_open(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t hdr[TILED_HEADER_BYTES];
+    if (read_full(fd, hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr, TILED_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not a tiled image\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    TiledImage *t = (TiledImage *)calloc(1, sizeof(TiledImage));
+    t->fd = fd;
+    t->width = (int)get_le(hdr + 8, 4);
+    t->height = (int)get_le(hdr + 12, 4);
+    t->maxval = (int)get_le(hdr + 16, 4);
+    t->tile_size = (int)get_le(hdr + 20, 4);
+    t->compression = (int)get_le(hdr + 24, 4);
+    if (t->width <= 0 || t->height <= 0 || t->maxval <= 0 || t->maxval > 65535 || t->tile_size <= 0 ||
+        (t->compression != TILED_NONE && t->compression != TILED_LZ4)) {
+        fprintf(stderr, "%s: bad tiled image header\n", filename);
+        exit(EXIT_FAILURE);
+    }
+#ifndef SM_HAVE_LZ4
+    if (t->compression == TILED_LZ4) {
+        fprintf(stderr, "%s: LZ4 tiles need a build with SM_HAVE_LZ4 (make LZ4=1)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+#endif
+    t->tiles_x = (t->width + t->tile_size - 1) / t->tile_size;
+    t->tiles_y = (t->height + t->tile_size - 1) / t->tile_size;
+
+    size_t ntiles = (size_t)t->tiles_x * t->tiles_y;
+    size_t index_bytes = ntiles * TILED_ENTRY_BYTES;
+    uint8_t *index = (uint8_t *)malloc(index_bytes);
+    t->offsets = (uint64_t *)malloc(ntiles * sizeof(uint64_t));
+    t->stored = (uint32_t *)malloc(ntiles * sizeof(uint32_t));
+    if (!index || !t->offsets || !t->stored) {
+        fprintf(stderr, "%s: out of memory reading the tile index\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(fd, index, index_bytes) != index_bytes) {
+        fprintf(stderr, "%s: truncated tile index\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    uint64_t file_bytes = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+
+    // Every tile must lie after the index and inside the file, and hold at
+    // most its raw size (exactly that when uncompressed), so read_tile
+    // never reads past its buffers
+    size_t pixel_bytes = t->maxval > 255 ? 2 : 1;
+    for (int ty = 0; ty < t->tiles_y; ty++) {
+        for (int tx = 0; tx < t->tiles_x; tx++) {
+            size_t i = (size_t)ty * t->tiles_x + tx;
+            t->offsets[i] = get_le(index + i * TILED_ENTRY_BYTES, 8);
+            t->stored[i] = (uint32_t)get_le(index + i * TILED_ENTRY_BYTES + 8, 4);
+            int tw, th;
+            tile_extent(t->width, t->height, t->tile_size, tx, ty, &tw, &th);
+            uint64_t raw_bytes = (uint64_t)tw * th * pixel_bytes;
+            uint64_t stored = t->stored[i];
+            int bad = stored == 0 || stored > raw_bytes ||
+                      (t->compression == TILED_NONE && stored != raw_bytes) ||
+                      (stored < raw_bytes && raw_bytes > INT_MAX) ||
+                      t->offsets[i] < TILED_HEADER_BYTES + index_bytes ||
+                      t->offsets[i] > file_bytes || stored > file_bytes - t->offsets[i];
+            if (bad) {
+                fprintf(stderr, "%s: bad index entry for tile (%d, %d)\n", filename, tx, ty);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    free(index);
+    return t;
+}
+
+void tiled_close(TiledImage *t) {
+    if (!t)
+        return;
+    close(t->fd);
+    free(t->offsets);
+    free(t->stored);
+    free(t);
+}
+
+// Read tile (tx, ty) into raw (tile_size^2 samples); packed is scratch for
+// compressed tiles
+static void read_tile(TiledImage *t, int tx, int ty, uint8_t *raw, uint8_t *packed) {
+    size_t i = (size_t)ty * t->tiles_x + tx;
+    int tw, th;
+    tile_extent(t->width, t->height, t->tile_size, tx, ty, &tw, &th);
+    size_t raw_bytes = (size_t)tw * th * (t->maxval > 255 ? 2 : 1);
+    int compressed = t->stored[i] != raw_bytes;
+    uint8_t *dst = compressed ? packed : raw;
+    ssize_t got = pread(t->fd, dst, t->stored[i], t->offsets[i]);
+    int ok = got == (ssize_t)t->stored[i];
+#ifdef SM_HAVE_LZ4
+    if (ok && compressed)
+        ok = LZ4_decompress_safe((const char *)packed, (char *)raw, (int)t->stored[i], (int)raw_bytes) == (int)raw_bytes;
+#else
+    ok = ok && !compressed;
+#endif
+    if (!ok) {
+        fprintf(stderr, "Corrupt or truncated tile (%d, %d)\n", tx, ty);
+        exit(EXIT_FAILURE);
+    }
+}
+
+Image *tiled_read_rect(TiledImage *t, int x, int y, int width, int height) {
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > t->width) width = t->width - x;
+    if (y + height > t->height) height = t->height - y;
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "Region lies outside the image\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t pixel_bytes = t->maxval > 255 ? 2 : 1;
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (!img) {
+        fprintf(stderr, "Out of memory reading tiles\n");
+        exit(EXIT_FAILURE);
+    }
+    img->width = width;
+    img->height = height;
+    img->maxval = t->maxval;
+    img->data = (uint8_t *)malloc((size_t)width * height * pixel_bytes);
+    img->map_base = NULL;
+    img->map_size = 0;
+
+    // No tile is larger than the image, whatever tile_size says
+    size_t raw_cap = (size_t)(t->tile_size < t->width ? t->tile_size : t->width) *
+                     (t->tile_size < t->height ? t->tile_size : t->height) * pixel_bytes;
+    uint8_t *raw = (uint8_t *)malloc(raw_cap);
+    uint8_t *packed = (uint8_t *)malloc(raw_cap);
+    if (!img->data || !raw || !packed) {
+        fprintf(stderr, "Out of memory reading tiles\n");
+        exit(EXIT_FAILURE);
+    }
+    int ts = t->tile_size;
+    for (int ty = y / ts; ty <= (y + height - 1) / ts; ty++) {
+        for (int tx = x / ts; tx <= (x + width - 1) / ts; tx++) {
+            int tw, th;
+            tile_extent(t->width, t->height, ts, tx, ty, &tw, &th);
+            read_tile(t, tx, ty, raw, packed);
+            // Overlap of the tile and the rectangle, in image coordinates
+            int x0 = tx * ts > x ? tx * ts : x;
+            int y0 = ty * ts > y ? ty * ts : y;
+            int x1 = tx * ts + tw < x + width ? tx * ts + tw : x + width;
+            int y1 = ty * ts + th < y + height ? ty * ts + th : y + height;
+            for (int yy = y0; yy < y1; yy++)
+                memcpy(img->data + ((size_t)(yy - y) * width + (x0 - x)) * pixel_bytes,
+                       raw + ((size_t)(yy - ty * ts) * tw + (x0 - tx * ts)) * pixel_bytes,
+                       (size_t)(x1 - x0) * pixel_bytes);
+        }
+    }
+    free(raw);
+    free(packed);
+    return img;
+}
+
+void tiled_window(const TiledImage *t, int halo_tiles, int *x, int *y, int *width, int *height) {
+    int ts = t->tile_size;
+    int tx0 = *x / ts - halo_tiles, ty0 = *y / ts - halo_tiles;
+    int tx1 = (*x + *width - 1) / ts + halo_tiles, ty1 = (*y + *height - 1) / ts + halo_tiles;
+    if (tx0 < 0) tx0 = 0;
+    if (ty0 < 0) ty0 = 0;
+    if (tx1 >= t->tiles_x) tx1 = t->tiles_x - 1;
+    if (ty1 >= t->tiles_y) ty1 = t->tiles_y - 1;
+    *x = tx0 * ts;
+    *y = ty0 * ts;
+    *width = (tx1 + 1) * ts < t->width ? (tx1 + 1) * ts - *x : t->width - *x;
+    *height = (ty1 + 1) * ts < t->height ? (ty1 + 1) * ts - *y : t->height - *y;
+}
@@ -1,7 +1,9 @@
 #ifndef IMAGE_IO_H
 #define IMAGE_IO_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,13 +12,167 @@ extern "C" {
 typedef struct {
     int width;
     int height;
+    int maxval;         // <= 255: one byte per pixel; otherwise uint16_t pixels in host order
     uint8_t *data;
+    void *map_base;     // file mapping data points into, or NULL if data is malloc'd
+    size_t map_size;
 } Image;
 
+// Bytes per pixel of img->data (1 or 2)
+#define IMAGE_PIXEL_BYTES(img) ((img)->maxval > 255 ? 2 : 1)
+
+// read_pgm maps regular files and points data straight into the mapping
+// (private, so writing to data never touches the file); other inputs are
+// read into memory. 16-bit files are byte-swapped to host order and P6
+// colour files converted to luminance, each into their own buffer. Exits on
+// malformed input.
 Image* read_pgm(const char *filename);
+// Non-exiting variant for callers that recycle buffers: reads filename into
+// img->data, a buffer_pool buffer of *capacity bytes (NULL/0 to start) that
+// is replaced only when the image needs more; release it with pool_free.
+// Prints the reason and returns -1 on failure.
+int read_pgm_into(const char *filename, Image *img, size_t *capacity);
+// Exits if the file cannot be written
 void write_pgm(const char *filename, const Image *img);
+// Non-exiting variant: prints the reason and returns -1 on failure
+int write_pgm_file(const char *filename, const Image *img);
 void free_image(Image *img);
 
+// Row-at-a-time reader for inputs too large to hold, or arriving on a pipe.
+// pgm_stream_open parses a P5/P6 header from fp; pgm_stream_open_raw takes
+// headerless rows of the given width until EOF. Rows come out as read_pgm
+// would store them (host-order uint16 when maxval > 255, luminance for P6).
+typedef struct {
+    FILE *fp;
+    int width;
+    int height;         // 0 when unknown (raw input): read until EOF
+    int maxval;
+    int colour;
+    int rows_read;
+    uint8_t *raw;       // one row as stored in the file
+    size_t raw_bytes;
+} PgmStream;
+
+PgmStream *pgm_stream_open(FILE *fp);
+PgmStream *pgm_stream_open_raw(FILE *fp, int width, int maxval);
+// Returns 1 with the next row in row (width pixels), 0 at end of input
+int pgm_stream_read_row(PgmStream *s, void *row);
+// Frees the stream; fp stays open
+void pgm_stream_close(PgmStream *s);
+
+// Full-precision label map: a .npy file holding a height x width array of
+// little-endian uint16, uint32 or uint64 labels. create_label_map sizes the
+// file with ftruncate and maps it, so an engine can write its labels
+// straight into the file; close_label_map unmaps and closes it.
+typedef struct {
+    void *labels;       // width * height labels, 64-byte aligned
+    size_t label_bytes;
+    void *map_base;
+    size_t map_size;
+} LabelMap;
+
+void *create_label_map(const char *filename, int width, int height, int label_bytes, LabelMap *map);
+// Map an existing label map read-only; returns the labels and sets the shape
+const void *open_label_map(const char *filename, int *width, int *height, LabelMap *map);
+void close_label_map(LabelMap *map);
+// Convenience wrapper: create, copy labels in, close
+void write_label_map(const char *filename, const void *labels, int width, int height, int label_bytes);
+
+// Run-length encoded label map. File layout (little-endian): the 8-byte
+// magic "SMRLE01\n", uint32 width, height, label_bytes, reserved, uint64 run
+// count, then one (uint32 row, uint32 start, uint32 length, label) record
+// per run in raster order, the label taking label_bytes (2, 4 or 8) bytes.
+typedef struct {
+    uint32_t row;
+    uint32_t start;
+    uint32_t length;
+    uint64_t label;
+} LabelRun;
+
+typedef struct {
+    FILE *fp;
+    int width;
+    int height;
+    int label_bytes;
+    uint64_t runs;
+    uint8_t *buf;       // records are batched into large writes
+    size_t used;
+} RleWriter;
+
+RleWriter *rle_open(const char *filename, int width, int height, int label_bytes);
+void rle_write_run(RleWriter *w, const LabelRun *run);
+// Encode one row of labels; the signature matches sm_params.row_sink so a
+// writer can be fed straight from the final labeling pass
+void rle_write_row(void *writer, int row, const void *labels, int label_bytes, int width);
+// Flush, record the run count and close
+void rle_close(RleWriter *w);
+
+// Append the runs of one row to runs (room for width entries); returns the count
+size_t rle_encode_row(const void *labels, int label_bytes, int width, int row, LabelRun *runs);
+// Read all runs of an RLE file, checking that they tile every row in order
+// (exits on a malformed file); free() the result
+LabelRun *read_rle(const char *filename, int *width, int *height, int *label_bytes, size_t *count);
+// Expand runs into a width-wide label array of label_bytes labels; runs must
+// lie inside the array, as read_rle guarantees
+void rle_decode(const LabelRun *runs, size_t count, void *labels, int label_bytes, int width);
+
+// Streaming RLE reader: decodes one row at a time through a fixed buffer,
+// so files larger than memory can be read in order
+typedef struct {
+    FILE *fp;
+    int width;
+    int height;
+    int label_bytes;
+    uint64_t remaining; // runs not yet decoded
+    uint8_t *buf;
+    size_t used;
+    size_t pos;
+    const char *filename;
+} RleReader;
+
+RleReader *rle_reader_open(const char *filename);
+// Decode row into labels (width labels of label_bytes); rows must be read
+// in order
+void rle_read_row(RleReader *r, int row, void *labels);
+void rle_reader_close(RleReader *r);
+
+// Tiled image container for random access into very large rasters. File
+// layout (little-endian): the 8-byte magic "SMTILE1\n", uint32 width,
+// height, maxval, tile_size, compression (0 none, 1 LZ4), reserved; then a
+// tile index of tiles_x * tiles_y (uint64 offset, uint32 stored bytes,
+// uint32 reserved) entries in row-major tile order; then the tiles. A tile
+// holds its rows of (clipped) width, one or two bytes per sample; an LZ4
+// tile whose stored size equals its raw size was kept uncompressed. LZ4
+// needs a build with SM_HAVE_LZ4 (make LZ4=1).
+#define TILED_NONE 0
+#define TILED_LZ4  1
+
+typedef struct {
+    int fd;
+    int width;
+    int height;
+    int maxval;
+    int tile_size;
+    int tiles_x;
+    int tiles_y;
+    int compression;
+    uint64_t *offsets;  // per tile, row-major
+    uint32_t *stored;   // bytes on disk per tile
+} TiledImage;
+
+// Exits on write errors, or when compression is unavailable in this build
+void write_tiled(const char *filename, const Image *img, int tile_size, int compression);
+// Exits on malformed input
+TiledImage *tiled_open(const char *filename);
+void tiled_close(TiledImage *t);
+// Load the rectangle (clipped to the image) reading only the tiles it
+// overlaps; free the result with free_image
+Image *tiled_read_rect(TiledImage *t, int x, int y, int width, int height);
+// Widen a rectangle to whole tiles plus halo_tiles tiles on every side,
+// clipped to the image, so a region of interest can be segmented with
+// context from its neighbours
+void tiled_window(const TiledImage *t, int halo_tiles, int *x, int *y, int *width, int *height);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include "metrics.h"
+#include "trace.h"
+
+static const char *phase_names[SM_PHASE_COUNT] = {
+    "read", "localize", "scatter", "mask", "init", "merge", "link",
+    "flatten", "halo", "regions", "update", "gather", "render", "write"
+};
+
+static const char *counter_names[SM_COUNTER_COUNT] = {
+    "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+// Per-thread perf event group: cycles leads, the rest follow where the
+// kernel accepts them. slot[c] is counter c's position in a group read.
+typedef struct {
+    int opened;
+    int fds[SM_COUNTER_COUNT];
+    int slot[SM_COUNTER_COUNT];
+    int nr;
+    unsigned mask;
+} counter_group;
+
+static __thread counter_group thread_group;
+static pthread_key_t group_key;
+static pthread_once_t group_key_once = PTHREAD_ONCE_INIT;
+
+static void close_group(void *arg) {
+    counter_group *g = (counter_group *)arg;
+    for (int c = 0; c < SM_COUNTER_COUNT; c++)
+        if (g->fds[c] >= 0)
+            close(g->fds[c]);
+    g->mask = 0;
+    g->nr = 0;
+}
+
+static void make_group_key(void) {
+    pthread_key_create(&group_key, close_group);
+}
+
+static void counter_attr(sm_counter c, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (c) {
+    case SM_COUNTER_CYCLES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case SM_COUNTER_INSTRUCTIONS:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case SM_COUNTER_LLC_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case SM_COUNTER_DTLB_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    default:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+}
+
+static counter_group *open_group(void) {
+    counter_group *g = &thread_group;
+    if (g->opened)
+        return g;
+    g->opened = 1;
+    for (int c = 0; c < SM_COUNTER_COUNT; c++)
+        g->fds[c] = -1;
+
+    int leader = -1;
+    for (int c = 0; c < SM_COUNTER_COUNT; c++) {
+        struct perf_event_attr attr;
+        counter_attr((sm_counter)c, &attr);
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd < 0) {
+            // Without cycles there is no group to join
+            if (c == SM_COUNTER_CYCLES)
+                return g;
+            continue;
+        }
+        if (leader < 0)
+            leader = fd;
+        g->fds[c] = fd;
+        g->slot[c] = g->nr++;
+        g->mask |= 1u << c;
+    }
+    pthread_once(&group_key_once, make_group_key);
+    pthread_setspecific(group_key, g);
+    return g;
+}
+
+// Current values of the thread's counters, scaled up when the kernel had to
+// multiplex the group
+static void read_counters(uint64_t *out) {
+    counter_group *g = open_group();
+    uint64_t buf[3 + SM_COUNTER_COUNT];
+    memset(out, 0, SM_COUNTER_COUNT * sizeof(uint64_t));
+    if (!g->mask || read(g->fds[SM_COUNTER_CYCLES], buf, sizeof(buf)) < (ssize_t)((3 + g->nr) * sizeof(uint64_t)))
+        return;
+    uint64_t enabled = buf[1], running = buf[2];
+    for (int c = 0; c < SM_COUNTER_COUNT; c++) {
+        if (!(g->mask & (1u << c)))
+            continue;
+        uint64_t v = buf[3 + g->slot[c]];
+        out[c] = running && running < enabled ? (uint64_t)((double)v * enabled / running) : v;
+    }
+}
+
+int sm_metrics_init(sm_metrics *m, int max_threads) {
+    memset(m, 0, sizeof(*m));
+    if (max_threads > 0) {
+        m->threads = (sm_phase_times *)calloc(max_threads, sizeof(sm_phase_times));
+        if (!m->threads)
+            return -1;
+        m->max_threads = max_threads;
+    }
+    return 0;
+}
+
+void sm_metrics_free(sm_metrics *m) {
+    free(m->threads);
+    memset(m, 0, sizeof(*m));
+}
+
+unsigned sm_metrics_enable_counters(sm_metrics *m) {
+    m->counter_mask = open_group()->mask;
+    return m->counter_mask;
+}
+
+double sm_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+sm_mark sm_metrics_mark(const sm_metrics *m) {
+    sm_mark mark;
+    if (m->counter_mask)
+        read_counters(mark.counters);
+    mark.seconds = sm_metrics_now();
+    return mark;
+}
+
+static void add_since(const sm_metrics *m, sm_phase_times *t, sm_phase phase, const sm_mark *start) {
+    double now = sm_metrics_now();
+    if (m->counter_mask) {
+        uint64_t counters[SM_COUNTER_COUNT];
+        read_counters(counters);
+        for (int c = 0; c < SM_COUNTER_COUNT; c++)
+            if (counters[c] > start->counters[c])
+                t->counters[phase][c] += counters[c] - start->counters[c];
+    }
+    t->seconds[phase] += now - start->seconds;
+    t->calls[phase]++;
+    if (sm_tracing)
+        sm_trace_event(phase_names[phase], start->seconds, now);
+}
+
+void sm_metrics_stop(sm_metrics *m, sm_phase phase, sm_mark start) {
+    if (!m)
+        return;
+    add_since(m, &m->phases, phase, &start);
+}
+
+void sm_metrics_stop_thread(sm_metrics *m, int thread, sm_phase phase, sm_mark start) {
+    if (!m || thread < 0 || thread >= m->max_threads)
+        return;
+    add_since(m, &m->threads[thread], phase, &start);
+}
+
+void sm_phase_times_add(sm_phase_times *dst, const sm_phase_times *src) {
+    for (int p = 0; p < SM_PHASE_COUNT; p++) {
+        dst->seconds[p] += src->seconds[p];
+        dst->calls[p] += src->calls[p];
+        for (int c = 0; c < SM_COUNTER_COUNT; c++)
+            dst->counters[p][c] += src->counters[p][c];
+    }
+}
+
+const char *sm_phase_name(sm_phase phase) {
+    return phase >= 0 && phase < SM_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+const char *sm_counter_name(sm_counter counter) {
+    return counter >= 0 && counter < SM_COUNTER_COUNT ? counter_names[counter] : "unknown";
+}
+
+void sm_phase_times_json(FILE *fp, const sm_phase_times *t, unsigned counter_mask) {
+    const char *sep = "";
+    fputc('{', fp);
+    for (int p = 0; p < SM_PHASE_COUNT; p++) {
+        if (!t->calls[p])
+            continue;
+        fprintf(fp, "%s\"%s\": {\"seconds\": %.9f, \"calls\": %llu", sep, phase_names[p],
+                t->seconds[p], (unsigned long long)t->calls[p]);
+        for (int c = 0; c < SM_COUNTER_COUNT; c++)
+            if (counter_mask & (1u << c))
+                fprintf(fp, ", \"%s\": %llu", counter_names[c], (unsigned long long)t->counters[p][c]);
+        fputc('}', fp);
+        sep = ", ";
+    }
+    fputc('}', fp);
+}
+
+FILE *sm_sweep_csv_open(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp)
+        fprintf(fp, "sweep,writes,rows_changed,max_delta,seconds\n");
+    return fp;
+}
+
+void sm_sweep_csv_write(void *fp, int sweep, const sm_sweep_stats *stats) {
+    fprintf((FILE *)fp, "%d,%llu,%llu,%llu,%.9f\n", sweep, (unsigned long long)stats->writes,
+            (unsigned long long)stats->rows_changed, (unsigned long long)stats->max_delta, stats->seconds);
+}
@@ -0,0 +1,126 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-phase timings on the monotonic clock, plus optional hardware
+// counters; while tracing (trace.h) every phase is also a timeline event. Every recording call takes a sm_metrics pointer and does
+// nothing but one branch when it is NULL, so the calls stay in the hot
+// paths with metrics off.
+
+typedef enum {
+    SM_PHASE_READ = 0,      // read_pgm / tile reads
+    SM_PHASE_LOCALIZE,      // first-touch copy of the input (OpenMP driver)
+    SM_PHASE_SCATTER,       // MPI scatter and pixel halo exchange
+    SM_PHASE_MASK,          // edge mask
+    SM_PHASE_INIT,          // label initialisation
+    SM_PHASE_MERGE,         // label sweeps or MPI merge passes; calls = sweeps
+    SM_PHASE_LINK,          // union-find linking
+    SM_PHASE_FLATTEN,       // union-find flatten, including the row sink
+    SM_PHASE_HALO,          // MPI label halo exchange
+    SM_PHASE_REGIONS,       // region count and statistics
+    SM_PHASE_UPDATE,        // sm_update, up to any fallback to a full pass
+    SM_PHASE_GATHER,        // MPI gathers of output, labels and runs
+    SM_PHASE_RENDER,        // labels to output pixels
+    SM_PHASE_WRITE,         // write_pgm and the optional label outputs
+    SM_PHASE_COUNT
+} sm_phase;
+
+// Hardware counters read through perf_event_open, user space only. Each
+// thread counts its own work; events the CPU, kernel or
+// perf_event_paranoid setting refuse are left out.
+typedef enum {
+    SM_COUNTER_CYCLES = 0,
+    SM_COUNTER_INSTRUCTIONS,
+    SM_COUNTER_LLC_MISSES,      // last-level cache read misses
+    SM_COUNTER_DTLB_MISSES,     // data TLB read misses
+    SM_COUNTER_BRANCH_MISSES,   // mispredicted branches
+    SM_COUNTER_COUNT
+} sm_counter;
+
+typedef struct {
+    double seconds[SM_PHASE_COUNT];
+    uint64_t calls[SM_PHASE_COUNT];
+    uint64_t counters[SM_PHASE_COUNT][SM_COUNTER_COUNT];
+} sm_phase_times;
+
+typedef struct {
+    sm_phase_times phases;      // wall time (and counters) of each phase on the
+                                // calling thread
+    int max_threads;
+    sm_phase_times *threads;    // max_threads entries: each OpenMP thread's busy
+                                // time inside the parallel phases, without the
+                                // wait at the closing barrier
+    unsigned counter_mask;      // bit per sm_counter being read; 0 = counters off
+} sm_metrics;
+
+// Start of a timed phase: the clock and, with counters on, the calling
+// thread's counter values
+typedef struct {
+    double seconds;
+    uint64_t counters[SM_COUNTER_COUNT];
+} sm_mark;
+
+// Convergence telemetry for one merge sweep of the iterative engines
+typedef struct {
+    uint64_t writes;        // labels lowered
+    uint64_t rows_changed;  // rows with at least one write
+    uint64_t max_delta;     // largest drop of a single label
+    double seconds;
+} sm_sweep_stats;
+
+// sweep counts from 1
+typedef void (*sm_sweep_callback)(void *ctx, int sweep, const sm_sweep_stats *stats);
+
+// max_threads is normally omp_get_max_threads(); 0 skips the per-thread
+// table. Returns 0, or -1 if it cannot be allocated.
+int sm_metrics_init(sm_metrics *m, int max_threads);
+void sm_metrics_free(sm_metrics *m);
+
+// Open the hardware counters on the calling thread (other threads open
+// theirs the first time they record) and include them from now on.
+// Returns the mask of available counters; 0 means none could be opened
+// (no PMU, or perf_event_paranoid too strict) and m records time only.
+unsigned sm_metrics_enable_counters(sm_metrics *m);
+
+double sm_metrics_now(void);
+
+sm_mark sm_metrics_mark(const sm_metrics *m);
+
+static inline sm_mark sm_metrics_start(const sm_metrics *m) {
+    if (m)
+        return sm_metrics_mark(m);
+    sm_mark none = {0};
+    return none;
+}
+
+// Add the time (and counter deltas) since start to phase, as one call
+void sm_metrics_stop(sm_metrics *m, sm_phase phase, sm_mark start);
+// Same for one thread's share of a parallel phase; threads past
+// max_threads are not recorded
+void sm_metrics_stop_thread(sm_metrics *m, int thread, sm_phase phase, sm_mark start);
+// Sum src into dst
+void sm_phase_times_add(sm_phase_times *dst, const sm_phase_times *src);
+
+const char *sm_phase_name(sm_phase phase);
+const char *sm_counter_name(sm_counter counter);
+// {"read": {"seconds": S, "calls": N, <counter>: V...}, ...} over the
+// phases that ran, with the counters in counter_mask
+void sm_phase_times_json(FILE *fp, const sm_phase_times *t, unsigned counter_mask);
+
+// Sweep telemetry as a CSV time series: sm_sweep_csv_open creates path and
+// writes the header (NULL on failure); sm_sweep_csv_write is a
+// sm_sweep_callback taking the FILE * as ctx
+FILE *sm_sweep_csv_open(const char *path);
+void sm_sweep_csv_write(void *fp, int sweep, const sm_sweep_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef SEGMENT_HPP
+#define SEGMENT_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "edge_mask.h"
+#include "metrics.h"
+
+// Header-only split/merge labeling engine shared by the serial and OpenMP
+// backends. Everything that would otherwise be an option (pixel and label
+// width, connectivity, similarity test, parallel or not) is a template
+// parameter, so each instantiation compiles to its own branch-free loop.
+//
+// Every parallel loop splits rows with the same static schedule, so a thread
+// always works on the rows it first touched in init_labels and
+// build_edge_mask; on NUMA systems those pages sit on the thread's node.
+//
+// Linear indices are size_t throughout, so images past 2^31 pixels work; the
+// Label type only has to hold width * height - 1 (uint16_t up to 2^16
+// pixels, uint32_t up to 2^32, uint64_t beyond).
+//
+// The parallel loops take an optional sm_metrics and record each thread's
+// share of the loop in it; with NULL that costs one branch per thread.
+
+// Default similarity test: neighbours merge when |a - b| < threshold
+template <class Pixel>
+struct AbsDiffLess {
+    int threshold;
+
+    explicit AbsDiffLess(int t) : threshold(t) {}
+
+    inline bool operator()(Pixel a, Pixel b) const {
+        int d = (int)a - (int)b;
+        return (d < 0 ? -d : d) < threshold;
+    }
+};
+
+// Free the scratch sm_update keeps in an sm_result (update_segment.cpp)
+void update_state_free(struct sm_update_state *state);
+
+static inline void thread_done(sm_metrics *metrics, sm_phase phase, sm_mark start) {
+    if (!metrics)
+        return;
+#ifdef _OPENMP
+    sm_metrics_stop_thread(metrics, omp_get_thread_num(), phase, start);
+#else
+    sm_metrics_stop_thread(metrics, 0, phase, start);
+#endif
+}
+
+template <class Pixel, class Label, int Connectivity, class Predicate, bool Parallel = false>
+struct Segmenter {
+    static_assert(Connectivity == 4 || Connectivity == 8, "connectivity must be 4 or 8");
+
+    // Each pixel starts in its own region, labelled by its linear index
+    static void init_labels(Label *labels, int width, int height, sm_metrics *metrics = NULL) {
+        #pragma omp parallel if(Parallel)
+        {
+            sm_mark start = sm_metrics_start(metrics);
+            #pragma omp for schedule(static) nowait
+            for (int y = 0; y < height; y++)
+                for (int x = 0; x < width; x++)
+                    labels[(size_t)y * width + x] = (Label)((size_t)y * width + x);
+            thread_done(metrics, SM_PHASE_INIT, start);
+        }
+    }
+
+    // Evaluate the similarity test once per forward edge. Each neighbour
+    // direction is its own straight loop so the compiler can vectorise it.
+    static void build_edge_mask(const Pixel *img, uint8_t *mask, int width, int height, const Predicate &similar,
+                                sm_metrics *metrics = NULL) {
+        #pragma omp parallel if(Parallel)
+        {
+            sm_mark start = sm_metrics_start(metrics);
+            #pragma omp for schedule(static) nowait
+            for (int y = 0; y < height; y++) {
+                const Pixel *row = img + (size_t)y * width;
+                uint8_t *m = mask + (size_t)y * width;
+
+                for (int x = 0; x < width; x++)
+                    m[x] = 0;
+                for (int x = 0; x + 1 < width; x++)
+                    m[x] |= similar(row[x], row[x + 1]) ? EDGE_RIGHT : 0;
+
+                if (y + 1 < height) {
+                    const Pixel *next = row + width;
+                    for (int x = 0; x < width; x++)
+                        m[x] |= similar(row[x], next[x]) ? EDGE_DOWN : 0;
+                    if (Connectivity == 8) {
+                        for (int x = 0; x + 1 < width; x++)
+                            m[x] |= similar(row[x], next[x + 1]) ? EDGE_DOWN_RIGHT : 0;
+                        for (int x = 1; x < width; x++)
+                            m[x] |= similar(row[x], next[x - 1]) ? EDGE_DOWN_LEFT : 0;
+                    }
+                }
+            }
+            thread_done(metrics, SM_PHASE_MASK, start);
+        }
+    }
+
+    // One sweep: pull both ends of every similar edge to their smaller label.
+    // Returns nonzero if any label changed. With telemetry, also counts the
+    // sweep's label writes, changed rows and largest label drop into it;
+    // that is a separate instantiation, so plain sweeps pay nothing for it.
+    static int merge_labels(const uint8_t *mask, Label *labels, int width, int height, sm_metrics *metrics = NULL,
+                            sm_sweep_stats *telemetry = NULL) {
+        return telemetry ? sweep<true>(mask, labels, width, height, metrics, telemetry)
+                         : sweep<false>(mask, labels, width, height, metrics, NULL);
+    }
+
+    // Iterate sweeps until nothing changes; mask is width * height bytes of
+    // scratch. Returns the number of sweeps. on_sweep, if given, receives
+    // each sweep's telemetry as soon as the sweep ends.
+    static int segment(const Pixel *img, uint8_t *mask, Label *labels, int width, int height,
+                       const Predicate &similar, sm_metrics *metrics = NULL,
+                       sm_sweep_callback on_sweep = NULL, void *on_sweep_ctx = NULL) {
+        sm_mark start = sm_metrics_start(metrics);
+        build_edge_mask(img, mask, width, height, similar, metrics);
+        sm_metrics_stop(metrics, SM_PHASE_MASK, start);
+        start = sm_metrics_start(metrics);
+        init_labels(labels, width, height, metrics);
+        sm_metrics_stop(metrics, SM_PHASE_INIT, start);
+        int sweeps = 0, changed;
+        sm_sweep_stats stats;
+        do {
+            start = sm_metrics_start(metrics);
+            double sweep_start = on_sweep ? sm_metrics_now() : 0.0;
+            changed = merge_labels(mask, labels, width, height, metrics, on_sweep ? &stats : NULL);
+            sm_metrics_stop(metrics, SM_PHASE_MERGE, start);
+            sweeps++;
+            if (on_sweep) {
+                stats.seconds = sm_metrics_now() - sweep_start;
+                on_sweep(on_sweep_ctx, sweeps, &stats);
+            }
+        } while (changed);
+        return sweeps;
+    }
+
+    // Union-find alternative to the sweeps: one pass over the edge mask
+    // linking each edge, then one flatten pass. Roots are always the
+    // smaller index, so the result equals the converged sweep labeling.
+    static void union_find(const uint8_t *mask, Label *labels, int width, int height, sm_metrics *metrics = NULL) {
+        link_edges(mask, labels, width, height, metrics);
+        sm_mark start = sm_metrics_start(metrics);
+        flatten(labels, 0, (size_t)width * height);
+        sm_metrics_stop(metrics, SM_PHASE_FLATTEN, start);
+    }
+
+    // First half of union_find: leaves labels as a parent forest
+    static void link_edges(const uint8_t *mask, Label *labels, int width, int height, sm_metrics *metrics = NULL) {
+        sm_mark start = sm_metrics_start(metrics);
+        init_labels(labels, width, height, metrics);
+        sm_metrics_stop(metrics, SM_PHASE_INIT, start);
+        start = sm_metrics_start(metrics);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t idx = (size_t)y * width + x;
+                uint8_t m = mask[idx];
+
+                if (m & EDGE_RIGHT)
+                    unite(labels, idx, idx + 1);
+                if (m & EDGE_DOWN)
+                    unite(labels, idx, idx + width);
+                if (Connectivity == 8) {
+                    if (m & EDGE_DOWN_RIGHT)
+                        unite(labels, idx, idx + width + 1);
+                    if (m & EDGE_DOWN_LEFT)
+                        unite(labels, idx, idx + width - 1);
+                }
+            }
+        }
+        sm_metrics_stop(metrics, SM_PHASE_LINK, start);
+    }
+
+    // Parents always precede their children, so one forward pass resolves
+    // every pixel to its root. [begin, end) may be flattened piecewise as
+    // long as the pieces are visited in order.
+    static void flatten(Label *labels, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            labels[i] = labels[labels[i]];
+    }
+
+    static inline Label find_root(Label *labels, Label i) {
+        while (labels[i] != i) {
+            labels[i] = labels[labels[i]];
+            i = labels[i];
+        }
+        return i;
+    }
+
+    static inline void unite(Label *labels, Label a, Label b) {
+        Label ra = find_root(labels, a), rb = find_root(labels, b);
+        if (ra < rb)
+            labels[rb] = ra;
+        else if (rb < ra)
+            labels[ra] = rb;
+    }
+
+private:
+    template <bool Telemetry>
+    static int sweep(const uint8_t *mask, Label *labels, int width, int height, sm_metrics *metrics,
+                     sm_sweep_stats *telemetry) {
+        int changed = 0;
+        uint64_t writes = 0, rows_changed = 0, max_delta = 0;
+        #pragma omp parallel reduction(|:changed) reduction(+:writes, rows_changed) reduction(max:max_delta) if(Parallel)
+        {
+            sm_mark start = sm_metrics_start(metrics);
+            #pragma omp for schedule(static) nowait
+            for (int y = 0; y < height; y++) {
+                uint64_t row_writes = 0;
+                for (int x = 0; x < width; x++) {
+                    size_t idx = (size_t)y * width + x;
+                    uint8_t m = mask[idx];
+
+                    if (m & EDGE_RIGHT)
+                        changed |= join<Telemetry>(labels, idx, idx + 1, row_writes, max_delta);
+                    if (m & EDGE_DOWN)
+                        changed |= join<Telemetry>(labels, idx, idx + width, row_writes, max_delta);
+                    if (Connectivity == 8) {
+                        if (m & EDGE_DOWN_RIGHT)
+                            changed |= join<Telemetry>(labels, idx, idx + width + 1, row_writes, max_delta);
+                        if (m & EDGE_DOWN_LEFT)
+                            changed |= join<Telemetry>(labels, idx, idx + width - 1, row_writes, max_delta);
+                    }
+                }
+                if (Telemetry) {
+                    writes += row_writes;
+                    rows_changed += row_writes != 0;
+                }
+            }
+            thread_done(metrics, SM_PHASE_MERGE, start);
+        }
+        if (Telemetry) {
+            telemetry->writes = writes;
+            telemetry->rows_changed = rows_changed;
+            telemetry->max_delta = max_delta;
+        }
+        return changed;
+    }
+
+    // A changed edge rewrites exactly one label: the larger end drops to the
+    // smaller one
+    template <bool Telemetry>
+    static inline int join(Label *labels, size_t a, size_t b, uint64_t &writes, uint64_t &max_delta) {
+        Label la = labels[a], lb = labels[b];
+        if (la == lb)
+            return 0;
+        Label min_label = la < lb ? la : lb;
+        labels[a] = min_label;
+        labels[b] = min_label;
+        if (Telemetry) {
+            uint64_t delta = (uint64_t)(la < lb ? lb - la : la - lb);
+            writes++;
+            if (delta > max_delta)
+                max_delta = delta;
+        }
+        return 1;
+    }
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "splitmerge.h"
+#include "buffer_pool.h"
+#include "segment.hpp"
+
+static const char *engine_names[SM_ENGINE_COUNT] = { "serial", "openmp", "union-find" };
+
+template <class Pixel, class Label, int Connectivity, bool Parallel>
+static int run_engine(const Image *img, const sm_params *params, Label *labels) {
+    typedef Segmenter<Pixel, Label, Connectivity, AbsDiffLess<Pixel>, Parallel> Engine;
+    const Pixel *pixels = (const Pixel *)img->data;
+    int width = img->width, height = img->height;
+
+    size_t mask_bytes = (size_t)width * height;
+    uint8_t *mask = (uint8_t *)pool_alloc(mask_bytes);
+    if (!mask)
+        return SM_ERR_NOMEM;
+    AbsDiffLess<Pixel> similar(params->threshold);
+    sm_metrics *metrics = params->metrics;
+
+    int sweeps = 1;
+    if (params->engine == SM_ENGINE_UNION_FIND) {
+        sm_mark start = sm_metrics_start(metrics);
+        Engine::build_edge_mask(pixels, mask, width, height, similar, metrics);
+        sm_metrics_stop(metrics, SM_PHASE_MASK, start);
+        Engine::link_edges(mask, labels, width, height, metrics);
+        // Flatten row by row so each finished row goes to the sink while
+        // it is still in cache
+        start = sm_metrics_start(metrics);
+        for (int y = 0; y < height; y++) {
+            size_t row = (size_t)y * width;
+            Engine::flatten(labels, row, row + width);
+            if (params->row_sink)
+                params->row_sink(params->row_sink_ctx, y, labels + row, sizeof(Label), width);
+        }
+        sm_metrics_stop(metrics, SM_PHASE_FLATTEN, start);
+    } else {
+        sweeps = Engine::segment(pixels, mask, labels, width, height, similar, metrics,
+                                 params->sweep_sink, params->sweep_sink_ctx);
+        if (params->row_sink) {
+            sm_mark start = sm_metrics_start(metrics);
+            for (int y = 0; y < height; y++)
+                params->row_sink(params->row_sink_ctx, y, labels + (size_t)y * width, sizeof(Label), width);
+            sm_metrics_stop(metrics, SM_PHASE_WRITE, start);
+        }
+    }
+    pool_free(mask, mask_bytes);
+    return sweeps;
+}
+
+// Regions are rooted at their first pixel in raster order, so a single pass
+// can assign each root its slot before any other pixel refers to it
+template <class Pixel, class Label>
+static int collect_regions(const Image *img, const Label *labels, sm_region *regions) {
+    const Pixel *pixels = (const Pixel *)img->data;
+    int width = img->width, height = img->height;
+    size_t slot_bytes = (size_t)width * height * sizeof(Label);
+    Label *slot = (Label *)pool_alloc(slot_bytes);
+    if (!slot)
+        return SM_ERR_NOMEM;
+
+    Label count = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t i = (size_t)y * width + x;
+            if (labels[i] == i) {
+                sm_region *r = &regions[count];
+                r->label = i;
+                r->pixel_count = 0;
+                r->intensity_sum = 0;
+                r->min_x = r->max_x = x;
+                r->min_y = r->max_y = y;
+                slot[i] = count++;
+            }
+            sm_region *r = &regions[slot[labels[i]]];
+            r->pixel_count++;
+            r->intensity_sum += pixels[i];
+            if ((uint64_t)x < r->min_x) r->min_x = x;
+            if ((uint64_t)x > r->max_x) r->max_x = x;
+            r->max_y = y;
+        }
+    }
+    pool_free(slot, slot_bytes);
+    return SM_OK;
+}
+
+template <class Pixel, class Label>
+static int dispatch(const Image *img, const sm_params *params, Label *labels) {
+    bool parallel = params->engine == SM_ENGINE_OPENMP;
+    if (params->connectivity == 8)
+        return parallel ? run_engine<Pixel, Label, 8, true>(img, params, labels)
+                        : run_engine<Pixel, Label, 8, false>(img, params, labels);
+    return parallel ? run_engine<Pixel, Label, 4, true>(img, params, labels)
+                    : run_engine<Pixel, Label, 4, false>(img, params, labels);
+}
+
+template <class Pixel, int Connectivity>
+static void build_mask(const Image *img, uint8_t *mask, int threshold) {
+    Segmenter<Pixel, uint32_t, Connectivity, AbsDiffLess<Pixel>, false>::build_edge_mask(
+        (const Pixel *)img->data, mask, img->width, img->height, AbsDiffLess<Pixel>(threshold));
+}
+
+int sm_build_edge_mask(const Image *img, uint8_t *mask, const sm_params *params) {
+    if (!img || !img->data || !mask || !params || (params->connectivity != 4 && params->connectivity != 8))
+        return SM_ERR_ARGS;
+    bool wide = IMAGE_PIXEL_BYTES(img) == 2;
+    if (params->connectivity == 8) {
+        if (wide) build_mask<uint16_t, 8>(img, mask, params->threshold);
+        else      build_mask<uint8_t, 8>(img, mask, params->threshold);
+    } else {
+        if (wide) build_mask<uint16_t, 4>(img, mask, params->threshold);
+        else      build_mask<uint8_t, 4>(img, mask, params->threshold);
+    }
+    return SM_OK;
+}
+
+void sm_default_params(sm_params *params) {
+    params->engine = SM_ENGINE_SERIAL;
+    params->connectivity = 4;
+    params->threshold = 4;
+    params->num_threads = 0;
+    params->region_stats = 0;
+    params->label_bytes = 0;
+    params->row_sink = NULL;
+    params->row_sink_ctx = NULL;
+    params->metrics = NULL;
+    params->sweep_sink = NULL;
+    params->sweep_sink_ctx = NULL;
+}
+
+int sm_label_bytes(const Image *img, const sm_params *params) {
+    if (!img || !params || img->width <= 0 || img->height <= 0)
+        return SM_ERR_ARGS;
+    // Labels are linear indices, so 32 bits cover up to 2^32 pixels and 16
+    // bits up to 2^16; the narrow width is only used when asked for
+    uint64_t last = (uint64_t)img->width * img->height - 1;
+    bool fits32 = last <= UINT32_MAX;
+    if (params->label_bytes == 0)
+        return fits32 ? 4 : 8;
+    if (params->label_bytes == 8 || (params->label_bytes == 4 && fits32) ||
+        (params->label_bytes == 2 && last <= UINT16_MAX))
+        return params->label_bytes;
+    return SM_ERR_ARGS;
+}
+
+template <class Label>
+static int segment_with(const Image *img, const sm_params *params, sm_result *result) {
+    Label *labels = (Label *)result->labels;
+    bool wide = IMAGE_PIXEL_BYTES(img) == 2;
+    int sweeps = wide ? dispatch<uint16_t, Label>(img, params, labels)
+                      : dispatch<uint8_t, Label>(img, params, labels);
+    if (sweeps < 0)
+        return sweeps;
+
+    sm_mark start = sm_metrics_start(params->metrics);
+    size_t n = (size_t)img->width * img->height;
+    size_t regions = 0;
+    for (size_t i = 0; i < n; i++)
+        regions += labels[i] == i;
+    result->sweeps = sweeps;
+    result->num_regions = regions;
+
+    if (result->owns_regions)
+        free(result->regions);
+    result->regions = NULL;
+    result->owns_regions = 0;
+    int err = SM_OK;
+    if (params->region_stats) {
+        result->regions = (sm_region *)malloc(regions * sizeof(sm_region));
+        if (!result->regions)
+            return SM_ERR_NOMEM;
+        result->owns_regions = 1;
+        err = wide ? collect_regions<uint16_t, Label>(img, labels, result->regions)
+                   : collect_regions<uint8_t, Label>(img, labels, result->regions);
+    }
+    sm_metrics_stop(params->metrics, SM_PHASE_REGIONS, start);
+    return err;
+}
+
+int sm_segment(const Image *img, const sm_params *params, sm_result *result) {
+    if (!img || !img->data || img->width <= 0 || img->height <= 0 || !params || !result)
+        return SM_ERR_ARGS;
+    if (params->engine < 0 || params->engine >= SM_ENGINE_COUNT ||
+        (params->connectivity != 4 && params->connectivity != 8))
+        return SM_ERR_ARGS;
+    int label_bytes = sm_label_bytes(img, params);
+    if (label_bytes < 0)
+        return label_bytes;
+
+    size_t n = (size_t)img->width * img->height;
+    size_t bytes = n * label_bytes;
+    if (result->labels && result->capacity < bytes) {
+        if (!result->owns_labels)
+            return SM_ERR_BUFFER;
+        // Our own buffer from an earlier, smaller image: swap it for one
+        // that fits rather than making the caller release the result
+        pool_free(result->labels, result->capacity);
+        result->labels = NULL;
+        result->capacity = 0;
+        result->owns_labels = 0;
+    }
+    if (!result->labels) {
+        result->labels = pool_alloc(bytes);
+        if (!result->labels)
+            return SM_ERR_NOMEM;
+        result->capacity = bytes;
+        result->owns_labels = 1;
+    }
+    result->width = img->width;
+    result->height = img->height;
+    result->label_bytes = label_bytes;
+
+#ifdef _OPENMP
+    int saved_threads = omp_get_max_threads();
+    if (params->engine == SM_ENGINE_OPENMP && params->num_threads > 0)
+        omp_set_num_threads(params->num_threads);
+#endif
+
+    int err = label_bytes == 8 ? segment_with<uint64_t>(img, params, result)
+            : label_bytes == 4 ? segment_with<uint32_t>(img, params, result)
+                               : segment_with<uint16_t>(img, params, result);
+
+#ifdef _OPENMP
+    omp_set_num_threads(saved_threads);
+#endif
+    return err;
+}
+
+void sm_result_release(sm_result *result) {
+    if (!result)
+        return;
+    if (result->owns_labels)
+        pool_free(result->labels, result->capacity);
+    if (result->owns_regions)
+        free(result->regions);
+    update_state_free(result->update_state);
+    memset(result, 0, sizeof(*result));
+}
+
+const char *sm_engine_name(sm_engine engine) {
+    if (engine < 0 || engine >= SM_ENGINE_COUNT)
+        return "unknown";
+    return engine_names[engine];
+}
+
+int sm_engine_from_name(const char *name, sm_engine *engine) {
+    for (int i = 0; i < SM_ENGINE_COUNT; i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = (sm_engine)i;
+            return SM_OK;
+        }
+    }
+    return SM_ERR_ARGS;
+}
+
+const char *sm_strerror(int err) {
+    switch (err) {
+    case SM_OK:         return "success";
+    case SM_ERR_ARGS:   return "invalid arguments";
+    case SM_ERR_NOMEM:  return "out of memory";
+    case SM_ERR_BUFFER: return "label buffer too small";
+    default:            return "unknown error";
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef SPLITMERGE_H
+#define SPLITMERGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "image_io.h"
+#include "metrics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libsplitmerge: in-process split/merge segmentation. All functions return
+// SM_OK or a negative SM_ERR_* code; nothing in the library exits.
+
+#define SM_OK           0
+#define SM_ERR_ARGS    -1   // bad parameters or image
+#define SM_ERR_NOMEM   -2   // allocation failed
+#define SM_ERR_BUFFER  -3   // caller-provided buffer too small
+
+typedef enum {
+    SM_ENGINE_SERIAL = 0,   // iterative label sweeps on one thread
+    SM_ENGINE_OPENMP,       // iterative label sweeps on OpenMP threads
+    SM_ENGINE_UNION_FIND,   // single pass union-find plus flatten, one thread
+    SM_ENGINE_COUNT
+} sm_engine;
+
+typedef struct {
+    sm_engine engine;
+    int connectivity;       // 4 or 8
+    int threshold;          // neighbours merge when |a - b| < threshold
+    int num_threads;        // OpenMP engine only; 0 keeps the runtime default
+    int region_stats;       // nonzero to fill sm_result.regions
+    int label_bytes;        // 2, 4 or 8; 0 picks 4 unless the image has more than 2^32 pixels
+    // Optional: called for each row, in order, with its final labels as the
+    // last labeling pass produces them (e.g. to run-length encode the output)
+    void (*row_sink)(void *ctx, int row, const void *labels, int label_bytes, int width);
+    void *row_sink_ctx;
+    // Optional: per-phase (and, for the OpenMP engine, per-thread) timings
+    // are added here; NULL turns the timers off
+    sm_metrics *metrics;
+    // Optional: called after every merge sweep of the serial and OpenMP
+    // engines with its convergence telemetry (union-find has no sweeps)
+    sm_sweep_callback sweep_sink;
+    void *sweep_sink_ctx;
+} sm_params;
+
+// Per-region statistics. Every field is 64-bit so an array of these can be
+// handed out as a plain (num_regions x 7) uint64 table.
+typedef struct {
+    uint64_t label;
+    uint64_t pixel_count;
+    uint64_t intensity_sum;
+    uint64_t min_x, min_y;  // bounding box, inclusive
+    uint64_t max_x, max_y;
+} sm_region;
+
+// Zero-initialise an sm_result before its first use (sm_result r = {0};),
+// then set labels and capacity if the labels should go into your own
+// buffer. The library frees only what it allocated itself, as recorded in
+// the owns_* flags.
+typedef struct {
+    int width;
+    int height;
+    int label_bytes;        // size of one label: 2 (uint16_t), 4 (uint32_t) or 8 (uint64_t)
+    void *labels;           // width * height labels, row-major
+    size_t capacity;        // bytes available at labels when caller-provided
+    int owns_labels;        // set by the library when it allocated labels
+    int sweeps;             // merge sweeps run (1 for union-find)
+    size_t num_regions;
+    sm_region *regions;     // num_regions entries in label order when region_stats is set
+    int owns_regions;       // set by the library when it allocated regions
+    int resegmented;        // set by sm_update when it fell back to a full sm_segment
+    struct sm_update_state *update_state;   // sm_update's scratch, kept between calls
+} sm_result;
+
+// A rectangle of pixels, for sm_update_rects
+typedef struct {
+    int x, y;
+    int width, height;
+} sm_rect;
+
+// Fill params with the defaults used by the drivers
+void sm_default_params(sm_params *params);
+
+// Label width sm_segment will use for img under params (see
+// sm_params.label_bytes), or SM_ERR_ARGS if the requested width cannot hold
+// the image's labels
+int sm_label_bytes(const Image *img, const sm_params *params);
+
+// Segment img into a zero-initialised or previously used result. If
+// result->labels is NULL the library allocates the label buffer and
+// result->owns_labels is set, and a later call with a larger image replaces
+// that buffer with one that fits. Otherwise labels/capacity must describe a
+// buffer of at least width * height * sm_label_bytes() bytes (SM_ERR_BUFFER
+// if not), which lets callers reuse one buffer across many images.
+int sm_segment(const Image *img, const sm_params *params, sm_result *result);
+
+// Fill mask (width * height bytes) with the EDGE_* bits of edge_mask.h for
+// img under params' connectivity and threshold. Used by backends that run
+// their own merge, e.g. over a haloed MPI chunk.
+int sm_build_edge_mask(const Image *img, uint8_t *mask, const sm_params *params);
+
+// Incremental update after the pixels of img inside the rectangle (x, y,
+// width, height) changed. result must hold the labels and region statistics
+// (region_stats set, so the library owns regions) of the image before the
+// edit, from sm_segment or an earlier sm_update with the same connectivity
+// and threshold. Only the components meeting the rectangle are relabelled,
+// along with any neighbours they now merge with, and their statistics are
+// patched in place, so the cost follows the edit rather than the image;
+// when the pixels it would visit pass an eighth of the image, img is
+// re-segmented in full instead and result->resegmented is set. Labels and
+// regions end up exactly as a full sm_segment of img would leave them.
+// The first call allocates an index of 8 bytes per pixel, which result
+// keeps for later calls until sm_result_release.
+int sm_update(const Image *img, const sm_params *params, sm_result *result, int x, int y, int width, int height);
+// The same for several edited rectangles (which may overlap) in one pass,
+// so an image with many small edits is updated, or re-segmented, once.
+// before, if not NULL, is the image result describes (only its pixels inside
+// the rectangles are read). With it, a component the edit only nibbles at,
+// such as a background spanning the image, keeps its statistics without
+// being walked; without it such a component is flooded in full.
+int sm_update_rects(const Image *img, const Image *before, const sm_params *params, sm_result *result,
+                    const sm_rect *rects, int count);
+
+// Free library-owned labels, regions and update scratch and reset the
+// result for reuse
+void sm_result_release(sm_result *result);
+
+// Streaming segmentation: rows are pushed one at a time and only the
+// previous row plus the regions touching it are kept, so images of any
+// height run in O(width) memory. Each region is passed to emit (with the
+// same label and statistics sm_segment would report) as soon as a row no
+// longer touches it; sm_stream_finish emits the rest. Only connectivity and
+// threshold are taken from params.
+typedef struct sm_stream sm_stream;
+typedef void (*sm_region_callback)(void *ctx, const sm_region *region);
+
+// maxval > 255 selects uint16_t pixels; NULL on bad arguments
+sm_stream *sm_stream_create(int width, int maxval, const sm_params *params,
+                            sm_region_callback emit, void *ctx);
+int sm_stream_push_row(sm_stream *stream, const void *row);
+int sm_stream_finish(sm_stream *stream);
+// Most regions held at once, i.e. the stream's working-set size
+size_t sm_stream_peak_regions(const sm_stream *stream);
+void sm_stream_destroy(sm_stream *stream);
+
+const char *sm_engine_name(sm_engine engine);
+// Returns SM_OK and sets *engine if name matches an engine name
+int sm_engine_from_name(const char *name, sm_engine *engine);
+const char *sm_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
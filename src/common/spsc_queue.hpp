@@ -0,0 +1,65 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Bounded single-producer / single-consumer ring used to hand buffers
+// between pipeline stages. Exactly one thread may push and one may pop.
+// push and pop block: they spin briefly, then yield, then sleep, so an idle
+// stage does not take a core from the workers.
+template <class T>
+class SpscQueue {
+public:
+    // One slot stays empty to tell a full ring from an empty one
+    explicit SpscQueue(size_t capacity) : slots_(capacity + 1), head_(0), tail_(0) {}
+
+    bool try_push(const T &value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = tail + 1 == slots_.size() ? 0 : tail + 1;
+        if (next == head_.load(std::memory_order_acquire))
+            return false;
+        slots_[tail] = value;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        value = slots_[head];
+        head_.store(head + 1 == slots_.size() ? 0 : head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(const T &value) {
+        for (int spins = 0; !try_push(value); spins++)
+            backoff(spins);
+    }
+
+    T pop() {
+        T value;
+        for (int spins = 0; !try_pop(value); spins++)
+            backoff(spins);
+        return value;
+    }
+
+private:
+    static void backoff(int spins) {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    std::vector<T> slots_;
+    // Producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "splitmerge.h"
+#include "segment.hpp"
+
+// Single-pass streaming labeler. Only the previous row (pixels and region
+// ids) is kept, plus a union-find over the regions that still touch it.
+// After each row every region that no longer appears in it is complete and
+// is handed to the callback, so memory is O(width + active regions).
+//
+// Region labels match the whole-image engines: the linear index of the
+// region's first pixel in raster order.
+
+struct sm_stream {
+    int width;
+    int connectivity;
+    int pixel_bytes;
+    int threshold;
+    uint64_t row;                   // index of the next row
+
+    std::vector<uint8_t> prev_pixels;
+    std::vector<int> prev_ids;      // region node per pixel of the previous row
+    std::vector<int> cur_ids;
+
+    // Region nodes: parent links plus statistics, valid on roots only
+    std::vector<int> parent;
+    std::vector<sm_region> stats;
+    std::vector<uint64_t> seen_row; // last row a root was marked present in
+    std::vector<int> free_nodes;
+    std::vector<int> live;          // nodes allocated and not yet freed
+    size_t peak_live;
+
+    sm_region_callback emit;
+    void *ctx;
+};
+
+static int new_node(sm_stream *s, uint64_t x, uint64_t y) {
+    int id;
+    if (!s->free_nodes.empty()) {
+        id = s->free_nodes.back();
+        s->free_nodes.pop_back();
+    } else {
+        id = (int)s->parent.size();
+        s->parent.push_back(0);
+        s->stats.push_back(sm_region());
+        s->seen_row.push_back(0);
+    }
+    s->parent[id] = id;
+    sm_region &r = s->stats[id];
+    r.label = y * s->width + x;
+    r.pixel_count = 0;
+    r.intensity_sum = 0;
+    r.min_x = r.max_x = x;
+    r.min_y = r.max_y = y;
+    s->seen_row[id] = UINT64_MAX;
+    s->live.push_back(id);
+    return id;
+}
+
+static int find(sm_stream *s, int i) {
+    while (s->parent[i] != i) {
+        s->parent[i] = s->parent[s->parent[i]];
+        i = s->parent[i];
+    }
+    return i;
+}
+
+// The root with the smaller label (earlier first pixel) absorbs the other
+static int unite(sm_stream *s, int a, int b) {
+    a = find(s, a);
+    b = find(s, b);
+    if (a == b)
+        return a;
+    if (s->stats[b].label < s->stats[a].label) {
+        int t = a; a = b; b = t;
+    }
+    sm_region &ra = s->stats[a], &rb = s->stats[b];
+    ra.pixel_count += rb.pixel_count;
+    ra.intensity_sum += rb.intensity_sum;
+    if (rb.min_x < ra.min_x) ra.min_x = rb.min_x;
+    if (rb.max_x > ra.max_x) ra.max_x = rb.max_x;
+    if (rb.min_y < ra.min_y) ra.min_y = rb.min_y;
+    if (rb.max_y > ra.max_y) ra.max_y = rb.max_y;
+    s->parent[b] = a;
+    return a;
+}
+
+template <class Pixel, int Connectivity>
+static void push_row(sm_stream *s, const Pixel *row) {
+    AbsDiffLess<Pixel> similar(s->threshold);
+    const Pixel *prev = (const Pixel *)s->prev_pixels.data();
+    bool has_prev = s->row > 0;
+    uint64_t y = s->row;
+    int width = s->width;
+
+    for (int x = 0; x < width; x++) {
+        int id = -1;
+        if (x > 0 && similar(row[x], row[x - 1]))
+            id = s->cur_ids[x - 1];
+        if (has_prev) {
+            if (similar(row[x], prev[x]))
+                id = id < 0 ? s->prev_ids[x] : unite(s, id, s->prev_ids[x]);
+            if (Connectivity == 8) {
+                if (x > 0 && similar(row[x], prev[x - 1]))
+                    id = id < 0 ? s->prev_ids[x - 1] : unite(s, id, s->prev_ids[x - 1]);
+                if (x + 1 < width && similar(row[x], prev[x + 1]))
+                    id = id < 0 ? s->prev_ids[x + 1] : unite(s, id, s->prev_ids[x + 1]);
+            }
+        }
+        if (id < 0)
+            id = new_node(s, x, y);
+        id = find(s, id);
+
+        sm_region &r = s->stats[id];
+        r.pixel_count++;
+        r.intensity_sum += row[x];
+        if ((uint64_t)x < r.min_x) r.min_x = x;
+        if ((uint64_t)x > r.max_x) r.max_x = x;
+        r.max_y = y;
+        s->cur_ids[x] = id;
+    }
+
+    // Point every pixel at its root and mark the roots still present
+    for (int x = 0; x < width; x++) {
+        int root = find(s, s->cur_ids[x]);
+        s->cur_ids[x] = root;
+        s->seen_row[root] = y;
+    }
+
+    // Non-roots are no longer referenced; roots absent from this row are done
+    size_t kept = 0;
+    for (size_t i = 0; i < s->live.size(); i++) {
+        int id = s->live[i];
+        if (s->parent[id] == id && s->seen_row[id] == y) {
+            s->live[kept++] = id;
+            continue;
+        }
+        if (s->parent[id] == id)
+            s->emit(s->ctx, &s->stats[id]);
+        s->free_nodes.push_back(id);
+    }
+    s->live.resize(kept);
+
+    memcpy(s->prev_pixels.data(), row, (size_t)width * sizeof(Pixel));
+    s->prev_ids.swap(s->cur_ids);
+    s->row++;
+}
+
+sm_stream *sm_stream_create(int width, int maxval, const sm_params *params,
+                            sm_region_callback emit, void *ctx) {
+    if (width <= 0 || !params || !emit || (params->connectivity != 4 && params->connectivity != 8))
+        return NULL;
+    sm_stream *s = new sm_stream();
+    s->width = width;
+    s->connectivity = params->connectivity;
+    s->pixel_bytes = maxval > 255 ? 2 : 1;
+    s->threshold = params->threshold;
+    s->row = 0;
+    s->prev_pixels.resize((size_t)width * s->pixel_bytes);
+    s->prev_ids.resize(width);
+    s->cur_ids.resize(width);
+    s->peak_live = 0;
+    s->emit = emit;
+    s->ctx = ctx;
+    return s;
+}
+
+int sm_stream_push_row(sm_stream *s, const void *row) {
+    if (!s || !row)
+        return SM_ERR_ARGS;
+    bool wide = s->pixel_bytes == 2;
+    if (s->connectivity == 8) {
+        if (wide) push_row<uint16_t, 8>(s, (const uint16_t *)row);
+        else      push_row<uint8_t, 8>(s, (const uint8_t *)row);
+    } else {
+        if (wide) push_row<uint16_t, 4>(s, (const uint16_t *)row);
+        else      push_row<uint8_t, 4>(s, (const uint8_t *)row);
+    }
+    if (s->live.size() > s->peak_live)
+        s->peak_live = s->live.size();
+    return SM_OK;
+}
+
+int sm_stream_finish(sm_stream *s) {
+    if (!s)
+        return SM_ERR_ARGS;
+    for (size_t i = 0; i < s->live.size(); i++)
+        if (s->parent[s->live[i]] == s->live[i])
+            s->emit(s->ctx, &s->stats[s->live[i]]);
+    s->live.clear();
+    return SM_OK;
+}
+
+size_t sm_stream_peak_regions(const sm_stream *s) {
+    return s ? s->peak_live : 0;
+}
+
+void sm_stream_destroy(sm_stream *s) {
+    delete s;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "trace.h"
+#include "metrics.h"
+
+typedef struct trace_buffer {
+    const char **names;
+    double *start, *end;
+    size_t head, count, dropped;
+    int tid;                    // registration order; 0 is normally the main thread
+    struct trace_buffer *next;
+} trace_buffer;
+
+int sm_tracing = 0;
+static size_t trace_capacity;
+static double trace_origin;
+static trace_buffer *buffers;
+static int num_buffers;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_buffer *thread_buffer;
+
+int sm_trace_enable(size_t capacity) {
+    if (capacity == 0)
+        return -1;
+    trace_capacity = capacity;
+    trace_origin = sm_metrics_now();
+    sm_tracing = 1;
+    return 0;
+}
+
+void sm_trace_set_origin(double origin) {
+    trace_origin = origin;
+}
+
+// Buffers stay on the global list after their thread exits, so pipeline
+// threads' events survive until the trace is written
+static trace_buffer *register_thread(void) {
+    trace_buffer *b = (trace_buffer *)calloc(1, sizeof(trace_buffer));
+    if (!b)
+        return NULL;
+    b->names = (const char **)malloc(trace_capacity * sizeof(const char *));
+    b->start = (double *)malloc(trace_capacity * sizeof(double));
+    b->end = (double *)malloc(trace_capacity * sizeof(double));
+    if (!b->names || !b->start || !b->end) {
+        free(b->names);
+        free(b->start);
+        free(b->end);
+        free(b);
+        return NULL;
+    }
+    pthread_mutex_lock(&buffers_lock);
+    b->tid = num_buffers++;
+    b->next = buffers;
+    buffers = b;
+    pthread_mutex_unlock(&buffers_lock);
+    return b;
+}
+
+void sm_trace_event(const char *name, double start, double end) {
+    if (!sm_tracing)
+        return;
+    trace_buffer *b = thread_buffer;
+    if (!b && !(b = thread_buffer = register_thread()))
+        return;
+    size_t slot = (b->head + b->count) % trace_capacity;
+    if (b->count == trace_capacity) {
+        b->head = (b->head + 1) % trace_capacity;
+        b->dropped++;
+    } else {
+        b->count++;
+    }
+    b->names[slot] = name;
+    b->start[slot] = start;
+    b->end[slot] = end;
+}
+
+char *sm_trace_json(int pid, const char *process_name, size_t *len) {
+    char *out = NULL;
+    *len = 0;
+    FILE *fp = open_memstream(&out, len);
+    if (!fp)
+        return NULL;
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+            pid, process_name);
+    pthread_mutex_lock(&buffers_lock);
+    for (trace_buffer *b = buffers; b; b = b->next) {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                    "\"args\": {\"name\": \"thread %d\"}}", pid, b->tid, b->tid);
+        for (size_t i = 0; i < b->count; i++) {
+            size_t e = (b->head + i) % trace_capacity;
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, "
+                        "\"ts\": %.3f, \"dur\": %.3f}", b->names[e], pid, b->tid,
+                    (b->start[e] - trace_origin) * 1e6, (b->end[e] - b->start[e]) * 1e6);
+        }
+    }
+    pthread_mutex_unlock(&buffers_lock);
+    fclose(fp);
+    return out;
+}
+
+int sm_trace_write(const char *path, char *const *parts, int num_parts) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    fprintf(fp, "{\"traceEvents\": [\n");
+    const char *sep = "";
+    for (int i = 0; i < num_parts; i++) {
+        if (parts[i] && parts[i][0]) {
+            fprintf(fp, "%s%s", sep, parts[i]);
+            sep = ",\n";
+        }
+    }
+    fprintf(fp, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+size_t sm_trace_dropped(void) {
+    size_t dropped = 0;
+    pthread_mutex_lock(&buffers_lock);
+    for (trace_buffer *b = buffers; b; b = b->next)
+        dropped += b->dropped;
+    pthread_mutex_unlock(&buffers_lock);
+    return dropped;
+}
@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Timeline recording in the Chrome trace event format, viewable in
+// chrome://tracing or ui.perfetto.dev. Each thread appends complete events
+// (name, start, end) to its own ring buffer, so recording takes no lock and
+// a long run keeps its most recent events. The metrics layer records every
+// timed phase here while tracing is on.
+
+extern int sm_tracing;
+
+// Start recording with room for capacity events per thread; the clock
+// origin is now until sm_trace_set_origin moves it. Returns 0 or -1.
+int sm_trace_enable(size_t capacity);
+// Timestamps are written relative to origin (sm_metrics_now() seconds).
+// MPI ranks set it right after a shared barrier so their clocks line up.
+void sm_trace_set_origin(double origin);
+
+// Record [start, end) on the calling thread; name must outlive the trace
+void sm_trace_event(const char *name, double start, double end);
+
+// This process's events as comma-separated JSON objects under pid, with
+// thread and process name metadata; malloc'd, NULL if nothing was recorded
+char *sm_trace_json(int pid, const char *process_name, size_t *len);
+// Write {"traceEvents": [...]} from num_parts fragments of sm_trace_json
+int sm_trace_write(const char *path, char *const *parts, int num_parts);
+// Events overwritten because a ring buffer was full
+size_t sm_trace_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,732 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "splitmerge.h"
+#include "segment.hpp"
+
+// Incremental re-segmentation after edits confined to a few rectangles.
+//
+// Only edges touching the edit can have changed, so every component that
+// does not meet it keeps its pixels; the components that do (the affected
+// ones) may split, and may join neighbours across the edited edges.
+//
+// The part of an affected component outside the edit falls into pieces, each
+// of which touches the edit. They are found by flooding the old label along
+// similar edges outward from the edit's rim, all pieces at once, until the
+// pieces still growing are known to be one (each connected part of the edit
+// borders at most one of them): the others are explored in full, and the one
+// left (typically a background that spans the frame) is never walked. Its
+// statistics are the component's old ones minus everything else, which is
+// exact as long as the caller supplied the pixels from before the edit (the
+// intensities the edit took away) and its first pixel and every side of its
+// bounding box survive outside the explored pixels; otherwise it is flooded
+// too.
+//
+// A union-find then runs over the edit's pixels, with each piece and each
+// neighbouring unaffected component reachable through a similar edge folded
+// in as a single node carrying its statistics. Each resulting component
+// takes the smallest pixel index it holds as its label, its first pixel in
+// raster order, exactly as a full sm_segment would label it. Pieces and
+// neighbours whose label changes are relabelled by the same kind of flood,
+// so the cost follows the pixels the update visits rather than any bounding
+// box or the image. Visited pixels are marked in a per-pixel index that the
+// result keeps between updates instead of clearing it each time (see
+// PixelIndex), and the region table is patched in place; only when the
+// number of regions changes do the entries after the edit's labels move,
+// by one memmove. When the work would pass an eighth of the image, a
+// single full sm_segment into the same buffers is cheaper and runs instead.
+
+namespace {
+
+constexpr size_t NONE = SIZE_MAX;
+
+struct Rect {
+    int x0, y0, x1, y1;     // inclusive
+
+    bool contains(int x, int y) const {
+        return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+    }
+};
+
+// Pixel index -> value for the pixels an update visits, one entry per
+// pixel kept in the result between updates. Each entry carries the
+// generation of the update that wrote it, so starting an update costs
+// nothing: entries from earlier ones are simply stale. Only when the
+// generation wraps is the whole index cleared.
+const int GENERATION_SHIFT = 48;
+const uint64_t VALUE_MASK = ((uint64_t)1 << GENERATION_SHIFT) - 1;
+
+struct PixelIndex {
+    uint64_t *marks;
+    uint64_t stamp;         // generation << GENERATION_SHIFT
+
+    // The value stored for pixel i by this update, or NONE
+    size_t get(size_t i) const {
+        uint64_t m = marks[i];
+        return (m & ~VALUE_MASK) == stamp ? (size_t)(m & VALUE_MASK) : NONE;
+    }
+
+    void set(size_t i, size_t value) {
+        marks[i] = stamp | value;
+    }
+};
+
+// Union-find with the smaller index as the root
+struct Forest {
+    std::vector<size_t> parent;
+
+    size_t add() {
+        parent.push_back(parent.size());
+        return parent.size() - 1;
+    }
+
+    size_t find(size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    size_t unite(size_t a, size_t b) {
+        a = find(a);
+        b = find(b);
+        if (a < b)
+            parent[b] = a;
+        else if (b < a)
+            parent[a] = b;
+        return std::min(a, b);
+    }
+};
+
+bool label_less(const sm_region &r, uint64_t label) {
+    return r.label < label;
+}
+
+const sm_region *find_region(const sm_result *result, uint64_t label) {
+    const sm_region *end = result->regions + result->num_regions;
+    const sm_region *r = std::lower_bound((const sm_region *)result->regions, end, label, label_less);
+    return r != end && r->label == label ? r : NULL;
+}
+
+void absorb(sm_region &into, const sm_region &r) {
+    into.label = std::min(into.label, r.label);
+    into.pixel_count += r.pixel_count;
+    into.intensity_sum += r.intensity_sum;
+    into.min_x = std::min(into.min_x, r.min_x);
+    into.min_y = std::min(into.min_y, r.min_y);
+    into.max_x = std::max(into.max_x, r.max_x);
+    into.max_y = std::max(into.max_y, r.max_y);
+}
+
+const sm_region EMPTY = { UINT64_MAX, 0, 0, UINT64_MAX, UINT64_MAX, 0, 0 };
+
+const int DX[8] = { 1, -1, 0, 0, 1, -1, 1, -1 };
+const int DY[8] = { 0, 0, 1, -1, 1, 1, -1, -1 };
+
+// An affected component: its old statistics, what the edit took from it,
+// and its piece that was left unexplored, if any
+struct Affected {
+    sm_region old;
+    uint64_t edit_count, edit_sum;
+    bool edit_on_box;       // an edit pixel lies on a side of old's box
+    size_t open_group;      // unexplored piece, NONE if every piece is explored
+};
+
+template <class Pixel, class Label>
+int update(const Image *img, const Image *before, const sm_params *params, sm_result *result,
+           const std::vector<Rect> &edit, PixelIndex owner, bool &resegment) {
+    const Pixel *pixels = (const Pixel *)img->data;
+    const Pixel *old_pixels = before ? (const Pixel *)before->data : NULL;
+    Label *labels = (Label *)result->labels;
+    int width = img->width, height = img->height;
+    int neighbours = params->connectivity == 8 ? 8 : 4;
+    AbsDiffLess<Pixel> similar(params->threshold);
+    // A flood costs several times what a full pass spends per pixel
+    size_t budget = (size_t)width * height / 8;
+    resegment = false;
+
+    // The edit's pixels in raster order, each counted once where
+    // rectangles overlap
+    std::vector<size_t> cells;
+    for (size_t r = 0; r < edit.size(); r++)
+        for (int y = edit[r].y0; y <= edit[r].y1; y++)
+            for (int x = edit[r].x0; x <= edit[r].x1; x++) {
+                size_t k = 0;
+                while (k < r && !edit[k].contains(x, y))
+                    k++;
+                if (k == r)
+                    cells.push_back((size_t)y * width + x);
+            }
+    std::sort(cells.begin(), cells.end());
+    if (cells.size() > budget) {
+        resegment = true;
+        return SM_OK;
+    }
+
+    // What each visited pixel is to the update: c for cell c, and past the
+    // cells the group of an explored pixel
+    for (size_t c = 0; c < cells.size(); c++)
+        owner.set(cells[c], c);
+    size_t num_cells = cells.size();
+    auto in_edit = [&](int x, int y) {
+        for (size_t r = 0; r < edit.size(); r++)
+            if (edit[r].contains(x, y))
+                return true;
+        return false;
+    };
+    auto group_of = [&](size_t i) { return owner.get(i) - num_cells; };
+
+    // Affected components: every old label inside the edit
+    std::vector<uint64_t> labels_hit;
+    for (size_t c = 0; c < cells.size(); c++)
+        if (labels_hit.empty() || labels_hit.back() != labels[cells[c]])
+            labels_hit.push_back(labels[cells[c]]);
+    std::sort(labels_hit.begin(), labels_hit.end());
+    labels_hit.erase(std::unique(labels_hit.begin(), labels_hit.end()), labels_hit.end());
+    std::vector<Affected> affected(labels_hit.size());
+    uint64_t reach = 0;
+    for (size_t a = 0; a < affected.size(); a++) {
+        const sm_region *r = find_region(result, labels_hit[a]);
+        if (!r)
+            return SM_ERR_ARGS;     // regions do not match labels
+        affected[a] = { *r, 0, 0, false, NONE };
+        reach += r->pixel_count;
+    }
+    // Without the pixels from before the edit every piece gets walked, so
+    // touching more than the budget's worth of components means a full pass
+    // anyway
+    if (!old_pixels && reach > budget) {
+        resegment = true;
+        return SM_OK;
+    }
+    auto affected_index = [&](uint64_t label) -> size_t {
+        auto it = std::lower_bound(labels_hit.begin(), labels_hit.end(), label);
+        return it != labels_hit.end() && *it == label ? (size_t)(it - labels_hit.begin()) : NONE;
+    };
+    for (size_t c = 0; c < cells.size(); c++) {
+        Affected &a = affected[affected_index(labels[cells[c]])];
+        uint64_t x = cells[c] % width, y = cells[c] / width;
+        a.edit_count++;
+        if (old_pixels)
+            a.edit_sum += old_pixels[cells[c]];
+        a.edit_on_box |= x == a.old.min_x || x == a.old.max_x || y == a.old.min_y || y == a.old.max_y;
+    }
+
+    // Connected parts of the edit: rectangles that overlap or touch, even
+    // diagonally, belong to the same part
+    Forest parts;
+    for (size_t r = 0; r < edit.size(); r++) {
+        parts.add();
+        for (size_t k = 0; k < r; k++)
+            if (edit[k].x0 <= edit[r].x1 + 1 && edit[r].x0 <= edit[k].x1 + 1 && edit[k].y0 <= edit[r].y1 + 1 &&
+                edit[r].y0 <= edit[k].y1 + 1)
+                parts.unite(k, r);
+    }
+    auto part_at = [&](int x, int y) {
+        size_t r = 0;
+        while (!edit[r].contains(x, y))
+            r++;
+        return parts.find(r);
+    };
+
+    // Pieces: flood each affected label outward from the pixels that border
+    // the edit, one group per seed, merging groups that meet. A group with
+    // nothing queued is a whole piece; once a component is settled, its
+    // pixels are left alone.
+    Forest groups;
+    std::vector<size_t> group_comp, queued;
+    std::vector<size_t> active(affected.size(), 0);     // groups still growing
+    std::vector<std::vector<std::pair<size_t, size_t>>> borders(affected.size());   // (group, part)
+    std::vector<size_t> explored;
+    size_t head = 0;            // explored doubles as the queue
+    auto visit = [&](size_t i, size_t g) {
+        owner.set(i, num_cells + g);
+        explored.push_back(i);
+        queued[g]++;
+    };
+    for (size_t c = 0; c < cells.size(); c++) {
+        int x = (int)(cells[c] % width), y = (int)(cells[c] / width);
+        size_t part = NONE;
+        for (int d = 0; d < neighbours; d++) {
+            int nx = x + DX[d], ny = y + DY[d];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                continue;
+            size_t j = (size_t)ny * width + nx;
+            size_t v = owner.get(j);
+            if (v < num_cells)
+                continue;
+            size_t a = affected_index(labels[j]);
+            if (a == NONE)
+                continue;
+            if (v == NONE) {
+                size_t g = groups.add();
+                group_comp.push_back(a);
+                queued.push_back(0);
+                visit(j, g);
+                active[a]++;
+            }
+            if (part == NONE)
+                part = part_at(x, y);
+            borders[a].push_back({ group_of(j), part });
+        }
+    }
+
+    // A component is settled once each part of the edit, joined to others
+    // through the pieces explored in full, borders at most one growing
+    // group: any path the edit used to carry between growing groups then
+    // has a way around it, so they are all one piece. Parts bound how many
+    // growing groups can pass, so the check waits until there are that few.
+    std::vector<size_t> num_parts(affected.size());
+    auto compact = [&](size_t a) {
+        std::vector<std::pair<size_t, size_t>> &b = borders[a];
+        for (size_t k = 0; k < b.size(); k++)
+            b[k].first = groups.find(b[k].first);
+        std::sort(b.begin(), b.end());
+        b.erase(std::unique(b.begin(), b.end()), b.end());
+    };
+    auto settle = [&](size_t a) {
+        if (active[a] <= 1)
+            return true;
+        compact(a);
+        const std::vector<std::pair<size_t, size_t>> &b = borders[a];
+        Forest links;           // groups, then parts
+        std::unordered_map<size_t, size_t> group_node, part_node;
+        auto node = [&](std::unordered_map<size_t, size_t> &nodes, size_t key) {
+            auto it = nodes.emplace(key, links.parent.size());
+            if (it.second)
+                links.add();
+            return it.first->second;
+        };
+        for (size_t k = 0; k < b.size(); k++)
+            links.unite(node(group_node, b[k].first), node(part_node, b[k].second));
+        std::unordered_map<size_t, size_t> growing;     // link root to its growing group
+        for (size_t k = 0; k < b.size(); k++) {
+            size_t g = b[k].first;
+            if (!queued[g])
+                continue;
+            auto it = growing.emplace(links.find(group_node[g]), g);
+            if (it.first->second != g)
+                return false;
+        }
+        size_t open = NONE;
+        for (const auto &e : growing) {
+            if (open == NONE) {
+                open = e.second;
+                continue;
+            }
+            size_t q = queued[open] + queued[e.second];
+            open = groups.unite(open, e.second);
+            queued[open] = q;
+        }
+        active[a] = 1;
+        return true;
+    };
+    std::vector<uint8_t> settled(affected.size());
+    size_t pending = 0;         // components not settled yet
+    for (size_t a = 0; a < affected.size(); a++) {
+        compact(a);
+        for (size_t k = 0; k < borders[a].size(); k++)
+            if (k == 0 || borders[a][k].second != borders[a][k - 1].second)
+                num_parts[a]++;
+        settled[a] = active[a] <= 1;
+        pending += !settled[a];
+    }
+    while (pending && head < explored.size()) {
+        size_t i = explored[head++];
+        size_t g = groups.find(group_of(i)), a = group_comp[g];
+        if (settled[a])
+            continue;       // its growing group stays open
+        bool changed = false;
+        int x = (int)(i % width), y = (int)(i / width);
+        for (int d = 0; d < neighbours; d++) {
+            int nx = x + DX[d], ny = y + DY[d];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                continue;
+            size_t j = (size_t)ny * width + nx;
+            if (labels[j] != labels[i] || !similar(pixels[i], pixels[j]))
+                continue;
+            size_t v = owner.get(j);
+            if (v < num_cells)
+                continue;
+            if (v == NONE) {
+                visit(j, g);
+                continue;
+            }
+            size_t h = groups.find(v - num_cells);
+            if (h == g)
+                continue;
+            size_t q = queued[g] + queued[h];
+            g = groups.unite(g, h);
+            queued[g] = q;
+            active[a]--;
+            changed = true;
+        }
+        if (--queued[g] == 0) {
+            active[a]--;
+            changed = true;
+        }
+        if (changed && active[a] <= num_parts[a] && settle(a)) {
+            settled[a] = 1;
+            pending--;
+        }
+        if (explored.size() > budget) {
+            resegment = true;
+            return SM_OK;
+        }
+    }
+
+    // The open piece of each component, if one is left
+    for (size_t e = 0; e < explored.size(); e++) {
+        size_t g = groups.find(group_of(explored[e]));
+        if (queued[g] && settled[group_comp[g]])
+            affected[group_comp[g]].open_group = g;
+    }
+
+    // Statistics of the explored pieces
+    std::vector<sm_region> piece(groups.parent.size(), EMPTY);
+    for (size_t e = 0; e < explored.size(); e++) {
+        size_t i = explored[e], g = groups.find(group_of(i));
+        uint64_t x = i % width, y = i / width;
+        sm_region r = { i, 1, pixels[i], x, y, x, y };
+        absorb(piece[g], r);
+    }
+
+    // What the explored pieces took from each component with an open piece,
+    // and where the flood of that piece would start
+    std::vector<sm_region> taken(affected.size(), EMPTY);
+    for (size_t g = 0; g < piece.size(); g++) {
+        size_t a = group_comp[g];
+        if (groups.find(g) == g && affected[a].open_group != NONE && affected[a].open_group != g)
+            absorb(taken[a], piece[g]);
+    }
+    std::vector<std::vector<size_t>> open_pixels(affected.size());
+    for (size_t e = 0; e < explored.size(); e++) {
+        size_t g = groups.find(group_of(explored[e])), a = group_comp[g];
+        if (affected[a].open_group == g)
+            open_pixels[a].push_back(explored[e]);
+    }
+
+    // An open piece inherits the rest of its component's statistics when
+    // that is exact; otherwise it is flooded in full like the others
+    for (size_t a = 0; a < affected.size(); a++) {
+        Affected &comp = affected[a];
+        size_t g = comp.open_group;
+        if (g == NONE)
+            continue;
+        uint64_t first = comp.old.label;
+        size_t first_owner = owner.get(first);
+        bool first_gone = first_owner < num_cells ||
+                          (first_owner != NONE && groups.find(first_owner - num_cells) != g);
+        uint64_t count = comp.old.pixel_count - comp.edit_count - taken[a].pixel_count;
+        uint64_t sum = comp.old.intensity_sum - comp.edit_sum - taken[a].intensity_sum;
+        bool box_gone = comp.edit_on_box || taken[a].min_x == comp.old.min_x || taken[a].max_x == comp.old.max_x ||
+                        taken[a].min_y == comp.old.min_y || taken[a].max_y == comp.old.max_y;
+        if (old_pixels && !first_gone && !box_gone) {
+            piece[g] = { first, count, sum, comp.old.min_x, comp.old.min_y, comp.old.max_x, comp.old.max_y };
+            continue;
+        }
+        if (explored.size() + count > budget) {
+            resegment = true;
+            return SM_OK;
+        }
+        std::vector<size_t> &stack = open_pixels[a];
+        while (!stack.empty()) {
+            size_t i = stack.back();
+            stack.pop_back();
+            int x = (int)(i % width), y = (int)(i / width);
+            for (int d = 0; d < neighbours; d++) {
+                int nx = x + DX[d], ny = y + DY[d];
+                if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                    continue;
+                size_t j = (size_t)ny * width + nx;
+                if (labels[j] != labels[i] || !similar(pixels[i], pixels[j]) || owner.get(j) != NONE)
+                    continue;
+                owner.set(j, num_cells + g);
+                explored.push_back(j);
+                stack.push_back(j);
+                sm_region r = { j, 1, pixels[j], (uint64_t)nx, (uint64_t)ny, (uint64_t)nx, (uint64_t)ny };
+                absorb(piece[g], r);
+            }
+        }
+        comp.open_group = NONE;
+    }
+
+    // Union-find over the edit's cells, then one node per piece and per
+    // unaffected neighbour reached through a similar edge
+    Forest forest;
+    forest.parent.resize(cells.size());
+    for (size_t c = 0; c < cells.size(); c++)
+        forest.parent[c] = c;
+    std::vector<size_t> piece_node(piece.size(), NONE);
+    for (size_t g = 0; g < piece.size(); g++)
+        if (groups.find(g) == g)
+            piece_node[g] = forest.add();
+    std::vector<sm_region> outside;         // copies, as the table may move
+    std::vector<size_t> outside_seed;       // one pixel of each, for relabelling
+    std::unordered_map<uint64_t, size_t> outside_node;
+    size_t first_outside = forest.parent.size();
+
+    for (size_t c = 0; c < cells.size(); c++) {
+        size_t i = cells[c];
+        int x = (int)(i % width), y = (int)(i / width);
+        for (int d = 0; d < neighbours; d++) {
+            int nx = x + DX[d], ny = y + DY[d];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                continue;
+            size_t j = (size_t)ny * width + nx;
+            if (!similar(pixels[i], pixels[j]))
+                continue;
+            size_t node, v = owner.get(j);
+            if (v < num_cells) {
+                node = v;
+            } else if (v != NONE) {
+                node = piece_node[groups.find(v - num_cells)];
+            } else {
+                auto it = outside_node.find(labels[j]);
+                if (it != outside_node.end()) {
+                    node = it->second;
+                } else {
+                    const sm_region *r = find_region(result, labels[j]);
+                    if (!r)
+                        return SM_ERR_ARGS;
+                    node = forest.add();
+                    outside.push_back(*r);
+                    outside_seed.push_back(j);
+                    outside_node.emplace(labels[j], node);
+                }
+            }
+            forest.unite(c, node);
+        }
+    }
+
+    // Statistics per resulting component
+    std::vector<size_t> slot(forest.parent.size(), NONE);
+    std::vector<sm_region> added;
+    auto add_to = [&](size_t node, const sm_region &r) {
+        size_t root = forest.find(node);
+        if (slot[root] == NONE) {
+            slot[root] = added.size();
+            added.push_back(EMPTY);
+        }
+        slot[node] = slot[root];
+        absorb(added[slot[root]], r);
+    };
+    for (size_t c = 0; c < cells.size(); c++) {
+        size_t i = cells[c];
+        uint64_t x = i % width, y = i / width;
+        sm_region r = { i, 1, pixels[i], x, y, x, y };
+        add_to(c, r);
+    }
+    for (size_t g = 0; g < piece.size(); g++)
+        if (piece_node[g] != NONE)
+            add_to(piece_node[g], piece[g]);
+    for (size_t k = 0; k < outside.size(); k++)
+        add_to(first_outside + k, outside[k]);
+
+    // Floods that relabel the open pieces and neighbours whose label changes
+    size_t work = cells.size() + explored.size();
+    for (size_t a = 0; a < affected.size(); a++) {
+        size_t g = affected[a].open_group;
+        if (g != NONE && added[slot[piece_node[g]]].label != piece[g].label)
+            work += piece[g].pixel_count;
+    }
+    for (size_t k = 0; k < outside.size(); k++)
+        if (added[slot[first_outside + k]].label != outside[k].label)
+            work += outside[k].pixel_count;
+    if (work > budget) {
+        resegment = true;
+        return SM_OK;
+    }
+
+    // Every old region that was affected or absorbed is replaced by one per
+    // resulting component. Only the table entries between the first and the
+    // last of these labels are rewritten, merged into a side buffer; the
+    // entries past them shift as one block when the count changed. All
+    // allocation happens before any label changes, so a failure leaves the
+    // previous result intact.
+    std::vector<uint64_t> removed(labels_hit);
+    for (size_t k = 0; k < outside.size(); k++)
+        removed.push_back(outside[k].label);
+    std::sort(removed.begin(), removed.end());
+    std::vector<sm_region> sorted(added);
+    std::sort(sorted.begin(), sorted.end(), [](const sm_region &a, const sm_region &b) { return a.label < b.label; });
+    sm_region *regions = result->regions;
+    size_t n = result->num_regions, count = n - removed.size() + added.size();
+    size_t lo = std::lower_bound(regions, regions + n, std::min(removed.front(), sorted.front().label), label_less) - regions;
+    size_t hi = std::lower_bound(regions, regions + n, std::max(removed.back(), sorted.back().label) + 1, label_less) - regions;
+    std::vector<sm_region> window;
+    window.reserve(hi - lo - removed.size() + added.size());
+    for (size_t i = lo, k = 0, a = 0; i < hi || a < sorted.size();) {
+        if (a < sorted.size() && (i == hi || sorted[a].label < regions[i].label)) {
+            window.push_back(sorted[a++]);
+            continue;
+        }
+        while (k < removed.size() && removed[k] < regions[i].label)
+            k++;
+        if (k == removed.size() || removed[k] != regions[i].label)
+            window.push_back(regions[i]);
+        i++;
+    }
+    std::vector<size_t> stack;
+    if (count > n) {
+        regions = (sm_region *)realloc(regions, count * sizeof(sm_region));
+        if (!regions)
+            return SM_ERR_NOMEM;
+        result->regions = regions;
+    }
+
+    // Open pieces and neighbours first, while their old labels still mark
+    // exactly their own pixels outside the edit
+    auto relabel = [&](size_t seed, Label from, Label to) {
+        stack.assign(1, seed);
+        while (!stack.empty()) {
+            size_t i = stack.back();
+            stack.pop_back();
+            int x = (int)(i % width), y = (int)(i / width);
+            if (labels[i] != from || in_edit(x, y))
+                continue;
+            labels[i] = to;
+            for (int d = 0; d < neighbours; d++) {
+                int nx = x + DX[d], ny = y + DY[d];
+                if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                    continue;
+                size_t j = (size_t)ny * width + nx;
+                if (labels[j] == from && similar(pixels[i], pixels[j]))
+                    stack.push_back(j);
+            }
+        }
+    };
+    for (size_t e = 0; e < explored.size(); e++) {
+        size_t g = groups.find(group_of(explored[e]));
+        size_t a = group_comp[g];
+        if (affected[a].open_group != g)
+            continue;
+        uint64_t to = added[slot[piece_node[g]]].label;
+        if (to != affected[a].old.label)
+            relabel(explored[e], (Label)affected[a].old.label, (Label)to);
+        affected[a].open_group = NONE;      // done
+    }
+    for (size_t k = 0; k < outside.size(); k++) {
+        uint64_t to = added[slot[first_outside + k]].label;
+        if (to != outside[k].label)
+            relabel(outside_seed[k], (Label)outside[k].label, (Label)to);
+    }
+    for (size_t e = 0; e < explored.size(); e++) {
+        size_t g = groups.find(group_of(explored[e]));
+        labels[explored[e]] = (Label)added[slot[piece_node[g]]].label;
+    }
+    for (size_t c = 0; c < cells.size(); c++)
+        labels[cells[c]] = (Label)added[slot[c]].label;
+
+    memmove(regions + lo + window.size(), regions + hi, (n - hi) * sizeof(sm_region));
+    memcpy(regions + lo, window.data(), window.size() * sizeof(sm_region));
+    result->num_regions = count;
+    return SM_OK;
+}
+
+}
+
+struct sm_update_state {
+    size_t pixels;
+    uint64_t generation;
+    uint64_t *marks;
+};
+
+void update_state_free(sm_update_state *state) {
+    if (state)
+        free(state->marks);
+    free(state);
+}
+
+// A fresh generation of result's pixel index, allocated on first use and
+// whenever the image size changed
+static int begin_update(sm_result *result, size_t pixels, PixelIndex &index) {
+    sm_update_state *state = result->update_state;
+    if (state && state->pixels != pixels) {
+        update_state_free(state);
+        state = result->update_state = NULL;
+    }
+    if (!state) {
+        state = (sm_update_state *)calloc(1, sizeof(sm_update_state));
+        if (!state)
+            return SM_ERR_NOMEM;
+        state->marks = (uint64_t *)calloc(pixels, sizeof(uint64_t));
+        if (!state->marks) {
+            free(state);
+            return SM_ERR_NOMEM;
+        }
+        state->pixels = pixels;
+        result->update_state = state;
+    }
+    if (++state->generation >> (64 - GENERATION_SHIFT)) {
+        memset(state->marks, 0, pixels * sizeof(uint64_t));
+        state->generation = 1;
+    }
+    index.marks = state->marks;
+    index.stamp = state->generation << GENERATION_SHIFT;
+    return SM_OK;
+}
+
+int sm_update_rects(const Image *img, const Image *before, const sm_params *params, sm_result *result,
+                    const sm_rect *rects, int count) {
+    if (!img || !img->data || !params || !result || !result->labels || !result->regions || !result->owns_regions ||
+        result->width != img->width || result->height != img->height ||
+        (before && (!before->data || before->width != img->width || before->height != img->height ||
+                    IMAGE_PIXEL_BYTES(before) != IMAGE_PIXEL_BYTES(img))) ||
+        (params->connectivity != 4 && params->connectivity != 8) || count < 0 || (count > 0 && !rects))
+        return SM_ERR_ARGS;
+    result->resegmented = 0;
+    std::vector<Rect> edit;
+    for (int k = 0; k < count; k++) {
+        const sm_rect &r = rects[k];
+        if (r.width <= 0 || r.height <= 0)
+            continue;
+        // In 64 bits, as x + width may not fit an int
+        int64_t x1 = std::min((int64_t)r.x + r.width, (int64_t)img->width) - 1;
+        int64_t y1 = std::min((int64_t)r.y + r.height, (int64_t)img->height) - 1;
+        Rect clipped = { std::max(r.x, 0), std::max(r.y, 0), (int)x1, (int)y1 };
+        if (clipped.x0 <= clipped.x1 && clipped.y0 <= clipped.y1)
+            edit.push_back(clipped);
+    }
+    if (edit.empty())
+        return SM_OK;
+
+    sm_mark start = sm_metrics_start(params->metrics);
+    PixelIndex index;
+    int err = begin_update(result, (size_t)img->width * img->height, index);
+    if (err != SM_OK)
+        return err;
+    bool resegment = false;
+    try {
+        bool wide = IMAGE_PIXEL_BYTES(img) == 2;
+        if (result->label_bytes == 8)
+            err = wide ? update<uint16_t, uint64_t>(img, before, params, result, edit, index, resegment)
+                       : update<uint8_t, uint64_t>(img, before, params, result, edit, index, resegment);
+        else if (result->label_bytes == 4)
+            err = wide ? update<uint16_t, uint32_t>(img, before, params, result, edit, index, resegment)
+                       : update<uint8_t, uint32_t>(img, before, params, result, edit, index, resegment);
+        else
+            err = wide ? update<uint16_t, uint16_t>(img, before, params, result, edit, index, resegment)
+                       : update<uint8_t, uint16_t>(img, before, params, result, edit, index, resegment);
+    } catch (const std::bad_alloc &) {
+        err = SM_ERR_NOMEM;
+    }
+    sm_metrics_stop(params->metrics, SM_PHASE_UPDATE, start);
+    if (err == SM_OK && resegment) {
+        sm_params full = *params;
+        full.region_stats = 1;
+        err = sm_segment(img, &full, result);
+        result->resegmented = 1;
+    }
+    return err;
+}
+
+int sm_update(const Image *img, const sm_params *params, sm_result *result, int x, int y, int width, int height) {
+    sm_rect rect = { x, y, width, height };
+    return sm_update_rects(img, NULL, params, result, &rect, 1);
+}
@@ -10,7 +10,7 @@
 #define BLOCK_SIZE 16  // CUDA block size
 
 // Kernel: Initialize labels (each pixel gets its own label)
-__global__ void init_labels(uint8_t *img, int *labels, int width, int height) {
+__global__ void init_labels(int *labels, int width, int height) {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
 
@@ -20,7 +20,9 @@ __global__ void init_labels(uint8_t *img, int *labels, int width, int height) {
 }
 
 // Kernel: Merge neighboring pixels based on intensity difference
-__global__ void merge_labels(uint8_t *img, int *labels, int width, int height, int *changed) {
+// (Pixel is uint8_t or uint16_t)
+template <class Pixel>
+__global__ void merge_labels(const Pixel *img, int *labels, int width, int height, int *changed) {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
 
@@ -29,7 +31,7 @@ __global__ void merge_labels(uint8_t *img, int *labels, int width, int height, i
         int right = idx + 1;
         int down = idx + width;
 
-        if (abs(img[idx] - img[right]) < DIFF_THRESHOLD) {
+        if (abs((int)img[idx] - (int)img[right]) < DIFF_THRESHOLD) {
             int min_label = min(labels[idx], labels[right]);
             if (labels[right] != min_label) {
                 labels[right] = min_label;
@@ -41,7 +43,7 @@ __global__ void merge_labels(uint8_t *img, int *labels, int width, int height, i
             }
         }
 
-        if (abs(img[idx] - img[down]) < DIFF_THRESHOLD) {
+        if (abs((int)img[idx] - (int)img[down]) < DIFF_THRESHOLD) {
             int min_label = min(labels[idx], labels[down]);
             if (labels[down] != min_label) {
                 labels[down] = min_label;
@@ -55,54 +57,70 @@ __global__ void merge_labels(uint8_t *img, int *labels, int width, int height, i
     }
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s input.pgm output.pgm\n", argv[0]);
-        return -1;
-    }
-
-    Image *img = read_pgm(argv[1]);
+// Run the sweeps on the device and copy the final labels back
+template <class Pixel>
+void segment_on_device(const Image *img, int *labels) {
     int size = img->width * img->height;
 
-    uint8_t *d_img;
+    Pixel *d_img;
     int *d_labels, *d_changed;
     int changed;
 
-    cudaMalloc(&d_img, size * sizeof(uint8_t));
+    cudaMalloc(&d_img, size * sizeof(Pixel));
     cudaMalloc(&d_labels, size * sizeof(int));
     cudaMalloc(&d_changed, sizeof(int));
 
-    cudaMemcpy(d_img, img->data, size * sizeof(uint8_t), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_img, img->data, size * sizeof(Pixel), cudaMemcpyHostToDevice);
 
     dim3 block(BLOCK_SIZE, BLOCK_SIZE);
     dim3 grid((img->width + BLOCK_SIZE - 1) / BLOCK_SIZE, (img->height + BLOCK_SIZE - 1) / BLOCK_SIZE);
 
-    init_labels<<<grid, block>>>(d_img, d_labels, img->width, img->height);
+    init_labels<<<grid, block>>>(d_labels, img->width, img->height);
     cudaDeviceSynchronize();
 
     do {
         changed = 0;
         cudaMemcpy(d_changed, &changed, sizeof(int), cudaMemcpyHostToDevice);
 
-        merge_labels<<<grid, block>>>(d_img, d_labels, img->width, img->height, d_changed);
+        merge_labels<Pixel><<<grid, block>>>(d_img, d_labels, img->width, img->height, d_changed);
         cudaDeviceSynchronize();
 
         cudaMemcpy(&changed, d_changed, sizeof(int), cudaMemcpyDeviceToHost);
     } while (changed);
 
-    int *labels = (int*)malloc(size * sizeof(int));
     cudaMemcpy(labels, d_labels, size * sizeof(int), cudaMemcpyDeviceToHost);
 
+    cudaFree(d_img);
+    cudaFree(d_labels);
+    cudaFree(d_changed);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s input.pgm output.pgm [labels.npy]\n", argv[0]);
+        return -1;
+    }
+
+    Image *img = read_pgm(argv[1]);
+    int size = img->width * img->height;
+
+    int *labels = (int*)malloc(size * sizeof(int));
+    if (IMAGE_PIXEL_BYTES(img) == 2)
+        segment_on_device<uint16_t>(img, labels);
+    else
+        segment_on_device<uint8_t>(img, labels);
+
+    if (argc == 4)
+        write_label_map(argv[3], labels, img->width, img->height, sizeof(int));
+
     for (int i = 0; i < size; i++) {
         img->data[i] = labels[i] % 1024;
     }
+    img->maxval = 255;
 
     write_pgm(argv[2], img);
 
     free(labels);
     free_image(img);
-    cudaFree(d_img);
-    cudaFree(d_labels);
-    cudaFree(d_changed);
     return 0;
 }
@@ -1,61 +1,211 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <math.h>
 #include <mpi.h>
 #include "../common/image_io.h"
-
+#include "../common/edge_mask.h"
+#include "../common/buffer_pool.h"
+#include "../common/cli.h"
+
+// Runs per RLE message (at least one row's worth), and its message tag
+#define RLE_CHUNK_RUNS (1 << 18)
+#define RLE_TAG 1
+// Bytes per trace message, and its tag
+#define TRACE_CHUNK_BYTES (1 << 30)
+#define TRACE_TAG 2
+
+// Default threshold for 8-bit samples; wider samples scale it by their range
 #define DIFF_THRESHOLD 10
 
-// Exchange top and bottom halo rows with neighbors
-void exchange_boundaries(int *labels, int width, int height_per_proc, int rank, int size, MPI_Comm comm) {
+// The engine is this driver's own and the label width is fixed at build
+// time, so --engine, --label-bytes and --telemetry are not accepted
+#define OPTIONS (CLI_CONNECTIVITY | CLI_THRESHOLD | CLI_LABELS | CLI_RLE | CLI_STATS | CLI_METRICS | \
+                 CLI_COUNTERS | CLI_TRACE)
+
+// Labels are global linear pixel indices. uint32_t covers images of up to
+// 2^32 pixels; build with -DSM_LABELS64 (make dist_mem_cpu LABELS64=1) for
+// larger ones.
+#ifdef SM_LABELS64
+typedef uint64_t label_t;
+#define MPI_LABEL MPI_UINT64_T
+#else
+typedef uint32_t label_t;
+#define MPI_LABEL MPI_UINT32_T
+#endif
+
+// Exchange top and bottom halo rows with neighbors. Whole rows are sent, so
+// the diagonal corner neighbours of each boundary pixel travel with them.
+void exchange_boundaries(label_t *labels, int width, int height_per_proc, int rank, int size, MPI_Comm comm) {
     MPI_Status status;
 
     // Send top row and receive into halo above
     if (rank != 0) {
-        MPI_Sendrecv(labels + width, width, MPI_INT, rank - 1, 0,
-                     labels,        width, MPI_INT, rank - 1, 0, comm, &status);
+        MPI_Sendrecv(labels + width, width, MPI_LABEL, rank - 1, 0,
+                     labels,        width, MPI_LABEL, rank - 1, 0, comm, &status);
     }
 
     // Send bottom row and receive into halo below
     if (rank != size - 1) {
-        MPI_Sendrecv(labels + height_per_proc * width, width, MPI_INT, rank + 1, 0,
-                     labels + (height_per_proc + 1) * width, width, MPI_INT, rank + 1, 0, comm, &status);
+        MPI_Sendrecv(labels + (size_t)height_per_proc * width, width, MPI_LABEL, rank + 1, 0,
+                     labels + (size_t)(height_per_proc + 1) * width, width, MPI_LABEL, rank + 1, 0,
+                     comm, &status);
     }
 }
 
-// Simple merge operation within local chunk
-void merge(const uint8_t *img, int *labels, int width, int height_per_proc) {
-    int merged = 1;
-    while (merged) {
-        merged = 0;
-        for (int y = 1; y <= height_per_proc; y++) {
-            for (int x = 0; x < width - 1; x++) {
-                int idx = y * width + x;
-                int right = idx + 1;
-                int down  = idx + width;
-
-                if (x + 1 < width && labels[idx] != labels[right]) {
-                    if (abs(img[idx] - img[right]) < DIFF_THRESHOLD) {
-                        int old = labels[right], new = labels[idx];
-                        for (int i = 0; i < (height_per_proc + 2) * width; i++)
-                            if (labels[i] == old) labels[i] = new;
-                        merged = 1;
-                    }
-                }
+// Same exchange for the pixel rows; done once so the edge mask can see
+// the neighbouring ranks' boundary pixels. One row is a pixel_row datatype
+// of row_bytes, so 8- and 16-bit images share the code.
+void exchange_pixel_halos(uint8_t *img, size_t row_bytes, MPI_Datatype pixel_row, int height_per_proc,
+                          int rank, int size, MPI_Comm comm) {
+    MPI_Status status;
 
-                if (y < height_per_proc + 1 && labels[idx] != labels[down]) {
-                    if (abs(img[idx] - img[down]) < DIFF_THRESHOLD) {
-                        int old = labels[down], new = labels[idx];
-                        for (int i = 0; i < (height_per_proc + 2) * width; i++)
-                            if (labels[i] == old) labels[i] = new;
-                        merged = 1;
-                    }
-                }
+    if (rank != 0) {
+        MPI_Sendrecv(img + row_bytes, 1, pixel_row, rank - 1, 0,
+                     img,             1, pixel_row, rank - 1, 0, comm, &status);
+    }
+
+    if (rank != size - 1) {
+        MPI_Sendrecv(img + (size_t)height_per_proc * row_bytes, 1, pixel_row, rank + 1, 0,
+                     img + (size_t)(height_per_proc + 1) * row_bytes, 1, pixel_row, rank + 1, 0,
+                     comm, &status);
+    }
+}
+
+// Union-find root of pixel i. Roots are always the smallest index in their
+// set, so parent[i] <= i.
+static label_t find_root(label_t *parent, label_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static void link_pixels(label_t *parent, label_t a, label_t b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b)
+        parent[b] = a;
+    else if (b < a)
+        parent[a] = b;
+}
+
+// Union every pair of chunk pixels the edge mask joins, halo rows included,
+// then point each pixel straight at its root. The mask never changes, so
+// this is done once and every round reuses the result.
+void link_chunk(const uint8_t *mask, label_t *parent, int width, int first_row, int height_per_proc,
+                sm_metrics *m) {
+    size_t total = (size_t)(height_per_proc + 2) * width;
+    sm_mark start = sm_metrics_start(m);
+    for (size_t i = 0; i < total; i++)
+        parent[i] = (label_t)i;
+    for (int y = first_row; y <= height_per_proc; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t idx = (size_t)y * width + x;
+            uint8_t e = mask[idx];
+            if (!e)
+                continue;
+
+            if (e & EDGE_RIGHT)
+                link_pixels(parent, idx, idx + 1);
+            if (e & EDGE_DOWN)
+                link_pixels(parent, idx, idx + width);
+            if (e & EDGE_DOWN_RIGHT)
+                link_pixels(parent, idx, idx + width + 1);
+            if (e & EDGE_DOWN_LEFT)
+                link_pixels(parent, idx, idx + width - 1);
+        }
+    }
+    sm_metrics_stop(m, SM_PHASE_LINK, start);
+
+    // Parents precede their children, so one ascending pass flattens
+    start = sm_metrics_start(m);
+    for (size_t i = 0; i < total; i++)
+        parent[i] = parent[parent[i]];
+    sm_metrics_stop(m, SM_PHASE_FLATTEN, start);
+}
+
+// One merge pass over the chunk: gather the smallest label of each local
+// component at its root, then copy it to every member. Returns whether any
+// label changed; the pass is timed as a merge call.
+int merge(const label_t *parent, label_t *labels, int width, int height_per_proc, sm_metrics *m) {
+    size_t total = (size_t)(height_per_proc + 2) * width;
+    sm_mark start = sm_metrics_start(m);
+    for (size_t i = 0; i < total; i++) {
+        label_t r = parent[i];
+        if (labels[i] < labels[r])
+            labels[r] = labels[i];
+    }
+    int changed = 0;
+    for (size_t i = 0; i < total; i++) {
+        label_t l = labels[parent[i]];
+        if (labels[i] != l) {
+            labels[i] = l;
+            changed = 1;
+        }
+    }
+    sm_metrics_stop(m, SM_PHASE_MERGE, start);
+    return changed;
+}
+
+// Collect every rank's trace events on rank 0 and write one timeline with
+// a process per rank. Fragment sizes travel as 64-bit counts and the text in
+// pieces of at most TRACE_CHUNK_BYTES, so no MPI count overflows an int.
+static void gather_trace(const char *path, int rank, int size) {
+    char name[32];
+    snprintf(name, sizeof(name), "rank %d", rank);
+    size_t len;
+    char *events = sm_trace_json(rank, name, &len);
+    uint64_t bytes = events ? (uint64_t)len + 1 : 0;
+
+    uint64_t *counts = NULL;
+    char *all = NULL;
+    if (rank == 0)
+        counts = (uint64_t *)malloc(size * sizeof(uint64_t));
+    MPI_Gather(&bytes, 1, MPI_UINT64_T, counts, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        size_t total = 0;
+        for (int r = 0; r < size; r++)
+            total += counts[r];
+        all = (char *)malloc(total > 0 ? total : 1);
+        char *at = all;
+        for (int r = 0; r < size; r++) {
+            for (uint64_t done = 0; done < counts[r];) {
+                int n = counts[r] - done < TRACE_CHUNK_BYTES ? (int)(counts[r] - done) : TRACE_CHUNK_BYTES;
+                if (r == 0)
+                    memcpy(at + done, events + done, n);
+                else
+                    MPI_Recv(at + done, n, MPI_CHAR, r, TRACE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                done += n;
             }
+            at += counts[r];
+        }
+    } else {
+        for (uint64_t done = 0; done < bytes;) {
+            int n = bytes - done < TRACE_CHUNK_BYTES ? (int)(bytes - done) : TRACE_CHUNK_BYTES;
+            MPI_Send(events + done, n, MPI_CHAR, 0, TRACE_TAG, MPI_COMM_WORLD);
+            done += n;
+        }
+    }
+
+    if (rank == 0) {
+        // Each fragment arrives with its terminating NUL
+        char **parts = (char **)malloc(size * sizeof(char *));
+        char *at = all;
+        for (int r = 0; r < size; r++) {
+            parts[r] = counts[r] ? at : NULL;
+            at += counts[r];
         }
+        if (sm_trace_write(path, parts, size) != 0)
+            perror("Error writing trace");
+        free(parts);
+        free(all);
+        free(counts);
     }
+    free(events);
 }
 
 int main(int argc, char *argv[]) {
@@ -65,213 +215,298 @@ int main(int argc, char *argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 3) {
+    cli_options opts;
+    default_options(&opts);
+    opts.params.threshold = -1;     // unset: DIFF_THRESHOLD scaled to the image
+    if (argc < 3 || parse_options(argc, argv, 3, OPTIONS, &opts) != 0) {
         if (rank == 0)
-            printf("Usage: %s input.pgm output.pgm\n", argv[0]);
+            print_usage(argv[0], OPTIONS);
         MPI_Finalize();
         return -1;
     }
 
+    sm_metrics metrics;
+    sm_metrics_init(&metrics, 0);
+    if (opts.counters) {
+        // Only rank 0 warns when the counters are missing
+        if (rank == 0)
+            enable_counters(&metrics);
+        else
+            sm_metrics_enable_counters(&metrics);
+    }
+    sm_metrics *m = opts.metrics || opts.trace_path ? &metrics : NULL;
+    if (opts.trace_path) {
+        // Every rank leaves the barrier at nearly the same moment; taking
+        // that as each rank's clock origin lines the timelines up
+        start_trace(&opts);
+        MPI_Barrier(MPI_COMM_WORLD);
+        sm_trace_set_origin(sm_metrics_now());
+    }
+
     Image *img = NULL;
-    int width = 0, total_height = 0;
+    int width = 0, total_height = 0, maxval = 0;
 
     if (rank == 0) {
+        sm_mark start = sm_metrics_start(m);
         img = read_pgm(argv[1]);
+        sm_metrics_stop(m, SM_PHASE_READ, start);
         width = img->width;
         total_height = img->height;
+        maxval = img->maxval;
     }
 
-    // Broadcast width and height to all ranks
+    // Broadcast width, height and pixel depth to all ranks
     MPI_Bcast(&width, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&total_height, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&maxval, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (opts.params.threshold < 0)
+        opts.params.threshold = maxval > 255 ? (int)((long)DIFF_THRESHOLD * (maxval + 1) / 256) : DIFF_THRESHOLD;
 
-    int height_per_proc = total_height / size;
+    if ((uint64_t)width * total_height - 1 > (label_t)-1) {
+        if (rank == 0)
+            fprintf(stderr, "%dx%d needs 64-bit labels; rebuild with make dist_mem_cpu LABELS64=1\n",
+                    width, total_height);
+        MPI_Finalize();
+        return -1;
+    }
 
-    // Allocate local image chunk and scatter
-    uint8_t *local_data = (uint8_t *)malloc(width * height_per_proc * sizeof(uint8_t));
-    MPI_Scatter(img ? img->data : NULL, width * height_per_proc, MPI_UINT8_T,
-                local_data, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
+    if (total_height < size) {
+        if (rank == 0)
+            fprintf(stderr, "%d ranks for %d rows; run at most one rank per row\n", size, total_height);
+        MPI_Finalize();
+        return -1;
+    }
 
-    // Allocate haloed label array (+2 for top/bottom halo rows)
-    int *labels = (int *)malloc((height_per_proc + 2) * width * sizeof(int));
-    for (int y = 0; y < height_per_proc; y++) {
+    // Rank r owns rows_of[r] rows from first_of[r]; the first
+    // total_height % size ranks take one extra row, so no row is dropped
+    int *rows_of = (int *)malloc(size * sizeof(int));
+    int *first_of = (int *)malloc(size * sizeof(int));
+    for (int r = 0; r < size; r++) {
+        rows_of[r] = total_height / size + (r < total_height % size);
+        first_of[r] = r ? first_of[r - 1] + rows_of[r - 1] : 0;
+    }
+    int height_per_proc = rows_of[rank];
+    size_t row0 = first_of[rank];
+    size_t row_bytes = (size_t)width * (maxval > 255 ? 2 : 1);
+
+    // Transfers count whole rows, so no count or displacement exceeds the
+    // image height however many pixels a rank holds
+    MPI_Datatype pixel_row, output_row, label_row;
+    MPI_Type_contiguous(width, maxval > 255 ? MPI_UINT16_T : MPI_UINT8_T, &pixel_row);
+    MPI_Type_contiguous(width, MPI_UINT8_T, &output_row);
+    MPI_Type_contiguous(width, MPI_LABEL, &label_row);
+    MPI_Type_commit(&pixel_row);
+    MPI_Type_commit(&output_row);
+    MPI_Type_commit(&label_row);
+
+    // Allocate haloed local image chunk and scatter into its interior rows
+    sm_mark phase_start = sm_metrics_start(m);
+    size_t local_bytes = (size_t)(height_per_proc + 2) * row_bytes;
+    uint8_t *local_data = (uint8_t *)pool_calloc(local_bytes);
+    MPI_Scatterv(img ? img->data : NULL, rows_of, first_of, pixel_row,
+                 local_data + row_bytes, height_per_proc, pixel_row, 0, MPI_COMM_WORLD);
+    exchange_pixel_halos(local_data, row_bytes, pixel_row, height_per_proc, rank, size, MPI_COMM_WORLD);
+    sm_metrics_stop(m, SM_PHASE_SCATTER, phase_start);
+
+    // --stats times the labeling from here on, all ranks starting together
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    phase_start = sm_metrics_start(m);
+
+    // Build the edge mask over the rows that exist: the top halo only when
+    // there is a rank above (and then only its downward edges count), the
+    // bottom halo only when there is a rank below
+    int first_row = rank != 0 ? 0 : 1;
+    int last_row = rank != size - 1 ? height_per_proc + 1 : height_per_proc;
+    size_t mask_bytes = (size_t)(height_per_proc + 2) * width;
+    uint8_t *mask = (uint8_t *)pool_calloc(mask_bytes);
+    Image chunk = { width, last_row - first_row + 1, maxval, local_data + (size_t)first_row * row_bytes, NULL, 0 };
+    sm_build_edge_mask(&chunk, mask + (size_t)first_row * width, &opts.params);
+    if (first_row == 0)
+        for (int x = 0; x < width; x++)
+            mask[x] &= ~EDGE_RIGHT;
+    sm_metrics_stop(m, SM_PHASE_MASK, phase_start);
+
+    // Allocate haloed label array (+2 for top/bottom halo rows); halo rows
+    // start with the global labels their owners will assign (rank 0's top
+    // halo is never linked, so its wrapped values are never read)
+    phase_start = sm_metrics_start(m);
+    size_t label_bytes = (size_t)(height_per_proc + 2) * width * sizeof(label_t);
+    label_t *labels = (label_t *)pool_alloc(label_bytes);
+    for (int y = 0; y < height_per_proc + 2; y++) {
+        size_t global_row = row0 + y - 1;
         for (int x = 0; x < width; x++) {
-            labels[(y + 1) * width + x] = (rank * height_per_proc + y) * width + x;
+            labels[(size_t)y * width + x] = (label_t)(global_row * width + x);
         }
     }
-
-    // Merge neighboring regions using local info and boundary exchange
-    for (int iter = 0; iter < 5; iter++) {
-        merge(local_data, labels, width, height_per_proc);
+    sm_metrics_stop(m, SM_PHASE_INIT, phase_start);
+
+    // Merge neighboring regions using local info and boundary exchange,
+    // until a round in which no rank changed a label. The chunk's components
+    // are linked once; each round is then one pass that lowers every
+    // component to its smallest label, halo labels included. A round
+    // without changes sends the same boundary rows as the one before, so
+    // every halo then agrees with its owner.
+    label_t *parent = (label_t *)pool_alloc(label_bytes);
+    link_chunk(mask, parent, width, first_row, height_per_proc, m);
+    int passes = 0, changed;
+    do {
+        int local_changed = merge(parent, labels, width, height_per_proc, m);
+        passes++;
+        phase_start = sm_metrics_start(m);
         exchange_boundaries(labels, width, height_per_proc, rank, size, MPI_COMM_WORLD);
+        MPI_Allreduce(&local_changed, &changed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+        sm_metrics_stop(m, SM_PHASE_HALO, phase_start);
+    } while (changed);
+
+    if (opts.stats) {
+        // Slowest rank's time and passes; a region root is a pixel that
+        // still holds its own global index
+        double seconds = MPI_Wtime() - start;
+        unsigned long long roots = 0;
+        for (int y = 1; y <= height_per_proc; y++)
+            for (int x = 0; x < width; x++)
+                roots += labels[(size_t)y * width + x] == (label_t)((row0 + y - 1) * width + x);
+        double max_seconds;
+        int max_passes;
+        unsigned long long total_roots;
+        MPI_Reduce(&seconds, &max_seconds, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&passes, &max_passes, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&roots, &total_roots, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            print_stats(max_seconds, max_passes, (size_t)total_roots);
     }
 
     // Copy final labels back to uint8_t output (strip halos)
-    uint8_t *output_data = (uint8_t *)malloc(width * height_per_proc);
+    phase_start = sm_metrics_start(m);
+    size_t output_bytes = (size_t)width * height_per_proc;
+    uint8_t *output_data = (uint8_t *)pool_alloc(output_bytes);
     for (int y = 0; y < height_per_proc; y++) {
         for (int x = 0; x < width; x++) {
-            output_data[y * width + x] = labels[(y + 1) * width + x] % 256;
+            output_data[(size_t)y * width + x] = labels[(size_t)(y + 1) * width + x] % 256;
         }
     }
+    sm_metrics_stop(m, SM_PHASE_RENDER, phase_start);
 
     // Gather all results back to root
+    phase_start = sm_metrics_start(m);
     if (rank == 0) {
-        uint8_t *full_output = (uint8_t *)malloc(width * total_height);
-        MPI_Gather(output_data, width * height_per_proc, MPI_UINT8_T,
-                   full_output, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
-        img->data = full_output;
+        // Gather straight into the input image buffer; it is no longer needed
+        MPI_Gatherv(output_data, height_per_proc, output_row,
+                    img->data, rows_of, first_of, output_row, 0, MPI_COMM_WORLD);
+        sm_metrics_stop(m, SM_PHASE_GATHER, phase_start);
+        phase_start = sm_metrics_start(m);
+        img->maxval = 255;
         write_pgm(argv[2], img);
         free_image(img);
+        sm_metrics_stop(m, SM_PHASE_WRITE, phase_start);
     } else {
-        MPI_Gather(output_data, width * height_per_proc, MPI_UINT8_T,
-                   NULL, 0, MPI_UINT8_T, 0, MPI_COMM_WORLD);
+        MPI_Gatherv(output_data, height_per_proc, output_row,
+                    NULL, NULL, NULL, output_row, 0, MPI_COMM_WORLD);
+        sm_metrics_stop(m, SM_PHASE_GATHER, phase_start);
     }
 
+    // Full-precision labels: gather the interior rows straight into the
+    // root's mapped output file
+    if (opts.labels_path) {
+        phase_start = sm_metrics_start(m);
+        LabelMap label_map = {0};
+        void *all_labels = NULL;
+        if (rank == 0)
+            all_labels = create_label_map(opts.labels_path, width, total_height, sizeof(label_t), &label_map);
+        MPI_Gatherv(labels + width, height_per_proc, label_row,
+                    all_labels, rows_of, first_of, label_row, 0, MPI_COMM_WORLD);
+        close_label_map(&label_map);
+        sm_metrics_stop(m, SM_PHASE_GATHER, phase_start);
+    }
+
+    // Run-length encoded labels: each rank encodes its own rows into a
+    // fixed chunk of runs and ships it to the root whenever the next row
+    // might not fit, ending with an empty message; the root writes its own
+    // chunks, then each rank's as they arrive, in rank order. Memory stays
+    // at one chunk per rank however many runs the image has.
+    if (opts.rle_path) {
+        phase_start = sm_metrics_start(m);
+        MPI_Datatype run_type;
+        MPI_Type_contiguous(sizeof(LabelRun), MPI_BYTE, &run_type);
+        MPI_Type_commit(&run_type);
+        size_t cap = width > RLE_CHUNK_RUNS ? (size_t)width : RLE_CHUNK_RUNS;
+        LabelRun *runs = (LabelRun *)pool_alloc(cap * sizeof(LabelRun));
+        RleWriter *rle = rank == 0 ? rle_open(opts.rle_path, width, total_height, sizeof(label_t)) : NULL;
+        size_t nruns = 0;
+        for (int y = 0; y <= height_per_proc; y++) {
+            if (y == height_per_proc || nruns + width > cap) {
+                if (rank == 0)
+                    for (size_t i = 0; i < nruns; i++)
+                        rle_write_run(rle, &runs[i]);
+                else if (nruns)
+                    MPI_Send(runs, (int)nruns, run_type, 0, RLE_TAG, MPI_COMM_WORLD);
+                nruns = 0;
+            }
+            if (y < height_per_proc)
+                nruns += rle_encode_row(labels + (size_t)(y + 1) * width, sizeof(label_t), width,
+                                        (int)row0 + y, runs + nruns);
+        }
+        if (rank != 0)
+            MPI_Send(runs, 0, run_type, 0, RLE_TAG, MPI_COMM_WORLD);
+        for (int r = 1; rank == 0 && r < size; r++) {
+            for (;;) {
+                MPI_Status status;
+                int got;
+                MPI_Recv(runs, (int)cap, run_type, r, RLE_TAG, MPI_COMM_WORLD, &status);
+                MPI_Get_count(&status, run_type, &got);
+                if (got == 0)
+                    break;
+                for (int i = 0; i < got; i++)
+                    rle_write_run(rle, &runs[i]);
+            }
+        }
+        if (rle)
+            rle_close(rle);
+        pool_free(runs, cap * sizeof(LabelRun));
+        MPI_Type_free(&run_type);
+        sm_metrics_stop(m, SM_PHASE_GATHER, phase_start);
+    }
+
+    // --metrics: rank 0 collects every rank's phases; the totals are each
+    // phase's slowest rank
+    if (opts.metrics) {
+        sm_phase_times *all = NULL;
+        if (rank == 0)
+            all = (sm_phase_times *)malloc(size * sizeof(sm_phase_times));
+        MPI_Gather(&metrics.phases, sizeof(sm_phase_times), MPI_BYTE,
+                   all, sizeof(sm_phase_times), MPI_BYTE, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            sm_metrics slowest;
+            sm_metrics_init(&slowest, 0);
+            for (int r = 0; r < size; r++) {
+                for (int p = 0; p < SM_PHASE_COUNT; p++) {
+                    if (all[r].seconds[p] > slowest.phases.seconds[p])
+                        slowest.phases.seconds[p] = all[r].seconds[p];
+                    if (all[r].calls[p] > slowest.phases.calls[p])
+                        slowest.phases.calls[p] = all[r].calls[p];
+                }
+            }
+            write_metrics(&opts, "mpi_split_merge", width, total_height, &slowest, all, size);
+            free(all);
+        }
+    }
+    if (opts.trace_path)
+        gather_trace(opts.trace_path, rank, size);
+    sm_metrics_free(&metrics);
+
     // Cleanup
-    free(local_data);
-    free(labels);
-    free(output_data);
+    pool_free(local_data, local_bytes);
+    pool_free(mask, mask_bytes);
+    pool_free(labels, label_bytes);
+    pool_free(parent, label_bytes);
+    pool_free(output_data, output_bytes);
+    MPI_Type_free(&pixel_row);
+    MPI_Type_free(&output_row);
+    MPI_Type_free(&label_row);
+    free(rows_of);
+    free(first_of);
 
     MPI_Finalize();
     return 0;
 }
-
-// #include <stdio.h>
-// #include <stdlib.h>
-// #include <stdint.h>
-// #include <math.h>
-// #include <mpi.h>
-
-// #include "../common/image_io.h"
-
-// #define VAR_THRESHOLD 150
-// #define DIFF_THRESHOLD 5
-
-// // Exchange boundary rows with neighboring processes
-// void exchange_boundaries(int *labels, int width, int height, int rank, int size, MPI_Comm comm) {
-//     MPI_Status status;
-    
-
-
-//     if (rank != 0) {
-//         MPI_Sendrecv(labels + width, width, MPI_INT, rank - 1, 0,
-//             labels,        width, MPI_INT, rank - 1, 0, comm, &status);
-//         // MPI_Sendrecv(labels, width, MPI_INT, rank - 1, 0,
-//         //              labels - width, width, MPI_INT, rank - 1, 0, comm, &status);
-//     }
-
-//     if (rank != size - 1) {
-//         MPI_Sendrecv(labels + height_per_proc * width, width, MPI_INT, rank + 1, 0,
-//             labels + (height_per_proc + 1) * width, width, MPI_INT, rank + 1, 0, comm, &status);
-//         // MPI_Sendrecv(labels + (height - 1) * width, width, MPI_INT, rank + 1, 0,
-//         //              labels + height * width, width, MPI_INT, rank + 1, 0, comm, &status);
-//     }
-// }
-
-// // Simple merge within process region
-// void merge(const Image *img, int *labels, int width, int height) {
-//     int merged = 1;
-//     while (merged) {
-//         merged = 0;
-//         for (int y = 0; y < height - 1; y++) {
-//             for (int x = 0; x < width - 1; x++) {
-//                 int curr = labels[y * width + x];
-//                 int right = labels[y * width + (x + 1)];
-//                 int down  = labels[(y + 1) * width + x];
-
-//                 if (curr != right) {
-//                     uint8_t val1 = img->data[y * width + x];
-//                     uint8_t val2 = img->data[y * width + (x + 1)];
-//                     if (abs(val1 - val2) < DIFF_THRESHOLD) {
-//                         for (int i = 0; i < width * height; i++) {
-//                             if (labels[i] == right) labels[i] = curr;
-//                         }
-//                         merged = 1;
-//                     }
-//                 }
-
-//                 if (curr != down) {
-//                     uint8_t val1 = img->data[y * width + x];
-//                     uint8_t val2 = img->data[(y + 1) * width + x];
-//                     if (abs(val1 - val2) < DIFF_THRESHOLD) {
-//                         for (int i = 0; i < width * height; i++) {
-//                             if (labels[i] == down) labels[i] = curr;
-//                         }
-//                         merged = 1;
-//                     }
-//                 }
-//             }
-//         }
-//     }
-// }
-
-// int main(int argc, char *argv[]) {
-//     int rank, size;
-//     MPI_Init(&argc, &argv);
-//     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-//     MPI_Comm_size(MPI_COMM_WORLD, &size);
-
-//     if (argc != 3) {
-//         if (rank == 0)
-//             printf("Usage: %s input.pgm output.pgm\n", argv[0]);
-//         MPI_Finalize();
-//         return -1;
-//     }
-
-//     Image *img = NULL;
-//     if (rank == 0)
-//         img = read_pgm(argv[1]);
-
-//     int width, total_height;
-//     if (rank == 0) {
-//         width = img->width;
-//         total_height = img->height;
-//     }
-
-//     MPI_Bcast(&width, 1, MPI_INT, 0, MPI_COMM_WORLD);
-//     MPI_Bcast(&total_height, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-//     int height_per_proc = total_height / size;
-
-//     uint8_t *local_data = (uint8_t*)malloc(width * height_per_proc * sizeof(uint8_t));
-//     MPI_Scatter(img ? img->data : NULL, width * height_per_proc, MPI_UINT8_T,
-//                 local_data, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
-
-//     // int *labels = (int*)malloc(width * height_per_proc * sizeof(int));
-//     int *labels = malloc(width * (height_per_proc + 2) * sizeof(int));
-
-//     for (int y = 0; y < height_per_proc; y++) {
-//         for (int x = 0; x < width; x++) {
-//             labels[y * width + x] = y * width + x;
-//         }
-//     }
-
-//     for (int iter = 0; iter < 5; iter++) {
-//         merge((Image*)(&(Image){width, height_per_proc, local_data}), labels, width, height_per_proc);
-//         exchange_boundaries(labels, width, height_per_proc, rank, size, MPI_COMM_WORLD);
-//     }
-
-//     uint8_t *output_data = (uint8_t*)malloc(width * height_per_proc * sizeof(uint8_t));
-//     for (int i = 0; i < width * height_per_proc; i++) {
-//         output_data[i] = labels[i] % 256;
-//     }
-
-//     if (rank == 0) {
-//         uint8_t *full_output = (uint8_t*)malloc(width * total_height * sizeof(uint8_t));
-//         MPI_Gather(output_data, width * height_per_proc, MPI_UINT8_T,
-//                    full_output, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
-//         img->data = full_output;
-//         write_pgm(argv[2], img);
-//         free_image(img);
-//     } else {
-//         MPI_Gather(output_data, width * height_per_proc, MPI_UINT8_T,
-//                    NULL, 0, MPI_UINT8_T, 0, MPI_COMM_WORLD);
-//     }
-
-//     free(local_data);
-//     free(labels);
-//     free(output_data);
-
-//     MPI_Finalize();
-//     return 0;
-// }
@@ -8,27 +8,20 @@
 
 
 extern "C" {
-    void cuda_init_labels(uint8_t **d_img, int **d_labels, int **d_changed, uint8_t *local_data, int width, int height_per_proc);
-    void cuda_merge_labels(int *d_changed, int *changed, uint8_t *d_img, int *d_labels, int *labels, int width, int height_per_proc);
+    void cuda_init_labels(uint8_t **d_img, int **d_labels, int **d_changed, uint8_t *local_data, int width, int height_per_proc, int pixel_bytes);
+    void cuda_merge_labels(int *d_changed, int *changed, uint8_t *d_img, int *d_labels, int *labels, int width, int height_per_proc, int pixel_bytes);
     void cuda_free(uint8_t *d_img, int *d_labels, int *d_changed);
     void cuda_update_labels(int *labels, int *d_labels, int width, int height_per_proc);
 }
 
+// Swap boundary label rows with the neighbouring ranks in place; no
+// staging buffer is needed, so nothing is allocated per iteration
 void exchange_boundaries(int *labels, int width, int height, int rank, int size, MPI_Comm comm) {
     MPI_Status status;
-    int *row = (int*)malloc(width * sizeof(int));
-    if (rank != 0) {
-        memcpy(row, labels, width * sizeof(int));
-        MPI_Sendrecv(row, width, MPI_INT, rank - 1, 0,
-                     row, width, MPI_INT, rank - 1, 0, comm, &status);
-        memcpy(labels, row, width * sizeof(int));
-    }
-    if (rank != size - 1) {
-        memcpy(row, labels + (height-1)*width, width * sizeof(int));
-        MPI_Sendrecv(row, width, MPI_INT, rank + 1, 0,
-                     row, width, MPI_INT, rank + 1, 0, comm, &status);
-        memcpy(labels + (height-1)*width, row, width * sizeof(int));
-    }
+    if (rank != 0)
+        MPI_Sendrecv_replace(labels, width, MPI_INT, rank - 1, 0, rank - 1, 0, comm, &status);
+    if (rank != size - 1)
+        MPI_Sendrecv_replace(labels + (height-1)*width, width, MPI_INT, rank + 1, 0, rank + 1, 0, comm, &status);
 }
 
 int main(int argc, char *argv[]) {
@@ -48,33 +41,38 @@ int main(int argc, char *argv[]) {
     if (rank == 0)
         img = read_pgm(argv[1]);
 
-    int width, total_height;
+    int width, total_height, maxval;
     if (rank == 0) {
         width = img->width;
         total_height = img->height;
+        maxval = img->maxval;
     }
 
     MPI_Bcast(&width, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&total_height, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&maxval, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
     int height_per_proc = total_height / size;
+    int pixel_bytes = maxval > 255 ? 2 : 1;
 
-    uint8_t *local_data = (uint8_t*)malloc(width * height_per_proc * sizeof(uint8_t));
-    MPI_Scatter(img ? img->data : NULL, width * height_per_proc, MPI_UINT8_T,
-                local_data, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
+    size_t local_bytes = (size_t)width * height_per_proc * pixel_bytes;
+    uint8_t *local_data = (uint8_t*)malloc(local_bytes);
+    MPI_Scatter(img ? img->data : NULL, width * height_per_proc * pixel_bytes, MPI_UINT8_T,
+                local_data, width * height_per_proc * pixel_bytes, MPI_UINT8_T, 0, MPI_COMM_WORLD);
 
 
     uint8_t *d_img     = nullptr;
     int     *d_labels  = nullptr;
     int     *d_changed = nullptr;
     int changed;
-    cuda_init_labels(&d_img, &d_labels, &d_changed, local_data, width, height_per_proc);
-    int *labels = (int*)malloc(width * height_per_proc * sizeof(int));
+    cuda_init_labels(&d_img, &d_labels, &d_changed, local_data, width, height_per_proc, pixel_bytes);
+    size_t label_bytes = (size_t)width * height_per_proc * sizeof(int);
+    int *labels = (int*)malloc(label_bytes);
 
     do {
         changed = 0;
 
-        cuda_merge_labels(d_changed, &changed, d_img, d_labels, labels, width, height_per_proc);
+        cuda_merge_labels(d_changed, &changed, d_img, d_labels, labels, width, height_per_proc, pixel_bytes);
 
         MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
 
@@ -84,16 +82,17 @@ int main(int argc, char *argv[]) {
 
     } while (changed);
 
-    uint8_t *output_data = (uint8_t*)malloc(width * height_per_proc * sizeof(uint8_t));
+    size_t output_bytes = (size_t)width * height_per_proc;
+    uint8_t *output_data = (uint8_t*)malloc(output_bytes);
     for (int i = 0; i < width * height_per_proc; i++) {
         output_data[i] = labels[i] % 256;
     }
 
     if (rank == 0) {
-        uint8_t *full_output = (uint8_t*)malloc(width * total_height * sizeof(uint8_t));
+        // Gather straight into the input image buffer; it is no longer needed
         MPI_Gather(output_data, width * height_per_proc, MPI_UINT8_T,
-                   full_output, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
-        img->data = full_output;
+                   img->data, width * height_per_proc, MPI_UINT8_T, 0, MPI_COMM_WORLD);
+        img->maxval = 255;
         write_pgm(argv[2], img);
         free_image(img);
     } else {
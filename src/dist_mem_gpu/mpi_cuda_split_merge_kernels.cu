@@ -12,14 +12,15 @@ __global__ void init_labels(uint8_t *img, int *labels, int width, int height) {
     }
 }
 
-__global__ void merge_labels(uint8_t *img, int *labels, int width, int height, int *changed) {
+template <class Pixel>
+__global__ void merge_labels(const Pixel *img, int *labels, int width, int height, int *changed) {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
     if (x < width - 1 && y < height - 1) {
         int idx = y * width + x;
         int right = idx + 1;
         int down = idx + width;
-        if (abs(img[idx] - img[right]) < DIFF_THRESHOLD) {
+        if (abs((int)img[idx] - (int)img[right]) < DIFF_THRESHOLD) {
             int min_label = min(labels[idx], labels[right]);
             if (labels[right] != min_label) {
                 labels[right] = min_label;
@@ -30,7 +31,7 @@ __global__ void merge_labels(uint8_t *img, int *labels, int width, int height, i
                 *changed = 1;
             }
         }
-        if (abs(img[idx] - img[down]) < DIFF_THRESHOLD) {
+        if (abs((int)img[idx] - (int)img[down]) < DIFF_THRESHOLD) {
             int min_label = min(labels[idx], labels[down]);
             if (labels[down] != min_label) {
                 labels[down] = min_label;
@@ -45,14 +46,15 @@ __global__ void merge_labels(uint8_t *img, int *labels, int width, int height, i
 }
 
 
-extern "C" void cuda_init_labels(uint8_t **d_img, int **d_labels, int **d_changed, uint8_t *local_data, int width, int height_per_proc)
+// d_img holds pixel_bytes (1 or 2) per pixel
+extern "C" void cuda_init_labels(uint8_t **d_img, int **d_labels, int **d_changed, uint8_t *local_data, int width, int height_per_proc, int pixel_bytes)
 {
 
-    cudaMalloc(d_img, width * height_per_proc * sizeof(uint8_t));
+    cudaMalloc(d_img, width * height_per_proc * pixel_bytes);
     cudaMalloc(d_labels, width * height_per_proc * sizeof(int));
     cudaMalloc(d_changed, sizeof(int));
 
-    cudaMemcpy(*d_img, local_data, width * height_per_proc * sizeof(uint8_t), cudaMemcpyHostToDevice);
+    cudaMemcpy(*d_img, local_data, width * height_per_proc * pixel_bytes, cudaMemcpyHostToDevice);
 
     dim3 block(BLOCK_SIZE, BLOCK_SIZE);
     dim3 grid((width + BLOCK_SIZE - 1) / BLOCK_SIZE, (height_per_proc + BLOCK_SIZE - 1) / BLOCK_SIZE);
@@ -61,7 +63,7 @@ extern "C" void cuda_init_labels(uint8_t **d_img, int **d_labels, int **d_change
     cudaDeviceSynchronize();
 }
 
-extern "C" void cuda_merge_labels(int *d_changed, int *changed, uint8_t *d_img, int *d_labels, int *labels, int width, int height_per_proc)
+extern "C" void cuda_merge_labels(int *d_changed, int *changed, uint8_t *d_img, int *d_labels, int *labels, int width, int height_per_proc, int pixel_bytes)
 {
     dim3 block(BLOCK_SIZE, BLOCK_SIZE);
     dim3 grid((width + BLOCK_SIZE - 1) / BLOCK_SIZE, (height_per_proc + BLOCK_SIZE - 1) / BLOCK_SIZE);
@@ -70,7 +72,10 @@ extern "C" void cuda_merge_labels(int *d_changed, int *changed, uint8_t *d_img,
 
     cudaMemcpy(d_changed, changed, sizeof(int), cudaMemcpyHostToDevice);
 
-    merge_labels<<<grid, block>>>(d_img, d_labels, width, height_per_proc, d_changed);
+    if (pixel_bytes == 2)
+        merge_labels<uint16_t><<<grid, block>>>((const uint16_t *)d_img, d_labels, width, height_per_proc, d_changed);
+    else
+        merge_labels<uint8_t><<<grid, block>>>(d_img, d_labels, width, height_per_proc, d_changed);
     cudaDeviceSynchronize();
 
     cudaMemcpy(changed, d_changed, sizeof(int), cudaMemcpyDeviceToHost);
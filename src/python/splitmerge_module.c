@@ -0,0 +1,193 @@
+// Python bindings for libsplitmerge.
+//
+//   labels, regions = splitmerge.segment(image, threshold=4, connectivity=4,
+//                                        engine="union-find")
+//
+// image is any C-contiguous 2-D uint8 or uint16 buffer (e.g. a numpy array)
+// and is read in place. labels (height x width; uint32, or uint64 past 2^32
+// pixels) and regions (num_regions x 7, uint64: label, pixel_count,
+// intensity_sum, min_x, min_y, max_x, max_y) are views over memory owned by
+// the library; they are numpy arrays when numpy is importable and
+// memoryviews otherwise. The GIL is released while segmenting, so several
+// images can be processed from parallel threads.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <string.h>
+
+#include "../common/splitmerge.h"
+
+// Owns one sm_result; freed when the last view onto it goes away
+typedef struct {
+    PyObject_HEAD
+    sm_result result;
+} ResultObject;
+
+static void Result_dealloc(ResultObject *self) {
+    sm_result_release(&self->result);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyTypeObject ResultType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "splitmerge._Result",
+    .tp_basicsize = sizeof(ResultObject),
+    .tp_dealloc = (destructor)Result_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+};
+
+// A 2-D buffer-protocol view into memory kept alive by owner
+typedef struct {
+    PyObject_HEAD
+    PyObject *owner;
+    void *data;
+    const char *format;
+    Py_ssize_t itemsize;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+} ViewObject;
+
+static int View_getbuffer(ViewObject *self, Py_buffer *view, int flags) {
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->shape[0] * self->shape[1] * self->itemsize;
+    view->readonly = 0;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)self->format : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyBufferProcs View_as_buffer = {
+    .bf_getbuffer = (getbufferproc)View_getbuffer,
+};
+
+static void View_dealloc(ViewObject *self) {
+    Py_XDECREF(self->owner);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyTypeObject ViewType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "splitmerge._View",
+    .tp_basicsize = sizeof(ViewObject),
+    .tp_dealloc = (destructor)View_dealloc,
+    .tp_as_buffer = &View_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+};
+
+static PyObject *as_array = NULL;   // numpy.asarray, or memoryview as a fallback
+
+static PyObject *make_view(PyObject *owner, void *data, const char *format, Py_ssize_t itemsize,
+                           Py_ssize_t rows, Py_ssize_t cols) {
+    ViewObject *view = PyObject_New(ViewObject, &ViewType);
+    if (!view)
+        return NULL;
+    Py_INCREF(owner);
+    view->owner = owner;
+    view->data = data;
+    view->format = format;
+    view->itemsize = itemsize;
+    view->shape[0] = rows;
+    view->shape[1] = cols;
+    view->strides[0] = cols * itemsize;
+    view->strides[1] = itemsize;
+
+    PyObject *array = PyObject_CallOneArg(as_array, (PyObject *)view);
+    Py_DECREF(view);
+    return array;
+}
+
+static PyObject *segment(PyObject *module, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = { "image", "threshold", "connectivity", "engine", NULL };
+    PyObject *image;
+    sm_params params;
+    const char *engine = "union-find";
+
+    sm_default_params(&params);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iis", kwlist, &image,
+                                     &params.threshold, &params.connectivity, &engine))
+        return NULL;
+    if (sm_engine_from_name(engine, &params.engine) != SM_OK) {
+        PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engine);
+        return NULL;
+    }
+    params.region_stats = 1;
+
+    Py_buffer buf;
+    if (PyObject_GetBuffer(image, &buf, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+        return NULL;
+    int is_u8 = buf.itemsize == 1 && strcmp(buf.format, "B") == 0;
+    int is_u16 = buf.itemsize == 2 && strcmp(buf.format, "H") == 0;
+    if (buf.ndim != 2 || !(is_u8 || is_u16)) {
+        PyBuffer_Release(&buf);
+        PyErr_SetString(PyExc_TypeError, "image must be a 2-D C-contiguous uint8 or uint16 array");
+        return NULL;
+    }
+
+    ResultObject *owner = PyObject_New(ResultObject, &ResultType);
+    if (!owner) {
+        PyBuffer_Release(&buf);
+        return NULL;
+    }
+    memset(&owner->result, 0, sizeof(owner->result));
+
+    Image img = { (int)buf.shape[1], (int)buf.shape[0], is_u16 ? 65535 : 255, (uint8_t *)buf.buf };
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = sm_segment(&img, &params, &owner->result);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&buf);
+
+    if (err != SM_OK) {
+        Py_DECREF(owner);
+        PyErr_SetString(err == SM_ERR_NOMEM ? PyExc_MemoryError : PyExc_ValueError, sm_strerror(err));
+        return NULL;
+    }
+
+    sm_result *r = &owner->result;
+    PyObject *labels = make_view((PyObject *)owner, r->labels, r->label_bytes == 8 ? "Q" : "I",
+                                 r->label_bytes, r->height, r->width);
+    PyObject *regions = make_view((PyObject *)owner, r->regions, "Q", sizeof(uint64_t),
+                                  (Py_ssize_t)r->num_regions, sizeof(sm_region) / sizeof(uint64_t));
+    Py_DECREF(owner);
+    if (!labels || !regions) {
+        Py_XDECREF(labels);
+        Py_XDECREF(regions);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", labels, regions);
+}
+
+static PyMethodDef methods[] = {
+    { "segment", (PyCFunction)(void (*)(void))segment, METH_VARARGS | METH_KEYWORDS,
+      "segment(image, threshold=4, connectivity=4, engine='union-find') -> (labels, regions)" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT, "splitmerge", "Split/merge image segmentation", -1, methods
+};
+
+PyMODINIT_FUNC PyInit_splitmerge(void) {
+    if (PyType_Ready(&ResultType) < 0 || PyType_Ready(&ViewType) < 0)
+        return NULL;
+
+    PyObject *numpy = PyImport_ImportModule("numpy");
+    if (numpy) {
+        as_array = PyObject_GetAttrString(numpy, "asarray");
+        Py_DECREF(numpy);
+    } else {
+        PyErr_Clear();
+    }
+    if (!as_array) {
+        as_array = (PyObject *)&PyMemoryView_Type;
+        Py_INCREF(as_array);
+    }
+    return PyModule_Create(&module_def);
+}
@@ -1,74 +1,100 @@
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <string.h>
 #include "../common/image_io.h"
-
-#define DIFF_THRESHOLD 4
-
-void init_labels(uint8_t *img, int *labels, int width, int height) {
-    for (int y = 0; y < height; y++)
-        for (int x = 0; x < width; x++)
-            labels[y * width + x] = y * width + x;
-}
-
-int merge_labels(uint8_t *img, int *labels, int width, int height) {
-    int changed = 0;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * width + x;
-            int right = idx + 1;
-            int down = idx + width;
-
-            if (x + 1 < width &&
-                abs(img[idx] - img[right]) < DIFF_THRESHOLD &&
-                labels[idx] != labels[right]) {
-                int min_label = labels[idx] < labels[right] ? labels[idx] : labels[right];
-                labels[idx] = min_label;
-                labels[right] = min_label;
-                changed = 1;
-            }
-
-            if (y + 1 < height &&
-                abs(img[idx] - img[down]) < DIFF_THRESHOLD &&
-                labels[idx] != labels[down]) {
-                int min_label = labels[idx] < labels[down] ? labels[idx] : labels[down];
-                labels[idx] = min_label;
-                labels[down] = min_label;
-                changed = 1;
-            }
-        }
-    }
-    return changed;
-}
+#include "../common/splitmerge.h"
+#include "../common/cli.h"
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s input.pgm output.pgm\n", argv[0]);
+    cli_options opts;
+    default_options(&opts);
+    opts.params.engine = SM_ENGINE_SERIAL;
+    if (argc < 3 || parse_options(argc, argv, 3, CLI_ALL, &opts) != 0) {
+        print_usage(argv[0], CLI_ALL);
         return -1;
     }
 
-    Image *img = read_pgm(argv[1]);
-    int width = img->width;
-    int height = img->height;
-    size_t img_size = width * height;
-
-    int *labels = (int *)malloc(img_size * sizeof(int));
-    init_labels(img->data, labels, width, height);
-
-    while (merge_labels(img->data, labels, width, height));
+    sm_metrics metrics;
+    sm_metrics_init(&metrics, 0);
+    if (opts.counters)
+        enable_counters(&metrics);
+    sm_metrics *m = opts.metrics || opts.trace_path ? &metrics : NULL;
+    start_trace(&opts);
+    opts.params.metrics = m;
 
-    for (int i = 0; i < img_size; i++)
-        img->data[i] = labels[i] % 1024;
+    sm_mark start = sm_metrics_start(m);
+    Image *img = read_pgm(argv[1]);
+    sm_metrics_stop(m, SM_PHASE_READ, start);
+    sm_result result = {0};
+    int label_bytes = sm_label_bytes(img, &opts.params);
+    if (label_bytes < 0) {
+        fprintf(stderr, "Labels of %d bytes cannot hold a %dx%d image\n", opts.params.label_bytes, img->width, img->height);
+        exit(EXIT_FAILURE);
+    }
+    LabelMap label_map = {0};
+    if (opts.labels_path) {
+        // Let the engine write its labels straight into the output file
+        result.labels = create_label_map(opts.labels_path, img->width, img->height, label_bytes, &label_map);
+        result.capacity = (size_t)img->width * img->height * label_bytes;
+    }
+    RleWriter *rle = NULL;
+    if (opts.rle_path) {
+        // Runs are encoded row by row from the final labeling pass
+        rle = rle_open(opts.rle_path, img->width, img->height, label_bytes);
+        opts.params.row_sink = rle_write_row;
+        opts.params.row_sink_ctx = rle;
+    }
+    FILE *telemetry = NULL;
+    if (opts.telemetry_path) {
+        telemetry = sm_sweep_csv_open(opts.telemetry_path);
+        if (!telemetry) {
+            perror("Error opening telemetry file");
+            exit(EXIT_FAILURE);
+        }
+        opts.params.sweep_sink = sm_sweep_csv_write;
+        opts.params.sweep_sink_ctx = telemetry;
+    }
+    double segment_start = cli_seconds();
+    int err = sm_segment(img, &opts.params, &result);
+    if (err != SM_OK) {
+        fprintf(stderr, "Segmentation failed: %s\n", sm_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    if (opts.stats)
+        print_stats(cli_seconds() - segment_start, result.sweeps, result.num_regions);
+
+    start = sm_metrics_start(m);
+    size_t img_size = (size_t)img->width * img->height;
+    if (label_bytes == 8) {
+        const uint64_t *labels = (const uint64_t *)result.labels;
+        for (size_t i = 0; i < img_size; i++)
+            img->data[i] = labels[i] % 1024;
+    } else {
+        const uint32_t *labels = (const uint32_t *)result.labels;
+        for (size_t i = 0; i < img_size; i++)
+            img->data[i] = labels[i] % 1024;
+    }
+    img->maxval = 255;
+    sm_metrics_stop(m, SM_PHASE_RENDER, start);
 
+    start = sm_metrics_start(m);
     write_pgm(argv[2], img);
+    close_label_map(&label_map);
+    if (rle)
+        rle_close(rle);
+    if (telemetry)
+        fclose(telemetry);
+    sm_metrics_stop(m, SM_PHASE_WRITE, start);
+    if (opts.metrics)
+        write_metrics(&opts, "serial_split_merge", img->width, img->height, m, NULL, 0);
+    finish_trace(&opts, "serial_split_merge");
+
     free_image(img);
-    free(labels);
+    sm_result_release(&result);
+    sm_metrics_free(&metrics);
     return 0;
 }
 
-
 // #include <stdio.h>
 // #include <stdlib.h>
 // #include <stdint.h>
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <omp.h>
+#include <vector>
+#include "../common/image_io.h"
+#include "../common/splitmerge.h"
+#include "../common/cli.h"
+#include "../common/buffer_pool.h"
+
+// One line on the thread count, binding and NUMA nodes in use, so a run on a
+// multi-socket node shows whether threads are pinned; with detail, also
+// where each thread runs and so which node its rows will live on
+static void report_affinity(bool detail) {
+    static const char *bind_names[] = { "false", "true", "primary", "close", "spread" };
+    int bind = (int)omp_get_proc_bind();
+    int threads = omp_get_max_threads();
+    unsigned *cpus = (unsigned *)calloc(2 * threads, sizeof(unsigned));
+
+    #pragma omp parallel
+    {
+        unsigned cpu = 0, node = 0;
+        getcpu(&cpu, &node);
+        int t = omp_get_thread_num();
+        cpus[2 * t] = cpu;
+        cpus[2 * t + 1] = node;
+    }
+    int nodes = 0;
+    for (int t = 0; t < threads; t++) {
+        bool seen = false;
+        for (int u = 0; u < t && !seen; u++)
+            seen = cpus[2 * u + 1] == cpus[2 * t + 1];
+        nodes += !seen;
+    }
+    fprintf(stderr, "OpenMP: %d threads on %d NUMA node%s, proc_bind=%s%s\n", threads, nodes,
+            nodes == 1 ? "" : "s", bind >= 0 && bind <= 4 ? bind_names[bind] : "unknown",
+            bind == omp_proc_bind_false ? " (not pinned; set OMP_PROC_BIND=close OMP_PLACES=cores)" : "");
+    if (detail)
+        for (int t = 0; t < threads; t++)
+            fprintf(stderr, "  thread %d: cpu %u, node %u\n", t, cpus[2 * t], cpus[2 * t + 1]);
+    free(cpus);
+}
+
+// --localize: copy the pixels into a pool buffer, each row first touched by
+// the thread the engines' static row schedule gives it, and drop the file
+// mapping (whose pages all sit wherever the reader ran)
+static Image *localize_image(Image *img, size_t *bytes) {
+    size_t row_bytes = (size_t)img->width * IMAGE_PIXEL_BYTES(img);
+    *bytes = row_bytes * img->height;
+    Image *local = (Image *)malloc(sizeof(Image));
+    *local = *img;
+    local->data = (uint8_t *)pool_alloc(*bytes);
+    local->map_base = NULL;
+    local->map_size = 0;
+    if (!local->data) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < img->height; y++)
+        memcpy(local->data + y * row_bytes, img->data + y * row_bytes, row_bytes);
+    free_image(img);
+    return local;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s input.pgm output.pgm [options]\n", prog);
+    printf("  --localize                         copy the pixels so each thread first-touches its rows\n");
+    print_options(CLI_ALL);
+}
+
+int main(int argc, char *argv[]) {
+    cli_options opts;
+    default_options(&opts);
+    opts.params.engine = SM_ENGINE_OPENMP;
+    bool localize = false;
+    std::vector<char *> rest;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--localize") == 0)
+            localize = true;
+        else
+            rest.push_back(argv[i]);
+    }
+    if (argc < 3 || parse_options((int)rest.size(), rest.data(), 0, CLI_ALL, &opts) != 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    // Label, mask and image buffers come from the pool; SM_HUGEPAGES=thp or
+    // hugetlb backs them with huge pages
+    report_affinity(opts.stats);
+
+    sm_metrics metrics;
+    sm_metrics_init(&metrics, omp_get_max_threads());
+    if (opts.counters) {
+        enable_counters(&metrics);
+        // Open every thread's counters now rather than inside the first
+        // timed loop
+        #pragma omp parallel
+        sm_metrics_mark(&metrics);
+    }
+    sm_metrics *m = opts.metrics || opts.trace_path ? &metrics : NULL;
+    start_trace(&opts);
+    opts.params.metrics = m;
+
+    sm_mark start = sm_metrics_start(m);
+    Image *img = read_pgm(argv[1]);
+    sm_metrics_stop(m, SM_PHASE_READ, start);
+    size_t img_bytes = 0;
+    if (localize) {
+        start = sm_metrics_start(m);
+        img = localize_image(img, &img_bytes);
+        sm_metrics_stop(m, SM_PHASE_LOCALIZE, start);
+    }
+    sm_result result = {0};
+    int label_bytes = sm_label_bytes(img, &opts.params);
+    if (label_bytes < 0) {
+        fprintf(stderr, "Labels of %d bytes cannot hold a %dx%d image\n", opts.params.label_bytes, img->width, img->height);
+        exit(EXIT_FAILURE);
+    }
+    LabelMap label_map = {0};
+    if (opts.labels_path) {
+        // Let the engine write its labels straight into the output file
+        result.labels = create_label_map(opts.labels_path, img->width, img->height, label_bytes, &label_map);
+        result.capacity = (size_t)img->width * img->height * label_bytes;
+    }
+    RleWriter *rle = NULL;
+    if (opts.rle_path) {
+        // Runs are encoded row by row from the final labeling pass
+        rle = rle_open(opts.rle_path, img->width, img->height, label_bytes);
+        opts.params.row_sink = rle_write_row;
+        opts.params.row_sink_ctx = rle;
+    }
+    FILE *telemetry = NULL;
+    if (opts.telemetry_path) {
+        telemetry = sm_sweep_csv_open(opts.telemetry_path);
+        if (!telemetry) {
+            perror("Error opening telemetry file");
+            exit(EXIT_FAILURE);
+        }
+        opts.params.sweep_sink = sm_sweep_csv_write;
+        opts.params.sweep_sink_ctx = telemetry;
+    }
+    double segment_start = cli_seconds();
+    int err = sm_segment(img, &opts.params, &result);
+    if (err != SM_OK) {
+        fprintf(stderr, "Segmentation failed: %s\n", sm_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    if (opts.stats)
+        print_stats(cli_seconds() - segment_start, result.sweeps, result.num_regions);
+
+    start = sm_metrics_start(m);
+    size_t img_size = (size_t)img->width * img->height;
+    if (label_bytes == 8) {
+        const uint64_t *labels = (const uint64_t *)result.labels;
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < img_size; i++)
+            img->data[i] = labels[i] % 1024;
+    } else {
+        const uint32_t *labels = (const uint32_t *)result.labels;
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < img_size; i++)
+            img->data[i] = labels[i] % 1024;
+    }
+    img->maxval = 255;
+    sm_metrics_stop(m, SM_PHASE_RENDER, start);
+
+    start = sm_metrics_start(m);
+    write_pgm(argv[2], img);
+    close_label_map(&label_map);
+    if (rle)
+        rle_close(rle);
+    if (telemetry)
+        fclose(telemetry);
+    sm_metrics_stop(m, SM_PHASE_WRITE, start);
+    if (opts.metrics)
+        write_metrics(&opts, "omp_split_merge", img->width, img->height, m, NULL, 0);
+    finish_trace(&opts, "omp_split_merge");
+
+    if (localize) {
+        pool_free(img->data, img_bytes);
+        free(img);
+    } else {
+        free_image(img);
+    }
+    sm_result_release(&result);
+    sm_metrics_free(&metrics);
+    return 0;
+}
+
+// #include <stdio.h>
+// #include <stdlib.h>
+// #include <stdint.h>
+// #include <math.h>
+// #include <omp.h>
+
+// #include "../common/image_io.h"
+
+// #define VAR_THRESHOLD 150
+// #define DIFF_THRESHOLD 10
+
+// typedef struct {
+//     int x, y;
+//     int size;
+// } Region;
+
+// float compute_variance(const Image *img, Region r) {
+//     int sum = 0, sum_sq = 0;
+//     for (int i = r.y; i < r.y + r.size; i++) {
+//         for (int j = r.x; j < r.x + r.size; j++) {
+//             uint8_t val = img->data[i * img->width + j];
+//             sum += val;
+//             sum_sq += val * val;
+//         }
+//     }
+//     int N = r.size * r.size;
+//     float mean = sum / (float)N;
+//     float var = (sum_sq / (float)N) - (mean * mean);
+//     return var;
+// }
+
+// // Parallel Split using OpenMP Tasks
+// void split(const Image *img, int *labels, Region r, int *label_id) {
+//     float var = compute_variance(img, r);
+
+//     if (var <= VAR_THRESHOLD || r.size == 1) {
+//         for (int i = r.y; i < r.y + r.size; i++) {
+//             for (int j = r.x; j < r.x + r.size; j++) {
+//                 labels[i * img->width + j] = *label_id;
+//             }
+//         }
+//         #pragma omp atomic
+//         (*label_id)++;
+//         return;
+//     }
+
+//     int new_size = r.size / 2;
+
+//     #pragma omp task firstprivate(r, new_size) shared(labels, label_id)
+//     split(img, labels, (Region){r.x, r.y, new_size}, label_id);
+
+//     #pragma omp task firstprivate(r, new_size) shared(labels, label_id)
+//     split(img, labels, (Region){r.x + new_size, r.y, new_size}, label_id);
+
+//     #pragma omp task firstprivate(r, new_size) shared(labels, label_id)
+//     split(img, labels, (Region){r.x, r.y + new_size, new_size}, label_id);
+
+//     #pragma omp task firstprivate(r, new_size) shared(labels, label_id)
+//     split(img, labels, (Region){r.x + new_size, r.y + new_size, new_size}, label_id);
+// }
+
+// void merge(const Image *img, int *labels, int width, int height) {
+//     int merged = 1;
+//     while (merged) {
+//         merged = 0;
+//         #pragma omp parallel for collapse(2)
+//         for (int y = 0; y < height - 1; y++) {
+//             for (int x = 0; x < width - 1; x++) {
+//                 int curr = labels[y * width + x];
+//                 int right = labels[y * width + (x + 1)];
+//                 int down  = labels[(y + 1) * width + x];
+
+//                 if (curr != right) {
+//                     uint8_t val1 = img->data[y * width + x];
+//                     uint8_t val2 = img->data[y * width + (x + 1)];
+//                     if (abs(val1 - val2) < DIFF_THRESHOLD) {
+//                         #pragma omp critical
+//                         {
+//                             for (int i = 0; i < width * height; i++) {
+//                                 if (labels[i] == right) labels[i] = curr;
+//                             }
+//                         }
+//                         merged = 1;
+//                     }
+//                 }
+
+//                 if (curr != down) {
+//                     uint8_t val1 = img->data[y * width + x];
+//                     uint8_t val2 = img->data[(y + 1) * width + x];
+//                     if (abs(val1 - val2) < DIFF_THRESHOLD) {
+//                         #pragma omp critical
+//                         {
+//                             for (int i = 0; i < width * height; i++) {
+//                                 if (labels[i] == down) labels[i] = curr;
+//                             }
+//                         }
+//                         merged = 1;
+//                     }
+//                 }
+//             }
+//         }
+//     }
+// }
+
+// int main(int argc, char *argv[]) {
+//     if (argc != 3) {
+//         printf("Usage: %s input.pgm output.pgm\n", argv[0]);
+//         return -1;
+//     }
+
+//     Image *img = read_pgm(argv[1]);
+//     int *labels = (int*)malloc(sizeof(int) * img->width * img->height);
+
+//     int label_id = 1;
+
+//     #pragma omp parallel
+//     {
+//         #pragma omp single
+//         {
+//             split(img, labels, (Region){0, 0, img->width}, &label_id);
+//         }
+//     }
+
+//     merge(img, labels, img->width, img->height);
+
+//     for (int i = 0; i < img->width * img->height; i++) {
+//         img->data[i] = labels[i] % 256;
+//     }
+
+//     write_pgm(argv[2], img);
+//     free(labels);
+//     free_image(img);
+//     return 0;
+// }
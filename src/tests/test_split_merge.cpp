@@ -0,0 +1,794 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include "../common/buffer_pool.h"
+#include "../common/image_io.h"
+#include "../common/splitmerge.h"
+
+// Checks of the library pieces whose output the drivers trust without
+// looking: sm_update and the streaming engine against a fresh sm_segment,
+// the PGM readers, the .npy, RLE and tiled formats round trip and reject
+// corrupt files, the batch driver's outputs, buffer pool reuse, and the
+// validator's verdicts. Run from the repository root (make test), which
+// holds batch_split_merge and validate_split_merge. Exits 1 if any check
+// failed.
+
+static int checks = 0, failures = 0;
+static std::string dir;
+
+static void check(bool ok, const char *what) {
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+static std::string path(const char *name) {
+    return dir + "/" + name;
+}
+
+// Whether fn exits with a failure status (the readers exit on bad input)
+static bool exits_failing(const std::function<void()> &fn) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stderr))
+            _exit(0);
+        fn();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) != 0;
+}
+
+static void patch_file(const std::string &p, long offset, const void *bytes, size_t n) {
+    FILE *fp = fopen(p.c_str(), "r+b");
+    if (!fp || fseek(fp, offset, SEEK_SET) != 0 || fwrite(bytes, 1, n, fp) != n) {
+        perror(p.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+}
+
+static void copy_file(const std::string &from, const std::string &to) {
+    FILE *in = fopen(from.c_str(), "rb"), *out = fopen(to.c_str(), "wb");
+    if (!in || !out) {
+        perror(from.c_str());
+        exit(EXIT_FAILURE);
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+}
+
+static void write_file(const std::string &p, const std::string &bytes) {
+    FILE *fp = fopen(p.c_str(), "wb");
+    if (!fp || fwrite(bytes.data(), 1, bytes.size(), fp) != bytes.size()) {
+        perror(p.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+}
+
+// Whether all three readers (read_pgm, read_pgm_into and the row stream)
+// return expected, laid out as read_pgm stores pixels
+static bool reads_as(const std::string &p, int width, int height, int maxval, const void *expected) {
+    size_t row_bytes = (size_t)width * (maxval > 255 ? 2 : 1), bytes = row_bytes * height;
+    Image *img = read_pgm(p.c_str());
+    bool same = img->width == width && img->height == height && img->maxval == maxval &&
+                memcmp(img->data, expected, bytes) == 0;
+    free_image(img);
+
+    Image into = { 0, 0, 0, NULL, NULL, 0 };
+    size_t capacity = 0;
+    same &= read_pgm_into(p.c_str(), &into, &capacity) == 0 && into.width == width && into.height == height &&
+            into.maxval == maxval && memcmp(into.data, expected, bytes) == 0;
+    pool_free(into.data, capacity);
+
+    FILE *fp = fopen(p.c_str(), "rb");
+    PgmStream *stream = pgm_stream_open(fp);
+    same &= stream && stream->width == width && stream->height == height;
+    std::vector<uint8_t> row(row_bytes);
+    for (int y = 0; same && y < height; y++)
+        same = pgm_stream_read_row(stream, row.data()) &&
+               memcmp(row.data(), (const uint8_t *)expected + y * row_bytes, row_bytes) == 0;
+    if (same)
+        same = !pgm_stream_read_row(stream, row.data());
+    pgm_stream_close(stream);
+    fclose(fp);
+    return same;
+}
+
+static uint64_t label_at(const sm_result *r, size_t i) {
+    if (r->label_bytes == 2)
+        return ((const uint16_t *)r->labels)[i];
+    return r->label_bytes == 8 ? ((const uint64_t *)r->labels)[i] : ((const uint32_t *)r->labels)[i];
+}
+
+// Blocks of a few grey levels plus noise, so edits both split and join
+// regions
+static Image blocky_image(int width, int height, int maxval, std::mt19937 &rng) {
+    Image img = { width, height, maxval, NULL, NULL, 0 };
+    img.data = (uint8_t *)calloc((size_t)width * height, IMAGE_PIXEL_BYTES(&img));
+    int scale = maxval > 255 ? 100 : 1;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            int v = ((x / 7 + y / 5) % 3 * 40 + (int)(rng() % 3)) * scale;
+            if (maxval > 255)
+                ((uint16_t *)img.data)[(size_t)y * width + x] = (uint16_t)v;
+            else
+                img.data[(size_t)y * width + x] = (uint8_t)v;
+        }
+    return img;
+}
+
+static void test_update(int connectivity, int maxval, int label_bytes) {
+    std::mt19937 rng(42 + connectivity);
+    int width = 96, height = 64, scale = maxval > 255 ? 100 : 1;
+    size_t pixel_bytes = maxval > 255 ? 2 : 1, bytes = (size_t)width * height * pixel_bytes;
+    Image img = blocky_image(width, height, maxval, rng);
+    Image before = img;
+    before.data = (uint8_t *)malloc(bytes);
+
+    sm_params params;
+    sm_default_params(&params);
+    params.engine = SM_ENGINE_UNION_FIND;
+    params.connectivity = connectivity;
+    params.threshold = 4 * scale;
+    params.region_stats = 1;
+    params.label_bytes = label_bytes;
+    sm_result result = {0};
+    check(sm_segment(&img, &params, &result) == SM_OK, "sm_segment before the edits");
+
+    char what[128];
+    int incremental = 0;
+    for (int edit = 0; edit < 300; edit++) {
+        memcpy(before.data, img.data, bytes);
+        sm_rect rects[3];
+        int count = 1 + (int)(rng() % 3);
+        for (int k = 0; k < count; k++) {
+            sm_rect &r = rects[k];
+            r.width = 1 + (int)(rng() % 12);
+            r.height = 1 + (int)(rng() % 12);
+            r.x = (int)(rng() % width) - 3;
+            r.y = (int)(rng() % height) - 3;
+            int fill = (int)(rng() % 3) * 40 + (int)(rng() % 3);
+            for (int y = std::max(r.y, 0); y < std::min(r.y + r.height, height); y++)
+                for (int x = std::max(r.x, 0); x < std::min(r.x + r.width, width); x++) {
+                    int v = (rng() % 4 == 0 ? (int)(rng() % 120) : fill) * scale;
+                    if (maxval > 255)
+                        ((uint16_t *)img.data)[(size_t)y * width + x] = (uint16_t)v;
+                    else
+                        img.data[(size_t)y * width + x] = (uint8_t)v;
+                }
+        }
+        int err;
+        if (count == 1 && edit % 2)
+            err = sm_update(&img, &params, &result, rects[0].x, rects[0].y, rects[0].width, rects[0].height);
+        else
+            err = sm_update_rects(&img, edit % 2 ? NULL : &before, &params, &result, rects, count);
+        incremental += !result.resegmented;
+
+        sm_result full = {0};
+        sm_segment(&img, &params, &full);
+        bool same = err == SM_OK && full.num_regions == result.num_regions &&
+                    memcmp(full.regions, result.regions, full.num_regions * sizeof(sm_region)) == 0;
+        for (size_t i = 0; same && i < (size_t)width * height; i++)
+            same = label_at(&full, i) == label_at(&result, i);
+        sm_result_release(&full);
+        snprintf(what, sizeof(what), "sm_update matches sm_segment (%d-connected, maxval %d, edit %d)",
+                 connectivity, maxval, edit);
+        check(same, what);
+        if (!same)
+            break;
+    }
+    snprintf(what, sizeof(what), "sm_update stays incremental for some edits (%d-connected)", connectivity);
+    check(incremental > 0, what);
+    sm_result_release(&result);
+    free(img.data);
+    free(before.data);
+}
+
+// Rectangles whose far edge does not fit an int are clipped, not wrapped
+static void test_update_clip() {
+    std::mt19937 rng(5);
+    int width = 40, height = 30;
+    Image img = blocky_image(width, height, 255, rng);
+    sm_params params;
+    sm_default_params(&params);
+    params.region_stats = 1;
+    sm_result result = {0};
+    sm_segment(&img, &params, &result);
+    for (int y = 0; y < height; y++)
+        for (int x = 20; x < width; x++)
+            img.data[(size_t)y * width + x] = 200;
+    check(sm_update(&img, &params, &result, INT_MAX - 5, 0, 100, height) == SM_OK &&
+              sm_update(&img, &params, &result, 20, INT_MAX - 5, 10, 100) == SM_OK,
+          "sm_update ignores rectangles past INT_MAX");
+    sm_result full = {0};
+    sm_segment(&img, &params, &full);
+    check(full.num_regions != result.num_regions, "sm_update left the image alone");
+    check(sm_update(&img, &params, &result, 20, 0, INT_MAX, INT_MAX) == SM_OK &&
+              full.num_regions == result.num_regions &&
+              memcmp(full.regions, result.regions, full.num_regions * sizeof(sm_region)) == 0,
+          "sm_update clips rectangles reaching past INT_MAX");
+    sm_result_release(&full);
+    sm_result_release(&result);
+    free(img.data);
+}
+
+// A result reused for a larger image grows its own label buffer; a caller's
+// buffer that is too small is an error
+static void test_result_reuse() {
+    std::mt19937 rng(3);
+    Image small = blocky_image(20, 10, 255, rng);
+    Image large = blocky_image(60, 40, 255, rng);
+    sm_params params;
+    sm_default_params(&params);
+    sm_result result = {0}, fresh = {0};
+    check(sm_segment(&small, &params, &result) == SM_OK && sm_segment(&large, &params, &result) == SM_OK &&
+              sm_segment(&large, &params, &fresh) == SM_OK && result.owns_labels &&
+              result.capacity >= (size_t)60 * 40 * 4 &&
+              memcmp(result.labels, fresh.labels, (size_t)60 * 40 * 4) == 0,
+          "sm_segment grows a label buffer it allocated");
+    std::vector<uint32_t> mine(20 * 10);
+    sm_result caller = {0};
+    caller.labels = mine.data();
+    caller.capacity = mine.size() * 4;
+    check(sm_segment(&small, &params, &caller) == SM_OK && sm_segment(&large, &params, &caller) == SM_ERR_BUFFER &&
+              caller.labels == mine.data(),
+          "sm_segment rejects a caller buffer that is too small");
+    sm_result_release(&caller);
+    sm_result_release(&fresh);
+    sm_result_release(&result);
+    free(small.data);
+    free(large.data);
+}
+
+// Comments and any whitespace between header fields, as the PGM spec
+// allows; a short raster is an error rather than garbage pixels
+static void test_pgm_header() {
+    int width = 5, height = 3;
+    std::string raster;
+    for (int i = 0; i < width * height; i++)
+        raster += (char)(i * 17);
+    std::string header = "P5# right after the magic\n#\n\t5\r\n# between fields 7 7\n3   255\n";
+    std::string good = path("comments.pgm"), short_file = path("short.pgm"), bare = path("bare.pgm");
+    write_file(good, header + raster);
+    check(reads_as(good, width, height, 255, raster.data()), "PGM readers skip comments and whitespace");
+    Image *img = read_pgm(good.c_str());
+    check(img->map_base != NULL && img->data == (uint8_t *)img->map_base + header.size(),
+          "read_pgm points 8-bit pixels into the mapping");
+    free_image(img);
+
+    write_file(short_file, header + raster.substr(1));
+    check(exits_failing([&] { read_pgm(short_file.c_str()); }), "read_pgm rejects a truncated raster");
+    check(exits_failing([&] {
+              Image into = { 0, 0, 0, NULL, NULL, 0 };
+              size_t capacity = 0;
+              if (read_pgm_into(short_file.c_str(), &into, &capacity) != 0)
+                  exit(EXIT_FAILURE);
+          }),
+          "read_pgm_into rejects a truncated raster");
+    write_file(bare, "P5 5 3");
+    check(exits_failing([&] { read_pgm(bare.c_str()); }), "read_pgm rejects a truncated header");
+}
+
+// Big-endian samples come out in host order. 13 x 3 samples cover the
+// SSE2 swap's 8-sample blocks and its scalar tail, both checked against
+// the byte-by-byte definition.
+static void test_pgm_16bit() {
+    std::mt19937 rng(13);
+    int width = 13, height = 3, maxval = 65535;
+    std::string bytes = "P5\n13 3\n65535\n";
+    std::vector<uint16_t> expected((size_t)width * height);
+    for (size_t i = 0; i < expected.size(); i++) {
+        uint8_t hi = (uint8_t)rng(), lo = (uint8_t)rng();
+        bytes += (char)hi;
+        bytes += (char)lo;
+        expected[i] = (uint16_t)(hi << 8 | lo);
+    }
+    std::string file = path("wide.pgm");
+    write_file(file, bytes);
+    check(reads_as(file, width, height, maxval, expected.data()), "PGM readers swap 16-bit samples to host order");
+
+    // Samples 300 apart merge at threshold 301 but not at 300, so the
+    // segmentation sees the full 16 bits
+    uint16_t pixels[4] = { 1000, 1300, 1600, 2200 };
+    Image img = { 4, 1, 1000 * 4, (uint8_t *)pixels, NULL, 0 };
+    sm_params params;
+    sm_default_params(&params);
+    sm_result result = {0};
+    params.threshold = 300;
+    check(sm_segment(&img, &params, &result) == SM_OK && result.num_regions == 4,
+          "16-bit samples 300 apart stay apart at threshold 300");
+    params.threshold = 301;
+    check(sm_segment(&img, &params, &result) == SM_OK && result.num_regions == 2,
+          "16-bit samples 300 apart merge at threshold 301");
+    sm_result_release(&result);
+}
+
+// Luminance is (77 R + 150 G + 29 B + 128) >> 8. 37 x 2 pixels cover the
+// SSSE3 kernel's 16-pixel blocks and its scalar tail; the extremes check
+// that the 16-bit lanes do not overflow.
+static void test_ppm() {
+    std::mt19937 rng(17);
+    int width = 37, height = 2;
+    std::string bytes = "P6\n37 2\n255\n";
+    std::vector<uint8_t> expected((size_t)width * height);
+    for (size_t i = 0; i < expected.size(); i++) {
+        uint8_t rgb[3] = { (uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng() };
+        if (i % 16 == 5)
+            rgb[0] = rgb[1] = rgb[2] = 255;
+        bytes.append((const char *)rgb, 3);
+        expected[i] = (uint8_t)((rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29 + 128) >> 8);
+    }
+    std::string file = path("colour.ppm");
+    write_file(file, bytes);
+    check(reads_as(file, width, height, 255, expected.data()), "PPM readers convert 8-bit colour to luminance");
+
+    bytes = "P6\n5 1\n65535\n";
+    std::vector<uint16_t> wide(5);
+    for (size_t i = 0; i < wide.size(); i++) {
+        uint32_t sum = 128;
+        for (int c = 0; c < 3; c++) {
+            uint16_t v = i == 4 ? 65535 : (uint16_t)rng();
+            bytes += (char)(v >> 8);
+            bytes += (char)(v & 0xff);
+            sum += v * (c == 0 ? 77u : c == 1 ? 150u : 29u);
+        }
+        wide[i] = (uint16_t)(sum >> 8);
+    }
+    file = path("colour16.ppm");
+    write_file(file, bytes);
+    check(reads_as(file, 5, 1, 65535, wide.data()), "PPM readers convert 16-bit colour to luminance");
+}
+
+// The .npy layout numpy expects: magic, version 1.0, a dict naming the
+// dtype and C-order shape, data on a 64-byte boundary in little-endian
+static void test_label_map(int label_bytes) {
+    int width = 7, height = 5;
+    size_t n = (size_t)width * height;
+    std::vector<uint64_t> labels64(n);
+    std::vector<uint32_t> labels32(n);
+    std::vector<uint16_t> labels16(n);
+    for (size_t i = 0; i < n; i++) {
+        labels64[i] = (uint64_t)i * 0x100000001ULL;
+        labels32[i] = (uint32_t)(i * 0x01010101u);
+        labels16[i] = (uint16_t)(i * 0x0101u);
+    }
+    const void *labels = label_bytes == 8   ? (const void *)labels64.data()
+                         : label_bytes == 4 ? (const void *)labels32.data()
+                                            : (const void *)labels16.data();
+    std::string file = path("labels.npy");
+    write_label_map(file.c_str(), labels, width, height, label_bytes);
+
+    FILE *fp = fopen(file.c_str(), "rb");
+    std::string bytes;
+    char buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+        bytes.append(buf, got);
+    fclose(fp);
+    size_t header = bytes.size() >= 10 ? 10 + ((uint8_t)bytes[8] | (size_t)(uint8_t)bytes[9] << 8) : 0;
+    std::string dict = header ? bytes.substr(10, header - 10) : "";
+    std::string descr = "'descr': '<u" + std::to_string(label_bytes) + "'";
+    check(bytes.compare(0, 8, "\x93NUMPY\x01\x00", 8) == 0 && header % 64 == 0 && dict.back() == '\n' &&
+              dict.find(descr) != std::string::npos && dict.find("'fortran_order': False") != std::string::npos &&
+              dict.find("'shape': (5, 7)") != std::string::npos,
+          label_bytes == 8   ? "write_label_map writes a <u8 .npy header"
+          : label_bytes == 4 ? "write_label_map writes a <u4 .npy header"
+                             : "write_label_map writes a <u2 .npy header");
+    bool same = bytes.size() == header + n * label_bytes;
+    for (size_t i = 0; same && i < n * label_bytes; i++) {
+        uint64_t v = label_bytes == 8 ? labels64[i / 8] : label_bytes == 4 ? labels32[i / 4] : labels16[i / 2];
+        same = (uint8_t)bytes[header + i] == (uint8_t)(v >> (8 * (i % label_bytes)));
+    }
+    check(same, "write_label_map stores little-endian labels after the header");
+
+    LabelMap map;
+    int w = 0, h = 0;
+    const void *read = open_label_map(file.c_str(), &w, &h, &map);
+    check(w == width && h == height && (int)map.label_bytes == label_bytes &&
+              memcmp(read, labels, n * label_bytes) == 0 && (uintptr_t)read % 64 == 0,
+          "open_label_map round trips the labels");
+    close_label_map(&map);
+}
+
+static void test_rle() {
+    std::mt19937 rng(7);
+    int width = 53, height = 31;
+    Image img = blocky_image(width, height, 255, rng);
+    sm_params params;
+    sm_default_params(&params);
+    std::string file = path("labels.rle");
+    RleWriter *w = rle_open(file.c_str(), width, height, 4);
+    params.row_sink = rle_write_row;
+    params.row_sink_ctx = w;
+    sm_result result = {0};
+    check(sm_segment(&img, &params, &result) == SM_OK, "sm_segment with an RLE row sink");
+    rle_close(w);
+
+    int rw = 0, rh = 0, lb = 0;
+    size_t count = 0;
+    LabelRun *runs = read_rle(file.c_str(), &rw, &rh, &lb, &count);
+    std::vector<uint32_t> decoded((size_t)width * height);
+    rle_decode(runs, count, decoded.data(), lb, width);
+    check(rw == width && rh == height && lb == 4, "read_rle returns the header");
+    check(memcmp(decoded.data(), result.labels, decoded.size() * 4) == 0, "read_rle round trips the labels");
+    free(runs);
+
+    RleReader *r = rle_reader_open(file.c_str());
+    std::vector<uint32_t> row(width);
+    bool same = true;
+    for (int y = 0; y < height; y++) {
+        rle_read_row(r, y, row.data());
+        same &= memcmp(row.data(), (const uint32_t *)result.labels + (size_t)y * width, width * 4) == 0;
+    }
+    rle_reader_close(r);
+    check(same, "rle_read_row round trips the labels");
+
+    // Corruptions: a run that no longer tiles its row, a run count past the
+    // end of the file, and a truncated last record
+    const long header = 32, record = 16;
+    std::string bad = path("bad.rle");
+    copy_file(file, bad);
+    uint32_t length = width + 1;
+    patch_file(bad, header + 8, &length, sizeof(length));
+    check(exits_failing([&] { read_rle(bad.c_str(), &rw, &rh, &lb, &count); }), "read_rle rejects a bad run");
+    check(exits_failing([&] {
+              RleReader *b = rle_reader_open(bad.c_str());
+              rle_read_row(b, 0, row.data());
+          }),
+          "rle_read_row rejects a bad run");
+
+    copy_file(file, bad);
+    uint64_t runs_claimed = count + 1;
+    patch_file(bad, header - 8, &runs_claimed, sizeof(runs_claimed));
+    check(exits_failing([&] { read_rle(bad.c_str(), &rw, &rh, &lb, &count); }), "read_rle rejects a short file");
+    check(exits_failing([&] { rle_reader_open(bad.c_str()); }), "rle_reader_open rejects a short file");
+
+    copy_file(file, bad);
+    check(truncate(bad.c_str(), header + (long)count * record - 4) == 0, "truncate the RLE file");
+    check(exits_failing([&] { read_rle(bad.c_str(), &rw, &rh, &lb, &count); }), "read_rle rejects a truncated file");
+
+    sm_result_release(&result);
+    free(img.data);
+}
+
+// 16-bit labels: the same labeling as 32-bit ones for images of up to 2^16
+// pixels, refused beyond, and carried through the RLE format
+static void test_narrow_labels() {
+    std::mt19937 rng(11);
+    int width = 256, height = 256;
+    Image img = blocky_image(width, height, 255, rng);
+    sm_params params;
+    sm_default_params(&params);
+    sm_result wide = {0}, narrow = {0};
+    sm_segment(&img, &params, &wide);
+    params.label_bytes = 2;
+    std::string file = path("labels16.rle");
+    RleWriter *w = rle_open(file.c_str(), width, height, 2);
+    params.row_sink = rle_write_row;
+    params.row_sink_ctx = w;
+    bool same = sm_segment(&img, &params, &narrow) == SM_OK && narrow.label_bytes == 2 &&
+                narrow.num_regions == wide.num_regions;
+    rle_close(w);
+    for (size_t i = 0; same && i < (size_t)width * height; i++)
+        same = label_at(&narrow, i) == label_at(&wide, i);
+    check(same, "sm_segment with 16-bit labels matches 32-bit labels");
+
+    int rw = 0, rh = 0, lb = 0;
+    size_t count = 0;
+    LabelRun *runs = read_rle(file.c_str(), &rw, &rh, &lb, &count);
+    std::vector<uint16_t> decoded((size_t)width * height);
+    rle_decode(runs, count, decoded.data(), lb, width);
+    check(lb == 2 && memcmp(decoded.data(), narrow.labels, decoded.size() * 2) == 0,
+          "read_rle round trips 16-bit labels");
+    free(runs);
+
+    Image big = { width + 1, height, 255, img.data, NULL, 0 };
+    check(sm_label_bytes(&big, &params) == SM_ERR_ARGS, "16-bit labels are refused past 2^16 pixels");
+    sm_result_release(&narrow);
+    sm_result_release(&wide);
+    free(img.data);
+}
+
+static void collect_region(void *ctx, const sm_region *region) {
+    ((std::vector<sm_region> *)ctx)->push_back(*region);
+}
+
+// Every region emitted by the stream, with the label and statistics
+// sm_segment reports, while holding only the regions near the current row
+static void test_stream(int connectivity, int maxval) {
+    std::mt19937 rng(19 + connectivity);
+    int width = 40, height = 200;
+    Image img = blocky_image(width, height, maxval, rng);
+    sm_params params;
+    sm_default_params(&params);
+    params.connectivity = connectivity;
+    params.threshold = maxval > 255 ? 400 : 4;
+    params.region_stats = 1;
+    sm_result result = {0};
+    sm_segment(&img, &params, &result);
+
+    std::vector<sm_region> emitted;
+    sm_stream *stream = sm_stream_create(width, maxval, &params, collect_region, &emitted);
+    size_t row_bytes = (size_t)width * IMAGE_PIXEL_BYTES(&img);
+    int err = SM_OK;
+    for (int y = 0; y < height && err == SM_OK; y++)
+        err = sm_stream_push_row(stream, img.data + y * row_bytes);
+    if (err == SM_OK)
+        err = sm_stream_finish(stream);
+    size_t peak = sm_stream_peak_regions(stream);
+    sm_stream_destroy(stream);
+    std::sort(emitted.begin(), emitted.end(), [](const sm_region &a, const sm_region &b) { return a.label < b.label; });
+
+    char what[128];
+    snprintf(what, sizeof(what), "stream regions match sm_segment (%d-connected, maxval %d)", connectivity, maxval);
+    check(err == SM_OK && emitted.size() == result.num_regions &&
+              memcmp(emitted.data(), result.regions, emitted.size() * sizeof(sm_region)) == 0,
+          what);
+    snprintf(what, sizeof(what), "stream holds a fraction of the regions (%zu of %zu)", peak, result.num_regions);
+    check(peak > 0 && peak * 4 < result.num_regions, what);
+    sm_result_release(&result);
+    free(img.data);
+}
+
+static int run(const std::string &cmd) {
+    int status = system((cmd + " > /dev/null 2>&1").c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// One lane with one buffer set, so each image reuses the previous one's
+// buffers whether it is larger or smaller; outputs match a direct
+// sm_segment, and an unreadable input fails only itself
+static void test_batch() {
+    std::mt19937 rng(23);
+    const int sizes[][2] = { { 20, 10 }, { 64, 48 }, { 30, 30 }, { 90, 70 }, { 8, 8 } };
+    const int count = sizeof(sizes) / sizeof(sizes[0]);
+    std::string in = path("batch_in"), out = path("batch_out");
+    check(run("mkdir -p " + in + " " + out) == 0, "create the batch directories");
+    std::vector<Image> images;
+    for (int k = 0; k < count; k++) {
+        images.push_back(blocky_image(sizes[k][0], sizes[k][1], 255, rng));
+        std::string file = in + "/img" + std::to_string(k) + ".pgm";
+        write_pgm(file.c_str(), &images.back());
+    }
+    write_file(in + "/broken.pgm", "P5 4 4 255\n");
+    std::string cmd = "./batch_split_merge " + in + " " + out + " --lanes=1 --depth=1";
+    check(run(cmd) == 1, "batch_split_merge fails the run when an input is unreadable");
+
+    sm_params params;
+    sm_default_params(&params);
+    bool same = true;
+    for (int k = 0; k < count && same; k++) {
+        sm_result result = {0};
+        sm_segment(&images[k], &params, &result);
+        std::string file = out + "/img" + std::to_string(k) + ".pgm";
+        Image *written = read_pgm(file.c_str());
+        size_t n = (size_t)images[k].width * images[k].height;
+        same = written->width == images[k].width && written->height == images[k].height;
+        for (size_t i = 0; same && i < n; i++)
+            same = written->data[i] == (uint8_t)(label_at(&result, i) % 1024);
+        free_image(written);
+        sm_result_release(&result);
+        free(images[k].data);
+    }
+    check(same, "batch_split_merge writes every readable image's labels");
+    remove((in + "/broken.pgm").c_str());
+    check(run(cmd) == 0, "batch_split_merge succeeds once every input reads");
+}
+
+// Freed buffers come back for requests of the same class, whatever size
+// the caller passed to pool_free; reused buffers from pool_calloc are
+// cleared again; 2 MiB+ buffers are huge-page aligned; large exact-size
+// buffers are reused too
+static void test_pool() {
+    pool_trim();
+    uint8_t *a = (uint8_t *)pool_alloc(100000);
+    memset(a, 0xab, 100000);
+    pool_free(a, 1);
+    uint8_t *b = (uint8_t *)pool_alloc(70000);
+    check(b == a, "pool_alloc reuses a freed buffer of the same class");
+    pool_free(b, 70000);
+    uint8_t *c = (uint8_t *)pool_calloc(120000);
+    check(c == a && std::count(c, c + 120000, 0) == 120000, "pool_calloc clears a reused buffer");
+    pool_free(c, 120000);
+
+    size_t big = (size_t)3 << 20;
+    uint8_t *d = (uint8_t *)pool_alloc(big);
+    check(((uintptr_t)d & (((uintptr_t)2 << 20) - 1)) == 0, "pool_alloc aligns 2 MiB+ buffers to 2 MiB");
+    d[big - 1] = 1;
+    pool_free(d, big);
+    uint8_t *e = (uint8_t *)pool_alloc(big + 4096);
+    check(e == d, "pool_alloc reuses a freed 2 MiB+ buffer");
+    pool_free(e, big + 4096);
+
+    // More buffers than a class caches, all live at once, then freed
+    std::vector<uint32_t *> many(40);
+    for (size_t k = 0; k < many.size(); k++) {
+        many[k] = (uint32_t *)pool_alloc(65536);
+        std::fill(many[k], many[k] + 16384, (uint32_t)k);
+    }
+    bool intact = true;
+    for (size_t k = 0; k < many.size(); k++) {
+        intact &= std::count(many[k], many[k] + 16384, (uint32_t)k) == 16384;
+        pool_free(many[k], 65536);
+    }
+    check(intact, "pool buffers live at once do not overlap");
+
+    // Large buffers are mapped at their own size and kept for requests
+    // they fit closely
+    size_t large = (size_t)80 << 20;
+    uint8_t *f = (uint8_t *)pool_alloc(large);
+    f[large - 1] = 1;
+    pool_free(f, large);
+    uint8_t *g = (uint8_t *)pool_alloc(large - ((size_t)4 << 20));
+    check(g == f, "pool_alloc reuses a freed large buffer that fits closely");
+    uint8_t *h = (uint8_t *)pool_calloc(large);
+    check(h != f && h[large - 1] == 0, "pool_alloc maps a new large buffer while the cached one is in use");
+    pool_free(g, large);
+    pool_free(h, large);
+    uint8_t *k = (uint8_t *)pool_alloc(large * 2);
+    check(k != f && k != h, "pool_alloc does not hand out a large buffer that is too small");
+    pool_free(k, large * 2);
+    pool_free(NULL, 0);
+    pool_trim();
+}
+
+static void test_tiled(int maxval) {
+    std::mt19937 rng(11);
+    int width = 75, height = 50, tile = 16;
+    Image img = blocky_image(width, height, maxval, rng);
+    size_t pixel_bytes = IMAGE_PIXEL_BYTES(&img);
+    std::string file = path("image.tiled");
+    write_tiled(file.c_str(), &img, tile, TILED_NONE);
+
+    TiledImage *t = tiled_open(file.c_str());
+    check(t->width == width && t->height == height && t->maxval == maxval && t->tile_size == tile,
+          "tiled_open returns the header");
+    bool same = true;
+    for (int k = 0; k < 50 && same; k++) {
+        // Overlapping the image, possibly hanging over its edges
+        int x = (int)(rng() % (width + 5)) - 5, y = (int)(rng() % (height + 5)) - 5;
+        int w = 6 + (int)(rng() % 40), h = 6 + (int)(rng() % 40);
+        Image *rect = tiled_read_rect(t, x, y, w, h);
+        int x0 = std::max(x, 0), y0 = std::max(y, 0);
+        int x1 = std::min(x + w, width), y1 = std::min(y + h, height);
+        same = rect->width == x1 - x0 && rect->height == y1 - y0;
+        for (int yy = y0; same && yy < y1; yy++)
+            same = memcmp(rect->data + (size_t)(yy - y0) * rect->width * pixel_bytes,
+                          img.data + ((size_t)yy * width + x0) * pixel_bytes, (size_t)(x1 - x0) * pixel_bytes) == 0;
+        free_image(rect);
+    }
+    check(same, maxval > 255 ? "tiled_read_rect returns 16-bit pixels" : "tiled_read_rect returns 8-bit pixels");
+    int tiles = t->tiles_x * t->tiles_y;
+    tiled_close(t);
+
+    // Corruptions of the first index entry: an empty tile, a tile past the
+    // end of the file, and a tile overlapping the header
+    const long header = 32;
+    std::string bad = path("bad.tiled");
+    uint32_t stored = 0;
+    copy_file(file, bad);
+    patch_file(bad, header + 8, &stored, sizeof(stored));
+    check(exits_failing([&] { tiled_open(bad.c_str()); }), "tiled_open rejects an empty tile");
+    uint64_t offset = (uint64_t)1 << 40;
+    copy_file(file, bad);
+    patch_file(bad, header, &offset, sizeof(offset));
+    check(exits_failing([&] { tiled_open(bad.c_str()); }), "tiled_open rejects a tile past the end");
+    offset = header + (uint64_t)tiles * 16 - 8;
+    copy_file(file, bad);
+    patch_file(bad, header, &offset, sizeof(offset));
+    check(exits_failing([&] { tiled_open(bad.c_str()); }), "tiled_open rejects a tile inside the index");
+    free(img.data);
+}
+
+static int validate(const std::string &a, const std::string &b) {
+    std::string cmd = "./validate_split_merge " + a + " " + b + " > /dev/null";
+    int status = system(cmd.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void test_validator() {
+    std::mt19937 rng(3);
+    int width = 40, height = 30;
+    size_t n = (size_t)width * height;
+    Image img = blocky_image(width, height, 255, rng);
+    sm_params params;
+    sm_default_params(&params);
+    sm_result result = {0};
+    sm_segment(&img, &params, &result);
+    const uint32_t *labels = (const uint32_t *)result.labels;
+
+    // The same partition renumbered, in 64-bit labels
+    std::vector<uint64_t> renumbered(n);
+    for (size_t i = 0; i < n; i++)
+        renumbered[i] = ((uint64_t)labels[i] << 20) ^ 0x5a5a5;
+    // One pixel of a larger region moved to a region of its own
+    std::vector<uint32_t> split(labels, labels + n);
+    size_t moved = 0;
+    while (moved < n && (moved == 0 || labels[moved] != labels[moved - 1]))
+        moved++;
+    split[moved] = (uint32_t)n;
+    // Two neighbouring regions merged
+    std::vector<uint32_t> merged(labels, labels + n);
+    size_t other = 1;
+    while (other < n && labels[other] == labels[0])
+        other++;
+    for (size_t i = 0; i < n; i++)
+        if (merged[i] == labels[other])
+            merged[i] = labels[0];
+
+    std::string a = path("a.npy"), b = path("b.npy"), s = path("split.npy"), m = path("merged.npy");
+    std::string r = path("a.rle");
+    write_label_map(a.c_str(), labels, width, height, 4);
+    write_label_map(b.c_str(), renumbered.data(), width, height, 8);
+    write_label_map(s.c_str(), split.data(), width, height, 4);
+    write_label_map(m.c_str(), merged.data(), width, height, 4);
+    RleWriter *w = rle_open(r.c_str(), width, height, 4);
+    for (int y = 0; y < height; y++)
+        rle_write_row(w, y, labels + (size_t)y * width, 4, width);
+    rle_close(w);
+
+    check(validate(a, a) == 0, "validator accepts identical maps");
+    check(validate(a, b) == 0, "validator accepts renumbered 64-bit labels");
+    check(validate(a, r) == 0 && validate(r, b) == 0, "validator accepts the RLE form");
+    check(moved < n && validate(a, s) == 1 && validate(s, a) == 1, "validator rejects a split region");
+    check(other < n && validate(a, m) == 1 && validate(m, a) == 1, "validator rejects merged regions");
+    sm_result_release(&result);
+    free(img.data);
+}
+
+int main() {
+    char tmpl[] = "/tmp/test_split_merge.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    dir = tmpl;
+
+    test_update(4, 255, 4);
+    test_update(8, 255, 4);
+    test_update(8, 1000, 8);
+    test_update(4, 255, 2);
+    test_update_clip();
+    test_result_reuse();
+    test_pgm_header();
+    test_pgm_16bit();
+    test_ppm();
+    test_label_map(2);
+    test_label_map(4);
+    test_label_map(8);
+    test_rle();
+    test_narrow_labels();
+    test_stream(4, 255);
+    test_stream(8, 255);
+    test_stream(8, 1000);
+    test_batch();
+    test_pool();
+    test_tiled(255);
+    test_tiled(1000);
+    test_validator();
+
+    std::string cmd = "rm -rf " + dir;
+    if (system(cmd.c_str()) != 0)
+        fprintf(stderr, "Could not remove %s\n", dir.c_str());
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../common/image_io.h"
+#include "../common/splitmerge.h"
+#include "../common/cli.h"
+
+// Tiled-image driver. "convert" turns a PGM/PPM into the tiled container;
+// "roi" segments a region of interest of a tiled image, reading only the
+// tiles under it plus a halo of neighbouring tiles so regions that leave
+// the ROI are still followed for a tile's width. Regions reaching past the
+// halo are cut at the window edge; --cut writes a mask of them.
+
+#define OPTIONS (CLI_CONNECTIVITY | CLI_THRESHOLD | CLI_ENGINE | CLI_LABEL_BYTES | CLI_LABELS | CLI_METRICS | \
+                 CLI_COUNTERS | CLI_TRACE)
+
+static void usage(const char *prog) {
+    printf("Usage: %s convert input.pgm output.smt [--tile=N] [--lz4]\n", prog);
+    printf("       %s roi input.smt output.pgm X,Y,W,H [--halo=N] [options]\n", prog);
+    printf("  --tile=N                           tile edge in pixels (default 256)\n");
+    printf("  --lz4                              LZ4-compress tiles (needs make LZ4=1)\n");
+    printf("  --halo=N                           tiles of context around the ROI (default 1)\n");
+    printf("  --cut=FILE.pgm                     mask (255) of regions that reach the window edge\n");
+    print_options(OPTIONS);
+}
+
+static int convert(int argc, char *argv[]) {
+    int tile_size = 256, compression = TILED_NONE;
+    for (int i = 4; i < argc; i++) {
+        if (strncmp(argv[i], "--tile=", 7) == 0 && atoi(argv[i] + 7) > 0)
+            tile_size = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--lz4") == 0)
+            compression = TILED_LZ4;
+        else
+            return -1;
+    }
+    Image *img = read_pgm(argv[2]);
+    write_tiled(argv[3], img, tile_size, compression);
+    free_image(img);
+    return 0;
+}
+
+// Window labels are linear indices into the window; map them to the
+// equivalent index in the full image. For regions that stay inside the
+// window this is the whole-image id; cut regions (see mark_cut) may differ
+template <class Label>
+static void to_global(const Label *labels, uint64_t *out, int wx, int wy, int ww,
+                      int rx, int ry, int rw, int rh, int image_width) {
+    for (int y = 0; y < rh; y++) {
+        for (int x = 0; x < rw; x++) {
+            uint64_t l = labels[(size_t)(ry - wy + y) * ww + (rx - wx + x)];
+            out[(size_t)y * rw + x] = (uint64_t)(wy + l / ww) * image_width + (wx + l % ww);
+        }
+    }
+}
+
+// Flag every window label that touches a window edge lying inside the
+// image: such a region may continue past the window, so its id need not
+// match a whole-image run
+template <class Label>
+static void mark_cut(const Label *labels, uint8_t *cut, int wx, int wy, int ww, int wh, const TiledImage *t) {
+    for (int x = 0; x < ww; x++) {
+        if (wy > 0)
+            cut[labels[x]] = 1;
+        if (wy + wh < t->height)
+            cut[labels[(size_t)(wh - 1) * ww + x]] = 1;
+    }
+    for (int y = 0; y < wh; y++) {
+        if (wx > 0)
+            cut[labels[(size_t)y * ww]] = 1;
+        if (wx + ww < t->width)
+            cut[labels[(size_t)y * ww + ww - 1]] = 1;
+    }
+}
+
+// ROI pixels whose window label is flagged become 255 in the mask
+template <class Label>
+static void cut_mask(const Label *labels, const uint8_t *cut, uint8_t *mask, int wx, int wy, int ww,
+                     int rx, int ry, int rw, int rh) {
+    for (int y = 0; y < rh; y++)
+        for (int x = 0; x < rw; x++)
+            mask[(size_t)y * rw + x] = cut[labels[(size_t)(ry - wy + y) * ww + (rx - wx + x)]] ? 255 : 0;
+}
+
+static int roi(int argc, char *argv[]) {
+    int rx, ry, rw, rh, halo = 1;
+    const char *cut_path = NULL;
+    if (argc < 5 || sscanf(argv[4], "%d,%d,%d,%d", &rx, &ry, &rw, &rh) != 4)
+        return -1;
+    cli_options opts;
+    default_options(&opts);
+    opts.params.engine = SM_ENGINE_UNION_FIND;
+    char **rest = (char **)malloc(sizeof(char *) * argc);
+    int nrest = 0;
+    for (int i = 5; i < argc; i++) {
+        if (strncmp(argv[i], "--halo=", 7) == 0)
+            halo = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--cut=", 6) == 0)
+            cut_path = argv[i] + 6;
+        else
+            rest[nrest++] = argv[i];
+    }
+    int bad = parse_options(nrest, rest, 0, OPTIONS, &opts) != 0 || halo < 0;
+    free(rest);
+    if (bad)
+        return -1;
+
+    sm_metrics metrics;
+    sm_metrics_init(&metrics, 0);
+    if (opts.counters)
+        enable_counters(&metrics);
+    sm_metrics *m = opts.metrics || opts.trace_path ? &metrics : NULL;
+    start_trace(&opts);
+    opts.params.metrics = m;
+
+    sm_mark start = sm_metrics_start(m);
+    TiledImage *t = tiled_open(argv[2]);
+    if (rx < 0 || ry < 0 || rw <= 0 || rh <= 0 || rx + rw > t->width || ry + rh > t->height) {
+        fprintf(stderr, "ROI %d,%d,%d,%d is outside the %dx%d image\n", rx, ry, rw, rh, t->width, t->height);
+        exit(EXIT_FAILURE);
+    }
+    int wx = rx, wy = ry, ww = rw, wh = rh;
+    tiled_window(t, halo, &wx, &wy, &ww, &wh);
+    Image *window = tiled_read_rect(t, wx, wy, ww, wh);
+    sm_metrics_stop(m, SM_PHASE_READ, start);
+
+    sm_result result = {0};
+    int err = sm_segment(window, &opts.params, &result);
+    if (err != SM_OK) {
+        fprintf(stderr, "Segmentation failed: %s\n", sm_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    start = sm_metrics_start(m);
+    uint64_t *global = (uint64_t *)malloc((size_t)rw * rh * sizeof(uint64_t));
+    if (result.label_bytes == 8)
+        to_global((const uint64_t *)result.labels, global, wx, wy, ww, rx, ry, rw, rh, t->width);
+    else
+        to_global((const uint32_t *)result.labels, global, wx, wy, ww, rx, ry, rw, rh, t->width);
+
+    Image out = { rw, rh, 255, (uint8_t *)malloc((size_t)rw * rh), NULL, 0 };
+    for (size_t i = 0; i < (size_t)rw * rh; i++)
+        out.data[i] = global[i] % 1024;
+    sm_metrics_stop(m, SM_PHASE_RENDER, start);
+    start = sm_metrics_start(m);
+    write_pgm(argv[3], &out);
+
+    if (opts.labels_path) {
+        // Global ids need 64 bits once the full image passes 2^32 pixels
+        if ((uint64_t)t->width * t->height - 1 > UINT32_MAX) {
+            write_label_map(opts.labels_path, global, rw, rh, sizeof(uint64_t));
+        } else {
+            uint32_t *narrow = (uint32_t *)malloc((size_t)rw * rh * sizeof(uint32_t));
+            for (size_t i = 0; i < (size_t)rw * rh; i++)
+                narrow[i] = (uint32_t)global[i];
+            write_label_map(opts.labels_path, narrow, rw, rh, sizeof(uint32_t));
+            free(narrow);
+        }
+    }
+    if (cut_path) {
+        uint8_t *cut = (uint8_t *)calloc((size_t)ww * wh, 1);
+        Image mask = { rw, rh, 255, (uint8_t *)malloc((size_t)rw * rh), NULL, 0 };
+        if (result.label_bytes == 8) {
+            mark_cut((const uint64_t *)result.labels, cut, wx, wy, ww, wh, t);
+            cut_mask((const uint64_t *)result.labels, cut, mask.data, wx, wy, ww, rx, ry, rw, rh);
+        } else {
+            mark_cut((const uint32_t *)result.labels, cut, wx, wy, ww, wh, t);
+            cut_mask((const uint32_t *)result.labels, cut, mask.data, wx, wy, ww, rx, ry, rw, rh);
+        }
+        write_pgm(cut_path, &mask);
+        free(mask.data);
+        free(cut);
+    }
+    sm_metrics_stop(m, SM_PHASE_WRITE, start);
+    if (opts.metrics)
+        write_metrics(&opts, "tile_split_merge", rw, rh, m, NULL, 0);
+    finish_trace(&opts, "tile_split_merge");
+
+    free(out.data);
+    free(global);
+    sm_result_release(&result);
+    free_image(window);
+    tiled_close(t);
+    sm_metrics_free(&metrics);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int err = -1;
+    if (argc >= 4 && strcmp(argv[1], "convert") == 0)
+        err = convert(argc, argv);
+    else if (argc >= 5 && strcmp(argv[1], "roi") == 0)
+        err = roi(argc, argv);
+    if (err != 0)
+        usage(argv[0]);
+    return err;
+}
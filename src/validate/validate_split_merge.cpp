@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../common/image_io.h"
+
+// Partition-equivalence validator. Two label maps describe the same
+// segmentation when their labels are related by a bijection, whatever the
+// numbering: every label of A always meets the same label of B and vice
+// versa. One pass over the pixels records, for each label on either side,
+// the first partner it met; any other partner marks the label as split (a
+// region of A spread over several regions of B) or merged (a region of B
+// covering several regions of A).
+//
+// Both inputs are read a chunk of rows at a time, .npy maps through a
+// read-only mapping whose pages are dropped once compared and .rle files
+// through the streaming reader, so memory holds one chunk plus one table
+// entry per region and gigapixel maps need not fit in RAM. Runs of equal
+// label pairs, the common case inside regions, skip the table lookups.
+
+#define CHUNK_BYTES ((size_t)64 << 20)
+
+// Open-addressing label -> first partner table, grown at half load
+struct PartnerTable {
+    uint64_t *keys;
+    uint64_t *partners;
+    uint8_t *state;     // 0 empty, 1 set, 2 set and met a second partner
+    size_t capacity;
+    size_t count;
+    size_t conflicts;
+
+    PartnerTable() : keys(NULL), partners(NULL), state(NULL), capacity(0), count(0), conflicts(0) {
+        resize(1 << 16);
+    }
+
+    ~PartnerTable() {
+        free(keys);
+        free(partners);
+        free(state);
+    }
+
+    static inline size_t hash(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        return (size_t)k;
+    }
+
+    void resize(size_t cap) {
+        uint64_t *old_keys = keys, *old_partners = partners;
+        uint8_t *old_state = state;
+        size_t old_cap = capacity;
+        keys = (uint64_t *)malloc(cap * sizeof(uint64_t));
+        partners = (uint64_t *)malloc(cap * sizeof(uint64_t));
+        state = (uint8_t *)calloc(cap, 1);
+        if (!keys || !partners || !state) {
+            fprintf(stderr, "Out of memory for %zu regions\n", count);
+            exit(EXIT_FAILURE);
+        }
+        capacity = cap;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old_state[i])
+                continue;
+            size_t j = hash(old_keys[i]) & (cap - 1);
+            while (state[j])
+                j = (j + 1) & (cap - 1);
+            keys[j] = old_keys[i];
+            partners[j] = old_partners[i];
+            state[j] = old_state[i];
+        }
+        free(old_keys);
+        free(old_partners);
+        free(old_state);
+    }
+
+    // Record that key met partner; returns false if key had already met a
+    // different one
+    inline bool meet(uint64_t key, uint64_t partner) {
+        size_t i = hash(key) & (capacity - 1);
+        while (state[i]) {
+            if (keys[i] == key) {
+                if (partners[i] == partner)
+                    return true;
+                if (state[i] == 1) {
+                    state[i] = 2;
+                    conflicts++;
+                }
+                return false;
+            }
+            i = (i + 1) & (capacity - 1);
+        }
+        keys[i] = key;
+        partners[i] = partner;
+        state[i] = 1;
+        if (++count * 2 > capacity)
+            resize(capacity * 2);
+        return true;
+    }
+};
+
+// Rows of one input as uint64 labels, whatever the file holds
+struct LabelSource {
+    const char *path;
+    int width, height;
+    LabelMap map;
+    RleReader *rle;
+    size_t next_row;    // first row not yet released (npy)
+
+    bool open(const char *p) {
+        path = p;
+        rle = NULL;
+        memset(&map, 0, sizeof(map));
+        next_row = 0;
+        FILE *fp = fopen(p, "rb");
+        if (!fp) {
+            perror(p);
+            return false;
+        }
+        char magic[8] = {0};
+        size_t got = fread(magic, 1, sizeof(magic), fp);
+        fclose(fp);
+        if (got == 8 && memcmp(magic, "SMRLE01\n", 8) == 0) {
+            rle = rle_reader_open(p);
+            width = rle->width;
+            height = rle->height;
+        } else if (got >= 6 && memcmp(magic, "\x93NUMPY", 6) == 0) {
+            open_label_map(p, &width, &height, &map);
+        } else {
+            fprintf(stderr, "%s: neither a .npy nor an .rle label map\n", p);
+            return false;
+        }
+        return true;
+    }
+
+    void read_row(int y, uint64_t *out) {
+        if (rle) {
+            if (rle->label_bytes == 8) {
+                rle_read_row(rle, y, out);
+            } else {
+                // Decode into the upper end, then widen in place front to back
+                uint8_t *narrow = (uint8_t *)(out + width) - (size_t)width * rle->label_bytes;
+                rle_read_row(rle, y, narrow);
+                widen(narrow, rle->label_bytes, out);
+            }
+            return;
+        }
+        const uint8_t *src = (const uint8_t *)map.labels + (size_t)y * width * map.label_bytes;
+        if (map.label_bytes == 8)
+            memcpy(out, src, width * sizeof(uint64_t));
+        else
+            widen(src, (int)map.label_bytes, out);
+    }
+
+    void widen(const void *src, int label_bytes, uint64_t *out) {
+        if (label_bytes == 2) {
+            const uint16_t *narrow = (const uint16_t *)src;
+            for (int x = 0; x < width; x++)
+                out[x] = narrow[x];
+        } else {
+            const uint32_t *narrow = (const uint32_t *)src;
+            for (int x = 0; x < width; x++)
+                out[x] = narrow[x];
+        }
+    }
+
+    // Drop the mapped pages of rows before end, so resident memory stays at
+    // about one chunk however large the map
+    void release(size_t end) {
+        if (rle || end <= next_row)
+            return;
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        uintptr_t lo = (uintptr_t)map.labels + next_row * width * map.label_bytes;
+        uintptr_t hi = (uintptr_t)map.labels + end * width * map.label_bytes;
+        lo = (lo + page - 1) / page * page;
+        hi = hi / page * page;
+        if (hi > lo)
+            madvise((void *)lo, hi - lo, MADV_DONTNEED);
+        next_row = end;
+    }
+
+    void close() {
+        if (rle)
+            rle_reader_close(rle);
+        else
+            close_label_map(&map);
+    }
+};
+
+static void usage(const char *prog) {
+    printf("Usage: %s a.npy|a.rle b.npy|b.rle [options]\n", prog);
+    printf("  --chunk-rows=N                     rows compared per chunk (default about 64 MB)\n");
+    printf("Exits 0 if both describe the same partition, 1 if not.\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 2;
+    }
+    long chunk_rows = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--chunk-rows=", 13) == 0 && (chunk_rows = atol(argv[i] + 13)) > 0)
+            continue;
+        usage(argv[0]);
+        return 2;
+    }
+
+    LabelSource a, b;
+    if (!a.open(argv[1]) || !b.open(argv[2]))
+        return 2;
+    if (a.width != b.width || a.height != b.height) {
+        printf("%s is %dx%d but %s is %dx%d\n", a.path, a.width, a.height, b.path, b.width, b.height);
+        printf("Validation Failed!\n");
+        return 1;
+    }
+    int width = a.width, height = a.height;
+    if (chunk_rows == 0)
+        chunk_rows = CHUNK_BYTES / ((size_t)width * 2 * sizeof(uint64_t)) + 1;
+
+    // The first pixel whose pair contradicts an earlier one
+    long first_x = -1, first_y = -1;
+    uint64_t first_a = 0, first_b = 0;
+
+    PartnerTable a_to_b, b_to_a;
+    uint64_t *row_a = (uint64_t *)malloc((size_t)width * sizeof(uint64_t));
+    uint64_t *row_b = (uint64_t *)malloc((size_t)width * sizeof(uint64_t));
+    if (!row_a || !row_b) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    for (long y0 = 0; y0 < height; y0 += chunk_rows) {
+        long y1 = y0 + chunk_rows < height ? y0 + chunk_rows : height;
+        for (long y = y0; y < y1; y++) {
+            a.read_row((int)y, row_a);
+            b.read_row((int)y, row_b);
+            uint64_t last_a = row_a[0] + 1, last_b = 0;
+            for (int x = 0; x < width; x++) {
+                uint64_t la = row_a[x], lb = row_b[x];
+                if (la == last_a && lb == last_b)
+                    continue;
+                last_a = la;
+                last_b = lb;
+                bool ok = a_to_b.meet(la, lb);
+                ok &= b_to_a.meet(lb, la);
+                if (!ok && first_x < 0) {
+                    first_x = x;
+                    first_y = y;
+                    first_a = la;
+                    first_b = lb;
+                }
+            }
+        }
+        a.release(y1);
+        b.release(y1);
+    }
+    free(row_a);
+    free(row_b);
+
+    printf("%s: %dx%d, %zu regions\n", a.path, width, height, a_to_b.count);
+    printf("%s: %dx%d, %zu regions\n", b.path, width, height, b_to_a.count);
+    bool same = a_to_b.conflicts == 0 && b_to_a.conflicts == 0;
+    if (!same) {
+        printf("split:  %zu regions of %s are split in %s\n", a_to_b.conflicts, a.path, b.path);
+        printf("merged: %zu regions of %s merge several regions of %s\n", b_to_a.conflicts, b.path, a.path);
+        printf("first difference at (%ld, %ld): label %llu in %s, %llu in %s\n", first_x, first_y,
+               (unsigned long long)first_a, a.path, (unsigned long long)first_b, b.path);
+    }
+    printf("Validation %s!\n", same ? "Passed" : "Failed");
+    a.close();
+    b.close();
+    return same ? 0 : 1;
+}
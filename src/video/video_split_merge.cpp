@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../common/image_io.h"
+#include "../common/splitmerge.h"
+#include "../common/cli.h"
+
+// Sequence driver for video: reads PGM frames back to back (e.g. a camera
+// pipe of concatenated P5 images) and segments each one incrementally.
+// Every frame is compared with the previous one tile by tile; unchanged
+// tiles keep their labels, and the clusters of changed tiles all go to one
+// sm_update_rects call, which relabels them together with the components
+// they touch. When most tiles changed, or the update itself falls back to
+// a full pass, the frame is segmented from scratch.
+//
+// Each region also carries a stable id. A region whose label (its first
+// pixel) survives keeps its id. A new label inherits the id of the previous
+// frame's region it overlaps most among those whose label is gone, so an
+// object moving left or up (whose first pixel changes every frame) keeps
+// its id; each gone id goes to one new label, largest overlap first.
+// Anything else gets a fresh id. The output frames show id % 256, so
+// static objects keep their grey level.
+
+#define DEFAULT_TILE 64
+#define DEFAULT_REFRESH 0.5
+#define OPTIONS (CLI_CONNECTIVITY | CLI_THRESHOLD | CLI_ENGINE | CLI_LABEL_BYTES | CLI_STATS | CLI_METRICS | \
+                 CLI_COUNTERS | CLI_TRACE)
+
+// Whether columns [x0, x1) (in bytes) of rows [y0, y1) differ between a and b
+static bool tile_differs(const uint8_t *a, const uint8_t *b, size_t stride, size_t x0, size_t x1, int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *ra = a + (size_t)y * stride, *rb = b + (size_t)y * stride;
+        size_t x = x0;
+#ifdef __SSE2__
+        __m128i diff = _mm_setzero_si128();
+        for (; x + 16 <= x1; x += 16)
+            diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(ra + x)),
+                                                    _mm_loadu_si128((const __m128i *)(rb + x))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff)
+            return true;
+#endif
+        for (; x < x1; x++)
+            if (ra[x] != rb[x])
+                return true;
+    }
+    return false;
+}
+
+struct TileBox {
+    int x0, y0, x1, y1;     // inclusive, in tiles
+};
+
+// Bounding boxes of the 8-connected clusters of dirty tiles. An object
+// moving across a tile border dirties neighbouring tiles, and one rectangle
+// over their box keeps the update's list of rectangles short.
+static std::vector<TileBox> tile_clusters(std::vector<uint8_t> &dirty, int tiles_x, int tiles_y) {
+    std::vector<TileBox> boxes;
+    std::vector<int> stack;
+    for (int t = 0; t < tiles_x * tiles_y; t++) {
+        if (dirty[t] != 1)
+            continue;
+        TileBox box = { t % tiles_x, t / tiles_x, t % tiles_x, t / tiles_x };
+        dirty[t] = 2;
+        stack.push_back(t);
+        while (!stack.empty()) {
+            int tx = stack.back() % tiles_x, ty = stack.back() / tiles_x;
+            stack.pop_back();
+            box.x0 = std::min(box.x0, tx);
+            box.y0 = std::min(box.y0, ty);
+            box.x1 = std::max(box.x1, tx);
+            box.y1 = std::max(box.y1, ty);
+            for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, tiles_y - 1); ny++)
+                for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, tiles_x - 1); nx++)
+                    if (dirty[ny * tiles_x + nx] == 1) {
+                        dirty[ny * tiles_x + nx] = 2;
+                        stack.push_back(ny * tiles_x + nx);
+                    }
+        }
+        boxes.push_back(box);
+    }
+    return boxes;
+}
+
+static uint64_t label_at(const sm_result *r, size_t i) {
+    return r->label_bytes == 8 ? ((const uint64_t *)r->labels)[i] : ((const uint32_t *)r->labels)[i];
+}
+
+// Stable ids, indexed by label (labels are pixel indices)
+struct Tracker {
+    std::vector<uint64_t> id_of;
+    std::vector<uint8_t> prev_labels;   // the previous frame's labels
+    std::vector<uint64_t> prev_regions; // and its region labels, in order
+    std::vector<size_t> slot;           // index of each new label, SIZE_MAX otherwise
+    uint64_t next_id;
+
+    Tracker() : next_id(1) {}
+
+    void first_frame(const sm_result *r) {
+        id_of.assign((size_t)r->width * r->height, 0);
+        slot.assign((size_t)r->width * r->height, SIZE_MAX);
+        prev_regions.resize(r->num_regions);
+        for (size_t i = 0; i < r->num_regions; i++) {
+            prev_regions[i] = r->regions[i].label;
+            id_of[r->regions[i].label] = next_id++;
+        }
+    }
+
+    // Call before labels change
+    void save(const sm_result *r) {
+        size_t bytes = (size_t)r->width * r->height * r->label_bytes;
+        prev_labels.resize(bytes);
+        memcpy(prev_labels.data(), r->labels, bytes);
+    }
+
+    uint64_t prev_label(const sm_result *r, size_t i) const {
+        return r->label_bytes == 8 ? ((const uint64_t *)prev_labels.data())[i]
+                                   : ((const uint32_t *)prev_labels.data())[i];
+    }
+
+    // Both region tables are in label order, so one merge walk finds the
+    // new labels. A label is current exactly when it is its own label (its
+    // first pixel), which tells the previous regions that are gone apart.
+    void next_frame(const sm_result *r) {
+        std::vector<uint64_t> current(r->num_regions), fresh;
+        size_t p = 0;
+        for (size_t i = 0; i < r->num_regions; i++) {
+            uint64_t label = current[i] = r->regions[i].label;
+            while (p < prev_regions.size() && prev_regions[p] < label)
+                p++;
+            if (p < prev_regions.size() && prev_regions[p] == label)
+                continue;
+            slot[label] = fresh.size();
+            fresh.push_back(label);
+        }
+        prev_regions.swap(current);
+        if (fresh.empty())
+            return;
+
+        // Pixels each new label shares with each previous region that is gone
+        std::vector<std::unordered_map<uint64_t, uint64_t>> overlap(fresh.size());
+        size_t n = (size_t)r->width * r->height;
+        for (size_t i = 0; i < n; i++) {
+            size_t k = slot[label_at(r, i)];
+            if (k == SIZE_MAX)
+                continue;
+            uint64_t before = prev_label(r, i);
+            if (label_at(r, before) != before)
+                overlap[k][before]++;
+        }
+        struct Match {
+            uint64_t pixels, label, before;
+        };
+        std::vector<Match> matches;
+        for (size_t k = 0; k < fresh.size(); k++)
+            for (const auto &o : overlap[k])
+                matches.push_back({ o.second, fresh[k], o.first });
+        std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+            if (a.pixels != b.pixels)
+                return a.pixels > b.pixels;
+            return a.label != b.label ? a.label < b.label : a.before < b.before;
+        });
+        std::vector<uint8_t> matched(fresh.size());
+        std::unordered_set<uint64_t> inherited;
+        for (const Match &m : matches) {
+            size_t k = slot[m.label];
+            if (matched[k] || !inherited.insert(m.before).second)
+                continue;
+            matched[k] = 1;
+            id_of[m.label] = id_of[m.before];
+        }
+        for (size_t k = 0; k < fresh.size(); k++) {
+            if (!matched[k])
+                id_of[fresh[k]] = next_id++;
+            slot[fresh[k]] = SIZE_MAX;
+        }
+    }
+};
+
+static void render(const sm_result *r, const Tracker &t, uint8_t *out) {
+    size_t n = (size_t)r->width * r->height;
+    if (r->label_bytes == 8) {
+        const uint64_t *labels = (const uint64_t *)r->labels;
+        for (size_t i = 0; i < n; i++)
+            out[i] = (uint8_t)t.id_of[labels[i]];
+    } else {
+        const uint32_t *labels = (const uint32_t *)r->labels;
+        for (size_t i = 0; i < n; i++)
+            out[i] = (uint8_t)t.id_of[labels[i]];
+    }
+}
+
+static void write_regions(FILE *fp, int frame, const sm_result *r, const Tracker &t) {
+    for (size_t i = 0; i < r->num_regions; i++) {
+        const sm_region &g = r->regions[i];
+        fprintf(fp, "%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                frame, t.id_of[g.label], g.label, g.pixel_count, g.intensity_sum, g.min_x, g.min_y, g.max_x, g.max_y);
+    }
+}
+
+// Next frame into img->data (width * height pixels); 0 at end of input
+static int read_frame(FILE *in, Image *img, int frame) {
+    PgmStream *s = pgm_stream_open(in);
+    if (!s)
+        return 0;
+    if (s->width != img->width || s->height != img->height || (s->maxval > 255) != (img->maxval > 255)) {
+        fprintf(stderr, "Frame %d is %dx%d (maxval %d), expected %dx%d (maxval %d)\n", frame, s->width,
+                s->height, s->maxval, img->width, img->height, img->maxval);
+        exit(EXIT_FAILURE);
+    }
+    size_t row_bytes = (size_t)img->width * IMAGE_PIXEL_BYTES(img);
+    for (int y = 0; y < img->height; y++) {
+        if (!pgm_stream_read_row(s, img->data + y * row_bytes)) {
+            fprintf(stderr, "Frame %d: truncated image data after %d rows\n", frame, y);
+            exit(EXIT_FAILURE);
+        }
+    }
+    pgm_stream_close(s);
+    return 1;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s frames.pgm|- ids.pgm|- [options]\n", prog);
+    printf("  --tile=N                           tile edge for frame differencing (default %d)\n", DEFAULT_TILE);
+    printf("  --refresh=F                        re-segment whole frames when over F of tiles changed (default %.1f)\n",
+           DEFAULT_REFRESH);
+    printf("  --regions=FILE.csv                 per-frame region table with stable ids\n");
+    print_options(OPTIONS);
+}
+
+int main(int argc, char *argv[]) {
+    cli_options opts;
+    default_options(&opts);
+    opts.params.engine = SM_ENGINE_UNION_FIND;
+    int tile = DEFAULT_TILE;
+    double refresh = DEFAULT_REFRESH;
+    const char *regions_path = NULL;
+    std::vector<char *> rest;
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--tile=", 7) == 0)
+            tile = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--refresh=", 10) == 0)
+            refresh = atof(argv[i] + 10);
+        else if (strncmp(argv[i], "--regions=", 10) == 0 && argv[i][10])
+            regions_path = argv[i] + 10;
+        else
+            rest.push_back(argv[i]);
+    }
+    if (argc < 3 || parse_options((int)rest.size(), rest.data(), 0, OPTIONS, &opts) != 0 || tile < 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    opts.params.region_stats = 1;
+
+    FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+    if (!in) {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+    FILE *out = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "wb");
+    if (!out) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+    FILE *regions = NULL;
+    if (regions_path) {
+        regions = fopen(regions_path, "w");
+        if (!regions) {
+            perror("Error opening regions file");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(regions, "frame,id,label,pixel_count,intensity_sum,min_x,min_y,max_x,max_y\n");
+    }
+
+    sm_metrics metrics;
+    sm_metrics_init(&metrics, 0);
+    if (opts.counters)
+        enable_counters(&metrics);
+    sm_metrics *m = opts.metrics || opts.trace_path ? &metrics : NULL;
+    start_trace(&opts);
+    opts.params.metrics = m;
+
+    // The first frame fixes the geometry
+    PgmStream *first = pgm_stream_open(in);
+    if (!first) {
+        fprintf(stderr, "Unsupported file format!\n");
+        exit(EXIT_FAILURE);
+    }
+    Image work = { first->width, first->height, first->maxval, NULL, NULL, 0 };
+    Image next = work;
+    size_t pixel_bytes = IMAGE_PIXEL_BYTES(&work), stride = (size_t)work.width * pixel_bytes;
+    size_t frame_bytes = stride * work.height;
+    work.data = (uint8_t *)malloc(frame_bytes);
+    next.data = (uint8_t *)malloc(frame_bytes);
+    std::vector<uint8_t> ids((size_t)work.width * work.height);
+    if (!work.data || !next.data) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int y = 0; y < work.height; y++) {
+        if (!pgm_stream_read_row(first, work.data + y * stride)) {
+            fprintf(stderr, "Frame 0: truncated image data after %d rows\n", y);
+            exit(EXIT_FAILURE);
+        }
+    }
+    pgm_stream_close(first);
+
+    int tiles_x = (work.width + tile - 1) / tile, tiles_y = (work.height + tile - 1) / tile;
+    size_t tiles = (size_t)tiles_x * tiles_y, changed_total = 0, full_frames = 1;
+    sm_result result = {0};
+    Tracker tracker;
+    double start = cli_seconds(), segment_seconds = 0;
+
+    double t0 = cli_seconds();
+    int err = sm_segment(&work, &opts.params, &result);
+    segment_seconds += cli_seconds() - t0;
+    if (err != SM_OK) {
+        fprintf(stderr, "Segmentation failed: %s\n", sm_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    tracker.first_frame(&result);
+
+    int frame = 0;
+    std::vector<uint8_t> dirty(tiles);
+    for (;;) {
+        sm_mark mark = sm_metrics_start(m);
+        render(&result, tracker, ids.data());
+        sm_metrics_stop(m, SM_PHASE_RENDER, mark);
+        mark = sm_metrics_start(m);
+        fprintf(out, "P5\n%d %d\n255\n", work.width, work.height);
+        if (fwrite(ids.data(), 1, ids.size(), out) != ids.size()) {
+            perror("Error writing frame");
+            exit(EXIT_FAILURE);
+        }
+        if (regions)
+            write_regions(regions, frame, &result, tracker);
+        sm_metrics_stop(m, SM_PHASE_WRITE, mark);
+
+        mark = sm_metrics_start(m);
+        int more = read_frame(in, &next, frame + 1);
+        sm_metrics_stop(m, SM_PHASE_READ, mark);
+        if (!more)
+            break;
+        frame++;
+
+        t0 = cli_seconds();
+        size_t changed = 0;
+        for (int ty = 0; ty < tiles_y; ty++) {
+            int y0 = ty * tile, y1 = y0 + tile < work.height ? y0 + tile : work.height;
+            for (int tx = 0; tx < tiles_x; tx++) {
+                int x0 = tx * tile, x1 = x0 + tile < work.width ? x0 + tile : work.width;
+                dirty[(size_t)ty * tiles_x + tx] =
+                    tile_differs(work.data, next.data, stride, x0 * pixel_bytes, x1 * pixel_bytes, y0, y1);
+                changed += dirty[(size_t)ty * tiles_x + tx];
+            }
+        }
+        changed_total += changed;
+
+        if (changed > 0) {
+            tracker.save(&result);
+            if (changed > refresh * tiles) {
+                std::swap(work.data, next.data);
+                err = sm_segment(&work, &opts.params, &result);
+                full_frames++;
+            } else {
+                // One update for every cluster: work still holds the pixels
+                // the labels describe, next the new ones
+                std::vector<TileBox> boxes = tile_clusters(dirty, tiles_x, tiles_y);
+                std::vector<sm_rect> rects;
+                for (size_t b = 0; b < boxes.size(); b++) {
+                    int x0 = boxes[b].x0 * tile, y0 = boxes[b].y0 * tile;
+                    int x1 = (boxes[b].x1 + 1) * tile < work.width ? (boxes[b].x1 + 1) * tile : work.width;
+                    int y1 = (boxes[b].y1 + 1) * tile < work.height ? (boxes[b].y1 + 1) * tile : work.height;
+                    rects.push_back({ x0, y0, x1 - x0, y1 - y0 });
+                }
+                err = sm_update_rects(&next, &work, &opts.params, &result, rects.data(), (int)rects.size());
+                std::swap(work.data, next.data);
+                full_frames += result.resegmented;
+            }
+            if (err != SM_OK) {
+                fprintf(stderr, "Frame %d: segmentation failed: %s\n", frame, sm_strerror(err));
+                exit(EXIT_FAILURE);
+            }
+            tracker.next_frame(&result);
+        }
+        double seconds = cli_seconds() - t0;
+        segment_seconds += seconds;
+        if (opts.stats)
+            fprintf(stderr, "frame %d: %zu/%zu tiles changed, %zu regions, %.6f s\n", frame, changed, tiles,
+                    result.num_regions, seconds);
+    }
+
+    double total = cli_seconds() - start;
+    fprintf(stderr, "%d frames of %dx%d in %.3f s (%.3f s segmenting, %.1f frames/s), %.1f%% of tiles changed, "
+                    "%zu full frames\n",
+            frame + 1, work.width, work.height, total, segment_seconds, (frame + 1) / total,
+            frame ? 100.0 * changed_total / ((double)tiles * frame) : 0.0, full_frames);
+    if (opts.metrics)
+        write_metrics(&opts, "video_split_merge", work.width, work.height, m, NULL, 0);
+    finish_trace(&opts, "video_split_merge");
+
+    if (regions)
+        fclose(regions);
+    if (out != stdout)
+        fclose(out);
+    if (in != stdin)
+        fclose(in);
+    sm_result_release(&result);
+    sm_metrics_free(&metrics);
+    free(work.data);
+    free(next.data);
+    return 0;
+}